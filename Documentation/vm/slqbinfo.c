@@ -33,8 +33,8 @@ struct slabinfo {
 	int order, poison, reclaim_account, red_zone;
 	int batch;
 	unsigned long objects, slabs, total_objects;
-	unsigned long alloc, alloc_slab_fill, alloc_slab_new;
-	unsigned long free, free_remote;
+	unsigned long alloc, alloc_hit, alloc_slab_fill, alloc_slab_new;
+	unsigned long free, free_hit, free_remote;
 	unsigned long claim_remote_list, claim_remote_list_objects;
 	unsigned long flush_free_list, flush_free_list_objects, flush_free_list_remote;
 	unsigned long flush_rfree_list, flush_rfree_list_objects;
@@ -393,11 +393,11 @@ void slab_stats(struct slabinfo *s)
 	printf("\n");
 	printf("Slab Perf Counter\n");
 	printf("------------------------------------------------------------------------\n");
-	printf("Alloc: %8lu, partial %8lu, page allocator %8lu\n",
-		total_alloc,
+	printf("Alloc: %8lu, cpu hit %8lu, partial %8lu, page allocator %8lu\n",
+		total_alloc, s->alloc_hit,
 		s->alloc_slab_fill, s->alloc_slab_new);
-	printf("Free:  %8lu, partial %8lu, page allocator %8lu, remote %5lu\n",
-		total_free,
+	printf("Free:  %8lu, cpu hit %8lu, partial %8lu, page allocator %8lu, remote %5lu\n",
+		total_free, s->free_hit,
 		s->flush_slab_partial,
 		s->flush_slab_free,
 		s->free_remote);
@@ -884,9 +884,11 @@ void read_slab_dir(void)
 			slab->store_user = get_obj("store_user");
 			slab->batch = get_obj("batch");
 			slab->alloc = get_obj("alloc");
+			slab->alloc_hit = get_obj("alloc_hit");
 			slab->alloc_slab_fill = get_obj("alloc_slab_fill");
 			slab->alloc_slab_new = get_obj("alloc_slab_new");
 			slab->free = get_obj("free");
+			slab->free_hit = get_obj("free_hit");
 			slab->free_remote = get_obj("free_remote");
 			slab->claim_remote_list = get_obj("claim_remote_list");
 			slab->claim_remote_list_objects = get_obj("claim_remote_list_objects");
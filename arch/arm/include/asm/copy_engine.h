@@ -0,0 +1,33 @@
+/*
+ *  arch/arm/include/asm/copy_engine.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_COPY_ENGINE_H
+#define __ASM_ARM_COPY_ENGINE_H
+
+#include <linux/types.h>
+
+#define COPY_ENGINE_NEON	(1 << 0)	/* needs kernel mode NEON */
+
+struct copy_engine {
+	const char		*name;
+	void			*(*copy)(void *dest, const void *src, size_t n);
+	unsigned int		flags;
+	unsigned int		speed;		/* MB/s measured at boot */
+	struct copy_engine	*next;
+};
+
+/* The routines the running CPU can use, in the order they were timed */
+extern struct copy_engine *copy_engine_list;
+
+/* The routine memcpy() uses for copies of copy_engine_threshold and up */
+extern struct copy_engine *copy_engine_fast;
+extern unsigned long copy_engine_threshold;
+
+extern void *__memcpy_arm(void *dest, const void *src, size_t n);
+extern void *__memcpy_large(void *dest, const void *src, size_t n);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ *  linux/arch/arm/lib/copy_bench.c
+ *
+ *  Throughput of the copy routines by size and alignment
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) "copy_bench: " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <asm/copy_engine.h>
+#include <asm/page.h>
+
+/*
+ * Loading this module times every bulk copy routine known to
+ * copy_engine.c, then memcpy() and __copy_to_user() as dispatched, for
+ * sizes from 64 bytes up to max_size and for a few source/destination
+ * misalignments, and copy_page(). Each figure is the throughput of
+ * copying run_bytes in total between the same two buffers, so sizes
+ * that fit in the caches measure the routine and larger ones the
+ * memory bandwidth. The module never stays loaded.
+ */
+
+static unsigned int max_size = 1024 * 1024;
+module_param(max_size, uint, 0);
+MODULE_PARM_DESC(max_size, "Largest copy size in bytes (default 1M)");
+
+static unsigned int run_bytes = 16 * 1024 * 1024;
+module_param(run_bytes, uint, 0);
+MODULE_PARM_DESC(run_bytes, "Bytes copied per measurement (default 16M)");
+
+#define BENCH_SIZE_MIN		64
+#define BENCH_SIZE_MAX		(64 * 1024 * 1024)
+
+static const struct {
+	unsigned int src;
+	unsigned int dst;
+} bench_align[] = {
+	{ 0, 0 }, { 0, 1 }, { 1, 0 }, { 4, 0 }, { 3, 5 },
+};
+
+typedef void *(*bench_copy_fn)(void *dest, const void *src, size_t n);
+
+static bool bench_fault;
+
+static void *bench_memcpy(void *dest, const void *src, size_t n)
+{
+	return memcpy(dest, src, n);
+}
+
+/* Called under KERNEL_DS, so dest may be a kernel address */
+static void *bench_copy_to_user(void *dest, const void *src, size_t n)
+{
+	if (__copy_to_user((void __user *)dest, src, n))
+		bench_fault = true;
+	return dest;
+}
+
+/* Throughput of copy in MB/s */
+static unsigned int bench_run(bench_copy_fn copy, void *dst,
+			      const void *src, unsigned int size)
+{
+	unsigned int i, loops = max(run_bytes / size, 1U);
+	ktime_t t0;
+	s64 ns;
+
+	copy(dst, src, size);
+
+	t0 = ktime_get();
+	for (i = 0; i < loops; i++)
+		copy(dst, src, size);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	cond_resched();
+
+	return ns > 0 ? div64_s64((s64)loops * size * 1000, ns) : 0;
+}
+
+static void bench_table(const char *name, bench_copy_fn copy,
+			void *dst, const void *src)
+{
+	unsigned int size;
+	char line[80];
+	int len, i;
+
+	pr_info("%s, MB/s by size and src/dst misalignment\n", name);
+
+	len = scnprintf(line, sizeof(line), "%10s", "size");
+	for (i = 0; i < ARRAY_SIZE(bench_align); i++)
+		len += scnprintf(line + len, sizeof(line) - len, "  %3u/%-3u",
+				 bench_align[i].src, bench_align[i].dst);
+	pr_info("%s\n", line);
+
+	for (size = BENCH_SIZE_MIN; size <= max_size; size *= 4) {
+		len = scnprintf(line, sizeof(line), "%10u", size);
+		for (i = 0; i < ARRAY_SIZE(bench_align); i++)
+			len += scnprintf(line + len, sizeof(line) - len,
+					 "  %7u",
+					 bench_run(copy,
+						   dst + bench_align[i].dst,
+						   src + bench_align[i].src,
+						   size));
+		pr_info("%s\n", line);
+	}
+}
+
+static int __init copy_bench_init(void)
+{
+	struct copy_engine *e;
+	mm_segment_t old_fs;
+	unsigned int speed;
+	void *src, *dst;
+	char name[48];
+	ktime_t t0;
+	s64 ns;
+	int i, loops;
+
+	if (max_size < BENCH_SIZE_MIN || max_size > BENCH_SIZE_MAX ||
+	    run_bytes == 0)
+		return -EINVAL;
+
+	src = vmalloc(max_size + PAGE_SIZE);
+	dst = vmalloc(max_size + PAGE_SIZE);
+	if (!src || !dst) {
+		vfree(src);
+		vfree(dst);
+		return -ENOMEM;
+	}
+	memset(src, 0x5a, max_size + PAGE_SIZE);
+	memset(dst, 0xa5, max_size + PAGE_SIZE);
+
+	for (e = copy_engine_list; e; e = e->next) {
+		snprintf(name, sizeof(name), "%s (%u MB/s at boot)",
+			 e->name, e->speed);
+		bench_table(name, e->copy, dst, src);
+	}
+
+	if (copy_engine_threshold != ~0UL)
+		snprintf(name, sizeof(name), "memcpy (%s from %lu bytes)",
+			 copy_engine_fast->name, copy_engine_threshold);
+	else
+		snprintf(name, sizeof(name), "memcpy");
+	bench_table(name, bench_memcpy, dst, src);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	bench_table("__copy_to_user", bench_copy_to_user, dst, src);
+	set_fs(old_fs);
+	if (bench_fault)
+		pr_warning("__copy_to_user faulted, results are not valid\n");
+
+	loops = max(run_bytes / PAGE_SIZE, 1UL);
+	copy_page(dst, src);
+	t0 = ktime_get();
+	for (i = 0; i < loops; i++)
+		copy_page(dst, src);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+	speed = ns > 0 ? div64_s64((s64)loops * PAGE_SIZE * 1000, ns) : 0;
+	pr_info("copy_page: %u MB/s\n", speed);
+
+	vfree(src);
+	vfree(dst);
+
+	/* Nothing to keep around, refuse to stay loaded */
+	return -EAGAIN;
+}
+
+module_init(copy_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Copy routine benchmark");
@@ -0,0 +1,231 @@
+/*
+ *  linux/arch/arm/lib/copy_engine.c
+ *
+ *  Run time selection of the bulk memcpy routine
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <linux/gfp.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <asm/copy_engine.h>
+#include <asm/neon.h>
+
+/*
+ * memcpy() and copy_page() hand copies of copy_engine_threshold bytes
+ * and up to __memcpy_large(). Every routine is timed once at boot on
+ * cache hot buffers of the sizes below. The one that is fastest at the
+ * largest size is used from the smallest size from which it keeps
+ * beating the generic routine; if that is the generic routine itself,
+ * the threshold stays at ~0 and memcpy() behaves as before.
+ *
+ * The NEON routine cannot run in interrupt context, nor with interrupts
+ * disabled where the VFP may not be set up (CPU bring-up, suspend), so
+ * such copies go to the fastest of the other routines. Sizes start at
+ * 512 bytes: below that, saving the VFP state of a user thread costs as
+ * much as the copy.
+ */
+
+extern void *__memcpy_ldm(void *dest, const void *src, size_t n);
+extern void *__memcpy_neon(void *dest, const void *src, size_t n);
+
+#define COPY_ENGINE_MAX		3
+#define BENCH_BYTES		(256 * 1024)
+#define BENCH_SIZE_MAX		16384
+
+static const unsigned int bench_sizes[] __initconst = {
+	512, 1024, 2048, 4096, BENCH_SIZE_MAX,
+};
+#define NR_BENCH_SIZES		ARRAY_SIZE(bench_sizes)
+
+static struct copy_engine copy_engine_arm = {
+	.name	= "arm",
+	.copy	= __memcpy_arm,
+};
+
+static struct copy_engine copy_engine_ldm = {
+	.name	= "ldm",
+	.copy	= __memcpy_ldm,
+};
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+static notrace void *memcpy_neon(void *dest, const void *src, size_t n)
+{
+	kernel_neon_begin();
+	__memcpy_neon(dest, src, n);
+	kernel_neon_end();
+
+	return dest;
+}
+
+static struct copy_engine copy_engine_neon = {
+	.name	= "neon",
+	.copy	= memcpy_neon,
+	.flags	= COPY_ENGINE_NEON,
+};
+#endif
+
+struct copy_engine *copy_engine_list;
+EXPORT_SYMBOL_GPL(copy_engine_list);
+
+struct copy_engine *copy_engine_fast = &copy_engine_arm;
+EXPORT_SYMBOL_GPL(copy_engine_fast);
+
+/* Takes over from copy_engine_fast where that one may not run */
+static struct copy_engine *copy_engine_atomic = &copy_engine_arm;
+
+unsigned long copy_engine_threshold = ~0UL;
+EXPORT_SYMBOL_GPL(copy_engine_threshold);
+
+static char copy_engine_force[8] __initdata;
+
+notrace void *__memcpy_large(void *dest, const void *src, size_t n)
+{
+	struct copy_engine *e = copy_engine_fast;
+
+	if ((e->flags & COPY_ENGINE_NEON) &&
+	    (in_interrupt() || irqs_disabled()))
+		e = copy_engine_atomic;
+
+	return e->copy(dest, src, n);
+}
+
+static int __init copy_engine_setup(char *str)
+{
+	strlcpy(copy_engine_force, str, sizeof(copy_engine_force));
+	return 1;
+}
+__setup("copy_engine=", copy_engine_setup);
+
+/* Best of three runs of BENCH_BYTES, in MB/s */
+static unsigned int __init copy_engine_speed(struct copy_engine *e,
+					     void *dst, const void *src,
+					     unsigned int size)
+{
+	s64 ns, best = LLONG_MAX;
+	ktime_t t0;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		t0 = ktime_get();
+		for (j = 0; j < BENCH_BYTES / size; j++)
+			e->copy(dst, src, size);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+		if (ns < best)
+			best = ns;
+	}
+
+	return best > 0 ? div64_s64((s64)BENCH_BYTES * 1000, best) : 0;
+}
+
+static void __init copy_engine_add(struct copy_engine *e)
+{
+	struct copy_engine **p = &copy_engine_list;
+
+	while (*p)
+		p = &(*p)->next;
+	*p = e;
+}
+
+static int __init copy_engine_init(void)
+{
+	unsigned int speed[COPY_ENGINE_MAX][NR_BENCH_SIZES];
+	struct copy_engine *e, *fast, *atomic;
+	unsigned long threshold;
+	void *buf;
+	int n, i;
+
+	copy_engine_add(&copy_engine_arm);
+	copy_engine_add(&copy_engine_ldm);
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (cpu_has_neon())
+		copy_engine_add(&copy_engine_neon);
+#endif
+
+	buf = (void *)__get_free_pages(GFP_KERNEL,
+				       get_order(2 * BENCH_SIZE_MAX));
+	if (!buf) {
+		pr_warning("copy: no memory to time the copy routines\n");
+		return -ENOMEM;
+	}
+	memset(buf, 0x5a, 2 * BENCH_SIZE_MAX);
+
+	pr_info("copy: measuring bulk copy speed\n");
+	for (e = copy_engine_list, n = 0; e; e = e->next, n++) {
+		char line[64];
+		int len = 0;
+
+		for (i = 0; i < NR_BENCH_SIZES; i++) {
+			speed[n][i] = copy_engine_speed(e,
+					buf + BENCH_SIZE_MAX, buf,
+					bench_sizes[i]);
+			len += scnprintf(line + len, sizeof(line) - len,
+					 " %6u", speed[n][i]);
+		}
+		e->speed = speed[n][NR_BENCH_SIZES - 1];
+		pr_info("   %-6s:%s MB/sec\n", e->name, line);
+	}
+
+	free_pages((unsigned long)buf, get_order(2 * BENCH_SIZE_MAX));
+
+	fast = atomic = copy_engine_list;
+	for (e = copy_engine_list; e; e = e->next) {
+		if (e->speed > fast->speed)
+			fast = e;
+		if (!(e->flags & COPY_ENGINE_NEON) && e->speed > atomic->speed)
+			atomic = e;
+	}
+
+	for (e = copy_engine_list, n = 0; e; e = e->next, n++)
+		if (e == fast)
+			break;
+
+	/* copy_engine_list starts with the generic routine */
+	threshold = ~0UL;
+	for (i = NR_BENCH_SIZES - 1; i >= 0; i--) {
+		if (speed[n][i] <= speed[0][i])
+			break;
+		threshold = bench_sizes[i];
+	}
+
+	if (copy_engine_force[0]) {
+		for (e = copy_engine_list; e; e = e->next)
+			if (!strcmp(e->name, copy_engine_force))
+				break;
+		if (e) {
+			fast = e;
+			if (!(e->flags & COPY_ENGINE_NEON))
+				atomic = e;
+			threshold = e == copy_engine_list ? ~0UL : bench_sizes[0];
+		} else {
+			pr_warning("copy: no routine named %s\n",
+				   copy_engine_force);
+		}
+	}
+
+	if (threshold == ~0UL) {
+		pr_info("copy: using function: %s\n", copy_engine_arm.name);
+		return 0;
+	}
+
+	copy_engine_fast = fast;
+	copy_engine_atomic = atomic;
+	smp_wmb();
+	copy_engine_threshold = threshold;
+
+	pr_info("copy: using function: %s from %lu bytes (%s in atomic context)\n",
+		fast->name, threshold, atomic->name);
+
+	return 0;
+}
+
+/* After vfp_init(), which tells whether NEON is there */
+late_initcall_sync(copy_engine_init);
@@ -11,6 +11,7 @@
 #include <linux/module.h>
 #include <linux/types.h>
 #include <linux/cpu.h>
+#include <linux/hardirq.h>
 #include <linux/kernel.h>
 #include <linux/notifier.h>
 
@@ -20,6 +21,7 @@
 #include <linux/init.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/system_info.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
@@ -530,6 +532,33 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Kernel mode NEON is only allowed outside of interrupt context, with
+ * preemption disabled. Whoever owns the VFP registers on this CPU gets
+ * its state saved, exactly as for suspend, and reloads it lazily on its
+ * next VFP instruction, so nothing needs restoring at the end.
+ */
+void kernel_neon_begin(void)
+{
+	BUG_ON(in_interrupt());
+	preempt_disable();
+
+	vfp_flush_context();
+	fmxr(FPEXC, fmrx(FPEXC) | FPEXC_EN);
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	preempt_enable();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
@@ -0,0 +1,76 @@
+/*
+ * Per queue request latency histograms
+ */
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+
+#include "blk.h"
+
+static void blk_lat_hist_add(struct blk_lat_hist *hist, struct request *rq,
+			     ktime_t start, ktime_t end)
+{
+	s64 us = ktime_us_delta(end, start);
+	int bucket = 0;
+
+	if (us > 1)
+		bucket = min_t(int, ilog2((u64)us), BLK_LAT_HIST_BUCKETS - 1);
+
+	hist->count[rq_data_dir(rq)][rq_is_sync(rq)][bucket]++;
+}
+
+/*
+ * Called with the queue lock held when rq is handed to the driver. A
+ * requeued request is counted again when it is dispatched again.
+ */
+void blk_lat_hist_dispatch(struct request *rq)
+{
+	ktime_t now = ktime_get();
+
+	blk_lat_hist_add(&rq->q->dispatch_lat, rq, rq->lat_queue_time, now);
+	rq->lat_dispatch_time = now;
+}
+
+/* Called with the queue lock held when rq completes */
+void blk_lat_hist_done(struct request *rq)
+{
+	if (!rq->lat_dispatch_time.tv64)
+		return;
+
+	blk_lat_hist_add(&rq->q->completion_lat, rq, rq->lat_dispatch_time,
+			 ktime_get());
+}
+
+ssize_t blk_lat_hist_show(struct blk_lat_hist *hist, char *page)
+{
+	ssize_t len;
+	int i;
+
+	len = scnprintf(page, PAGE_SIZE, "%10s %11s %11s %11s %11s\n", "usecs",
+			"read_async", "read_sync", "write_async", "write_sync");
+
+	for (i = 0; i < BLK_LAT_HIST_BUCKETS; i++) {
+		char label[16];
+
+		if (i < BLK_LAT_HIST_BUCKETS - 1)
+			snprintf(label, sizeof(label), "< %lu", 2UL << i);
+		else
+			snprintf(label, sizeof(label), ">= %lu", 1UL << i);
+
+		len += scnprintf(page + len, PAGE_SIZE - len,
+				 "%10s %11lu %11lu %11lu %11lu\n", label,
+				 hist->count[READ][0][i], hist->count[READ][1][i],
+				 hist->count[WRITE][0][i],
+				 hist->count[WRITE][1][i]);
+	}
+
+	return len;
+}
+
+void blk_lat_hist_clear(struct request_queue *q, struct blk_lat_hist *hist)
+{
+	spin_lock_irq(q->queue_lock);
+	memset(hist, 0, sizeof(*hist));
+	spin_unlock_irq(q->queue_lock);
+}
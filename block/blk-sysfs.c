@@ -382,6 +382,46 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static ssize_t queue_dispatch_lat_show(struct request_queue *q, char *page)
+{
+	return blk_lat_hist_show(&q->dispatch_lat, page);
+}
+
+static ssize_t
+queue_dispatch_lat_store(struct request_queue *q, const char *page,
+			 size_t count)
+{
+	blk_lat_hist_clear(q, &q->dispatch_lat);
+	return count;
+}
+
+static ssize_t queue_completion_lat_show(struct request_queue *q, char *page)
+{
+	return blk_lat_hist_show(&q->completion_lat, page);
+}
+
+static ssize_t
+queue_completion_lat_store(struct request_queue *q, const char *page,
+			   size_t count)
+{
+	blk_lat_hist_clear(q, &q->completion_lat);
+	return count;
+}
+
+static struct queue_sysfs_entry queue_dispatch_lat_entry = {
+	.attr = {.name = "dispatch_latency", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_dispatch_lat_show,
+	.store = queue_dispatch_lat_store,
+};
+
+static struct queue_sysfs_entry queue_completion_lat_entry = {
+	.attr = {.name = "completion_latency", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_completion_lat_show,
+	.store = queue_completion_lat_store,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -404,6 +444,10 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+#ifdef CONFIG_BLK_LATENCY_HIST
+	&queue_dispatch_lat_entry.attr,
+	&queue_completion_lat_entry.attr,
+#endif
 	NULL,
 };
 
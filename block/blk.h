@@ -183,6 +183,22 @@ static inline int blk_cpu_to_group(int cpu)
 	return cpu;
 }
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+static inline void blk_lat_hist_init_rq(struct request *rq)
+{
+	rq->lat_queue_time = ktime_get();
+}
+
+void blk_lat_hist_dispatch(struct request *rq);
+void blk_lat_hist_done(struct request *rq);
+ssize_t blk_lat_hist_show(struct blk_lat_hist *hist, char *page);
+void blk_lat_hist_clear(struct request_queue *q, struct blk_lat_hist *hist);
+#else
+static inline void blk_lat_hist_init_rq(struct request *rq) { }
+static inline void blk_lat_hist_dispatch(struct request *rq) { }
+static inline void blk_lat_hist_done(struct request *rq) { }
+#endif
+
 /*
  * Contribute to IO statistics IFF:
  *
@@ -12,16 +12,31 @@
  * Asynchronous and synchronous requests are not treated separately, but
  * we relay on deadlines to ensure fairness.
  *
+ * Requests are queued per I/O priority class. Real time requests are
+ * served before best effort ones, and idle class requests only once
+ * the device has had no other work for idle_delay, or when their
+ * deadline has expired. The number of requests dispatched between two
+ * deadline checks is scaled down while the device is slow to complete
+ * them, so that foreground reads are not held up behind a long batch
+ * of writeback.
+ *
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/ioprio.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
 #include <linux/version.h>
 
 enum { ASYNC, SYNC };
 
+/* I/O priority classes, in the order they are served */
+enum { SIO_RT, SIO_BE, SIO_IDLE, SIO_NR_CLASSES };
+
 /* Tunables */
 
 /* max time before a sync read is submitted. */
@@ -43,21 +58,84 @@ static const int writes_starved = 2;
  */
 static const int fifo_batch     = 8;
 
+/*
+ * Time a batch of requests should take to complete, in msecs. The batch
+ * is made smaller than fifo_batch when the device is slow. 0 disables.
+ */
+static const int target_latency = 10;
+
+/* time the device must have been idle before idle class I/O is served */
+static const int idle_delay = HZ / 5;
+
+#define RQ_SIO_CLASS(rq)	((unsigned long)(rq)->elevator_private[0])
+#define RQ_SIO_START(rq)	((unsigned long)(rq)->elevator_private[1])
+
 /* Elevator data */
 struct sio_data {
+	struct request_queue *queue;
+
 	/* Request queues */
-	struct list_head fifo_list[2][2];
+	struct list_head fifo_list[SIO_NR_CLASSES][2][2];
 
 	/* Attributes */
 	unsigned int batched;
 	unsigned int starved;
 
+	/* Requests dispatched and not yet completed */
+	unsigned int in_flight[SIO_NR_CLASSES];
+	/* Average dispatch to completion time, in usecs */
+	unsigned long avg_latency;
+	/* Last time a non idle class request completed */
+	unsigned long last_busy;
+
+	struct timer_list idle_timer;
+	struct work_struct kick_work;
+
 	/* Settings */
 	int fifo_expire[2][2];
 	int fifo_batch;
 	int writes_starved;
+	int target_latency;
+	int idle_delay;
 };
 
+static inline struct list_head *
+sio_rq_list(struct sio_data *sd, struct request *rq)
+{
+	return &sd->fifo_list[RQ_SIO_CLASS(rq)][rq_is_sync(rq)][rq_data_dir(rq)];
+}
+
+static unsigned long
+sio_ioprio_class(int ioprio_class)
+{
+	switch (ioprio_class) {
+	case IOPRIO_CLASS_RT:
+		return SIO_RT;
+	case IOPRIO_CLASS_IDLE:
+		return SIO_IDLE;
+	default:
+		return SIO_BE;
+	}
+}
+
+static int
+sio_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct io_context *ioc = current->io_context;
+	int ioprio_class;
+
+	/* Requests are allocated in the context of the submitting task */
+	if (ioc && ioprio_valid(ioc->ioprio))
+		ioprio_class = IOPRIO_PRIO_CLASS(ioc->ioprio);
+	else
+		ioprio_class = task_nice_ioclass(current);
+
+	rq->elevator_private[0] = (void *)sio_ioprio_class(ioprio_class);
+	rq->elevator_private[1] = NULL;
+
+	return 0;
+}
+
 static void
 sio_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
@@ -66,7 +144,9 @@ sio_merged_requests(struct request_queue *q, struct request *rq,
 	 * If next expires before rq, assign its expire time to rq
 	 * and move into next position (next will be deleted) in fifo.
 	 */
-	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist)) {
+	if (!list_empty(&rq->queuelist) && !list_empty(&next->queuelist) &&
+	    sio_rq_list(q->elevator->elevator_data, rq) ==
+	    sio_rq_list(q->elevator->elevator_data, next)) {
 		if (time_before(rq_fifo_time(next), rq_fifo_time(rq))) {
 			list_move(&rq->queuelist, &next->queuelist);
 			rq_set_fifo_time(rq, rq_fifo_time(next));
@@ -84,18 +164,23 @@ sio_add_request(struct request_queue *q, struct request *rq)
 	const int sync = rq_is_sync(rq);
 	const int data_dir = rq_data_dir(rq);
 
+	/* A priority set on the bio overrides the one of the task */
+	if (ioprio_valid(rq->ioprio))
+		rq->elevator_private[0] =
+			(void *)sio_ioprio_class(IOPRIO_PRIO_CLASS(rq->ioprio));
+
 	/*
 	 * Add request to the proper fifo list and set its
 	 * expire time.
 	 */
 	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
-	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+	list_add_tail(&rq->queuelist, sio_rq_list(sd, rq));
 }
 
 static struct request *
-sio_expired_request(struct sio_data *sd, int sync, int data_dir)
+sio_expired_request(struct sio_data *sd, int class, int sync, int data_dir)
 {
-	struct list_head *list = &sd->fifo_list[sync][data_dir];
+	struct list_head *list = &sd->fifo_list[class][sync][data_dir];
 	struct request *rq;
 
 	if (list_empty(list))
@@ -115,34 +200,73 @@ static struct request *
 sio_choose_expired_request(struct sio_data *sd)
 {
 	struct request *rq;
+	int class;
 
 	/*
-	 * Check expired requests.
+	 * Check expired requests, one priority class after another.
 	 * Asynchronous requests have priority over synchronous.
 	 * Write requests have priority over read.
 	 */
-	rq = sio_expired_request(sd, ASYNC, WRITE);
-	if (rq)
-		return rq;
-	rq = sio_expired_request(sd, ASYNC, READ);
-	if (rq)
-		return rq;
-
-	rq = sio_expired_request(sd, SYNC, WRITE);
-	if (rq)
-		return rq;
-	rq = sio_expired_request(sd, SYNC, READ);
-	if (rq)
-		return rq;
+	for (class = SIO_RT; class < SIO_NR_CLASSES; class++) {
+		rq = sio_expired_request(sd, class, ASYNC, WRITE);
+		if (rq)
+			return rq;
+		rq = sio_expired_request(sd, class, ASYNC, READ);
+		if (rq)
+			return rq;
+
+		rq = sio_expired_request(sd, class, SYNC, WRITE);
+		if (rq)
+			return rq;
+		rq = sio_expired_request(sd, class, SYNC, READ);
+		if (rq)
+			return rq;
+	}
 
 	return NULL;
 }
 
+static int
+sio_class_empty(struct sio_data *sd, int class)
+{
+	return list_empty(&sd->fifo_list[class][SYNC][READ]) &&
+	       list_empty(&sd->fifo_list[class][SYNC][WRITE]) &&
+	       list_empty(&sd->fifo_list[class][ASYNC][READ]) &&
+	       list_empty(&sd->fifo_list[class][ASYNC][WRITE]);
+}
+
+/*
+ * Idle class requests may go once nothing else has been queued or in
+ * flight for idle_delay. Otherwise make sure the queue is run again
+ * when that time comes.
+ */
+static int
+sio_idle_allowed(struct sio_data *sd, int force)
+{
+	unsigned long idle_at;
+
+	if (force)
+		return 1;
+
+	if (sd->in_flight[SIO_RT] || sd->in_flight[SIO_BE] ||
+	    !sio_class_empty(sd, SIO_RT) || !sio_class_empty(sd, SIO_BE))
+		return 0;
+
+	/* The completion of the last busy request arms the timer */
+	idle_at = sd->last_busy + sd->idle_delay;
+	if (time_before(jiffies, idle_at)) {
+		mod_timer(&sd->idle_timer, idle_at);
+		return 0;
+	}
+
+	return 1;
+}
+
 static struct request *
-sio_choose_request(struct sio_data *sd, int data_dir)
+sio_choose_class_request(struct sio_data *sd, int class, int data_dir)
 {
-	struct list_head *sync = sd->fifo_list[SYNC];
-	struct list_head *async = sd->fifo_list[ASYNC];
+	struct list_head *sync = sd->fifo_list[class][SYNC];
+	struct list_head *async = sd->fifo_list[class][ASYNC];
 
 	/*
 	 * Retrieve request from available fifo list.
@@ -162,6 +286,42 @@ sio_choose_request(struct sio_data *sd, int data_dir)
 	return NULL;
 }
 
+static struct request *
+sio_choose_request(struct sio_data *sd, int data_dir, int force)
+{
+	struct request *rq;
+
+	/* Real time requests have priority over best effort */
+	rq = sio_choose_class_request(sd, SIO_RT, data_dir);
+	if (rq)
+		return rq;
+	rq = sio_choose_class_request(sd, SIO_BE, data_dir);
+	if (rq)
+		return rq;
+
+	if (sio_class_empty(sd, SIO_IDLE) || !sio_idle_allowed(sd, force))
+		return NULL;
+
+	return sio_choose_class_request(sd, SIO_IDLE, data_dir);
+}
+
+/*
+ * Number of requests to dispatch before checking deadlines again: as
+ * many as complete within target_latency, at most fifo_batch.
+ */
+static int
+sio_batch(struct sio_data *sd)
+{
+	unsigned long batch;
+
+	if (!sd->target_latency || !sd->avg_latency)
+		return sd->fifo_batch;
+
+	batch = sd->target_latency * USEC_PER_MSEC / sd->avg_latency;
+
+	return clamp_t(unsigned long, batch, 1, sd->fifo_batch);
+}
+
 static inline void
 sio_dispatch_request(struct sio_data *sd, struct request *rq)
 {
@@ -172,6 +332,9 @@ sio_dispatch_request(struct sio_data *sd, struct request *rq)
 	rq_fifo_clear(rq);
 	elv_dispatch_add_tail(rq->q, rq);
 
+	sd->in_flight[RQ_SIO_CLASS(rq)]++;
+	rq->elevator_private[1] = (void *)(unsigned long)ktime_to_us(ktime_get());
+
 	sd->batched++;
 
 	if (rq_data_dir(rq))
@@ -191,7 +354,7 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	 * Retrieve any expired request after a batch of
 	 * sequential requests.
 	 */
-	if (sd->batched > sd->fifo_batch) {
+	if (sd->batched > sio_batch(sd)) {
 		sd->batched = 0;
 		rq = sio_choose_expired_request(sd);
 	}
@@ -201,7 +364,7 @@ sio_dispatch_requests(struct request_queue *q, int force)
 		if (sd->starved > sd->writes_starved)
 			data_dir = WRITE;
 
-		rq = sio_choose_request(sd, data_dir);
+		rq = sio_choose_request(sd, data_dir, force);
 		if (!rq)
 			return 0;
 	}
@@ -212,14 +375,60 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	return 1;
 }
 
+static void
+sio_completed_request(struct request_queue *q, struct request *rq)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	const unsigned long class = RQ_SIO_CLASS(rq);
+	long latency;
+
+	if (WARN_ON_ONCE(!sd->in_flight[class]))
+		return;
+	sd->in_flight[class]--;
+
+	/* Moving average over the last 8 or so requests */
+	latency = (unsigned long)ktime_to_us(ktime_get()) - RQ_SIO_START(rq);
+	if (latency >= 0) {
+		if (sd->avg_latency)
+			sd->avg_latency += (latency - (long)sd->avg_latency) / 8;
+		else
+			sd->avg_latency = latency;
+	}
+
+	if (class == SIO_IDLE)
+		return;
+
+	sd->last_busy = jiffies;
+	if (!sd->in_flight[SIO_RT] && !sd->in_flight[SIO_BE] &&
+	    !sio_class_empty(sd, SIO_IDLE))
+		mod_timer(&sd->idle_timer, jiffies + sd->idle_delay);
+}
+
+static void
+sio_kick_queue(struct work_struct *work)
+{
+	struct sio_data *sd = container_of(work, struct sio_data, kick_work);
+	struct request_queue *q = sd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static void
+sio_idle_timer(unsigned long data)
+{
+	struct sio_data *sd = (struct sio_data *)data;
+
+	kblockd_schedule_work(sd->queue, &sd->kick_work);
+}
+
 static struct request *
 sio_former_request(struct request_queue *q, struct request *rq)
 {
 	struct sio_data *sd = q->elevator->elevator_data;
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
 
-	if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
+	if (rq->queuelist.prev == sio_rq_list(sd, rq))
 		return NULL;
 
 	/* Return former request */
@@ -230,10 +439,8 @@ static struct request *
 sio_latter_request(struct request_queue *q, struct request *rq)
 {
 	struct sio_data *sd = q->elevator->elevator_data;
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
 
-	if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
+	if (rq->queuelist.next == sio_rq_list(sd, rq))
 		return NULL;
 
 	/* Return latter request */
@@ -244,17 +451,24 @@ static void *
 sio_init_queue(struct request_queue *q)
 {
 	struct sio_data *sd;
+	int class;
 
 	/* Allocate structure */
-	sd = kmalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
+	sd = kzalloc_node(sizeof(*sd), GFP_KERNEL, q->node);
 	if (!sd)
 		return NULL;
 
 	/* Initialize fifo lists */
-	INIT_LIST_HEAD(&sd->fifo_list[SYNC][READ]);
-	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
-	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
-	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	for (class = SIO_RT; class < SIO_NR_CLASSES; class++) {
+		INIT_LIST_HEAD(&sd->fifo_list[class][SYNC][READ]);
+		INIT_LIST_HEAD(&sd->fifo_list[class][SYNC][WRITE]);
+		INIT_LIST_HEAD(&sd->fifo_list[class][ASYNC][READ]);
+		INIT_LIST_HEAD(&sd->fifo_list[class][ASYNC][WRITE]);
+	}
+
+	sd->queue = q;
+	setup_timer(&sd->idle_timer, sio_idle_timer, (unsigned long)sd);
+	INIT_WORK(&sd->kick_work, sio_kick_queue);
 
 	/* Initialize data */
 	sd->batched = 0;
@@ -263,6 +477,10 @@ sio_init_queue(struct request_queue *q)
 	sd->fifo_expire[ASYNC][READ] = async_read_expire;
 	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
 	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->target_latency = target_latency;
+	sd->idle_delay = idle_delay;
+	sd->last_busy = jiffies;
 
 	return sd;
 }
@@ -271,11 +489,13 @@ static void
 sio_exit_queue(struct elevator_queue *e)
 {
 	struct sio_data *sd = e->elevator_data;
+	int class;
+
+	del_timer_sync(&sd->idle_timer);
+	cancel_work_sync(&sd->kick_work);
 
-	BUG_ON(!list_empty(&sd->fifo_list[SYNC][READ]));
-	BUG_ON(!list_empty(&sd->fifo_list[SYNC][WRITE]));
-	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][READ]));
-	BUG_ON(!list_empty(&sd->fifo_list[ASYNC][WRITE]));
+	for (class = SIO_RT; class < SIO_NR_CLASSES; class++)
+		BUG_ON(!sio_class_empty(sd, class));
 
 	/* Free structure */
 	kfree(sd);
@@ -315,6 +535,9 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_target_latency_show, sd->target_latency, 0);
+SHOW_FUNCTION(sio_idle_delay_show, sd->idle_delay, 1);
+SHOW_FUNCTION(sio_avg_latency_show, sd->avg_latency, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -344,6 +567,8 @@ STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0,
 								INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_target_latency_store, &sd->target_latency, 0, 1000, 0);
+STORE_FUNCTION(sio_idle_delay_store, &sd->idle_delay, 0, INT_MAX, 1);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -357,6 +582,9 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(target_latency),
+	DD_ATTR(idle_delay),
+	__ATTR(avg_latency, S_IRUGO, sio_avg_latency_show, NULL),
 	__ATTR_NULL
 };
 
@@ -367,6 +595,8 @@ static struct elevator_type iosched_sio = {
 		.elevator_add_req_fn		= sio_add_request,
 		.elevator_former_req_fn		= sio_former_request,
 		.elevator_latter_req_fn		= sio_latter_request,
+		.elevator_completed_req_fn	= sio_completed_request,
+		.elevator_set_req_fn		= sio_set_request,
 		.elevator_init_fn		= sio_init_queue,
 		.elevator_exit_fn		= sio_exit_queue,
 	},
@@ -396,4 +626,4 @@ module_exit(sio_exit);
 MODULE_AUTHOR("Miguel Boton");
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Simple IO scheduler");
-MODULE_VERSION("0.2");
+MODULE_VERSION("0.3");
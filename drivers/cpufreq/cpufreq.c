@@ -29,6 +29,7 @@
 #include <linux/completion.h>
 #include <linux/mutex.h>
 #include <linux/syscore_ops.h>
+#include <linux/rcupdate.h>
 
 #include <trace/events/power.h>
 
@@ -1445,6 +1446,70 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 EXPORT_SYMBOL(cpufreq_unregister_notifier);
 
 
+/*********************************************************************
+ *                          SCHEDULER INPUT                          *
+ *********************************************************************/
+
+static void (*cpufreq_sched_fn)(int cpu);
+static DEFINE_MUTEX(cpufreq_sched_fn_mutex);
+
+/**
+ *	cpufreq_register_sched_notify - get load updates from the scheduler
+ *	@fn: called with the CPU concerned
+ *
+ *	Lets a governor react to load as the scheduler sees it instead of
+ *	waiting for its next sample. @fn is called on every scheduler tick
+ *	and whenever a task is woken up, from atomic context and possibly
+ *	from within other wakeups, so it must be cheap and may only wake up
+ *	tasks and take locks that are never held around a wakeup.
+ *
+ *	Only one governor can register at a time; returns -EBUSY otherwise.
+ */
+int cpufreq_register_sched_notify(void (*fn)(int cpu))
+{
+	int ret = 0;
+
+	mutex_lock(&cpufreq_sched_fn_mutex);
+	if (cpufreq_sched_fn)
+		ret = -EBUSY;
+	else
+		rcu_assign_pointer(cpufreq_sched_fn, fn);
+	mutex_unlock(&cpufreq_sched_fn_mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(cpufreq_register_sched_notify);
+
+/**
+ *	cpufreq_unregister_sched_notify - stop getting scheduler load updates
+ *	@fn: function given to cpufreq_register_sched_notify()
+ *
+ *	Returns once @fn can no longer be running.
+ */
+void cpufreq_unregister_sched_notify(void (*fn)(int cpu))
+{
+	mutex_lock(&cpufreq_sched_fn_mutex);
+	if (cpufreq_sched_fn == fn) {
+		rcu_assign_pointer(cpufreq_sched_fn, NULL);
+		synchronize_sched();
+	}
+	mutex_unlock(&cpufreq_sched_fn_mutex);
+}
+EXPORT_SYMBOL_GPL(cpufreq_unregister_sched_notify);
+
+/* Called by the scheduler, see cpufreq_register_sched_notify() */
+void cpufreq_sched_notify(int cpu)
+{
+	void (*fn)(int cpu);
+
+	rcu_read_lock_sched_notrace();
+	fn = rcu_dereference_sched(cpufreq_sched_fn);
+	if (fn)
+		fn(cpu);
+	rcu_read_unlock_sched_notrace();
+}
+
+
 /*********************************************************************
  *                              GOVERNORS                            *
  *********************************************************************/
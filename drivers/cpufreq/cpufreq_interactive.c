@@ -52,6 +52,7 @@ struct cpufreq_interactive_cpuinfo {
 	u64 hispeed_validate_time;
 	struct rw_semaphore enable_sem;
 	int governor_enabled;
+	int sched_pending;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
@@ -59,6 +60,8 @@ static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
 /* realtime thread handles frequency scaling */
 static struct task_struct *speedchange_task;
 static cpumask_t speedchange_cpumask;
+/* CPUs the scheduler reported as loaded, also under speedchange lock */
+static cpumask_t sched_ramp_cpumask;
 static spinlock_t speedchange_cpumask_lock;
 static struct mutex gov_lock;
 
@@ -109,6 +112,14 @@ static u64 boostpulse_endtime;
 #define DEFAULT_TIMER_SLACK (4 * DEFAULT_TIMER_RATE)
 static int timer_slack_val = DEFAULT_TIMER_SLACK;
 
+/*
+ * Part of a sample window that must have passed before load reported by
+ * the scheduler on ticks and wakeups can raise speed ahead of the timer,
+ * or 0 to only sample on the timer.
+ */
+#define DEFAULT_SCHED_MIN_WINDOW (5 * USEC_PER_MSEC)
+static unsigned long sched_min_window_val = DEFAULT_SCHED_MIN_WINDOW;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -448,10 +459,93 @@ static void cpufreq_interactive_idle_end(void)
 	up_read(&pcpu->enable_sem);
 }
 
+/*
+ * Scheduler input, called on every tick and wakeup. If the CPU has been
+ * busy enough since the current sample window started to go to
+ * hispeed_freq, hand it to the speedchange task instead of waiting for
+ * the timer. This runs in atomic context, possibly from within another
+ * wakeup, so it only peeks at the idle time and leaves the decision to
+ * cpufreq_interactive_sched_ramp(), which runs with the CPU's governor
+ * data properly locked.
+ */
+static void cpufreq_interactive_sched_notify(int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	u64 now, now_idle, delta_time, delta_idle;
+	unsigned long flags;
+
+	if (!sched_min_window_val || !pcpu->governor_enabled ||
+	    pcpu->sched_pending || pcpu->target_freq >= hispeed_freq)
+		return;
+
+	now_idle = get_cpu_idle_time_us(cpu, &now);
+	delta_time = now - pcpu->time_in_idle_timestamp;
+	delta_idle = now_idle - pcpu->time_in_idle;
+
+	if (delta_time < sched_min_window_val || delta_idle >= delta_time)
+		return;
+	if ((delta_time - delta_idle) * 100 < go_hispeed_load * delta_time)
+		return;
+
+	spin_lock_irqsave(&speedchange_cpumask_lock, flags);
+	pcpu->sched_pending = 1;
+	cpumask_set_cpu(cpu, &sched_ramp_cpumask);
+	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
+
+	wake_up_process(speedchange_task);
+}
+
+/* Returns true if @cpu was raised to hispeed_freq */
+static bool cpufreq_interactive_sched_ramp(int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	u64 now;
+	unsigned int delta_time;
+	u64 cputime_speedadj;
+	unsigned int cpu_load;
+	unsigned long flags;
+	bool ramp = false;
+
+	if (!down_read_trylock(&pcpu->enable_sem)) {
+		pcpu->sched_pending = 0;
+		return false;
+	}
+	if (!pcpu->governor_enabled)
+		goto exit;
+
+	spin_lock_irqsave(&pcpu->load_lock, flags);
+	now = update_load(cpu);
+	delta_time = (unsigned int)(now - pcpu->cputime_speedadj_timestamp);
+	cputime_speedadj = pcpu->cputime_speedadj;
+	spin_unlock_irqrestore(&pcpu->load_lock, flags);
+
+	if (!delta_time)
+		goto exit;
+
+	do_div(cputime_speedadj, delta_time);
+	cpu_load = (unsigned int)cputime_speedadj * 100 / pcpu->target_freq;
+	if (cpu_load < go_hispeed_load || pcpu->target_freq >= hispeed_freq)
+		goto exit;
+
+	trace_cpufreq_interactive_target(cpu, cpu_load, pcpu->target_freq,
+					 pcpu->policy->cur, hispeed_freq);
+	pcpu->target_freq = hispeed_freq;
+	pcpu->floor_freq = hispeed_freq;
+	pcpu->floor_validate_time = now;
+	pcpu->hispeed_validate_time = now;
+	ramp = true;
+
+exit:
+	pcpu->sched_pending = 0;
+	up_read(&pcpu->enable_sem);
+	return ramp;
+}
+
 static int cpufreq_interactive_speedchange_task(void *data)
 {
 	unsigned int cpu;
 	cpumask_t tmp_mask;
+	cpumask_t ramp_mask;
 	unsigned long flags;
 	struct cpufreq_interactive_cpuinfo *pcpu;
 
@@ -459,7 +553,8 @@ static int cpufreq_interactive_speedchange_task(void *data)
 		set_current_state(TASK_INTERRUPTIBLE);
 		spin_lock_irqsave(&speedchange_cpumask_lock, flags);
 
-		if (cpumask_empty(&speedchange_cpumask)) {
+		if (cpumask_empty(&speedchange_cpumask) &&
+		    cpumask_empty(&sched_ramp_cpumask)) {
 			spin_unlock_irqrestore(&speedchange_cpumask_lock,
 					       flags);
 			schedule();
@@ -473,8 +568,14 @@ static int cpufreq_interactive_speedchange_task(void *data)
 		set_current_state(TASK_RUNNING);
 		tmp_mask = speedchange_cpumask;
 		cpumask_clear(&speedchange_cpumask);
+		ramp_mask = sched_ramp_cpumask;
+		cpumask_clear(&sched_ramp_cpumask);
 		spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
 
+		for_each_cpu(cpu, &ramp_mask)
+			if (cpufreq_interactive_sched_ramp(cpu))
+				cpumask_set_cpu(cpu, &tmp_mask);
+
 		for_each_cpu(cpu, &tmp_mask) {
 			unsigned int j;
 			unsigned int max_freq = 0;
@@ -510,7 +611,11 @@ static int cpufreq_interactive_speedchange_task(void *data)
 	return 0;
 }
 
-static void cpufreq_interactive_boost(void)
+/*
+ * Raise all CPUs to hispeed_freq and keep them there at least until
+ * min_sample_time after floor_time.
+ */
+static void __cpufreq_interactive_boost(u64 floor_time)
 {
 	int i;
 	int anyboost = 0;
@@ -532,11 +637,14 @@ static void cpufreq_interactive_boost(void)
 
 		/*
 		 * Set floor freq and (re)start timer for when last
-		 * validated.
+		 * validated, unless a longer boost is already running.
 		 */
 
-		pcpu->floor_freq = hispeed_freq;
-		pcpu->floor_validate_time = ktime_to_us(ktime_get());
+		if (pcpu->floor_freq < hispeed_freq ||
+		    floor_time > pcpu->floor_validate_time) {
+			pcpu->floor_freq = hispeed_freq;
+			pcpu->floor_validate_time = floor_time;
+		}
 	}
 
 	spin_unlock_irqrestore(&speedchange_cpumask_lock, flags);
@@ -545,6 +653,11 @@ static void cpufreq_interactive_boost(void)
 		wake_up_process(speedchange_task);
 }
 
+static void cpufreq_interactive_boost(void)
+{
+	__cpufreq_interactive_boost(ktime_to_us(ktime_get()));
+}
+
 static int cpufreq_interactive_notifier(
 	struct notifier_block *nb, unsigned long val, void *data)
 {
@@ -790,6 +903,27 @@ static ssize_t store_timer_slack(
 
 define_one_global_rw(timer_slack);
 
+static ssize_t show_sched_min_window(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", sched_min_window_val);
+}
+
+static ssize_t store_sched_min_window(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	sched_min_window_val = val;
+	return count;
+}
+
+define_one_global_rw(sched_min_window);
+
 static ssize_t show_boost(struct kobject *kobj, struct attribute *attr,
 			  char *buf)
 {
@@ -839,6 +973,40 @@ static ssize_t store_boostpulse(struct kobject *kobj, struct attribute *attr,
 static struct global_attr boostpulse =
 	__ATTR(boostpulse, 0200, NULL, store_boostpulse);
 
+/*
+ * Frame deadline hint: userspace writes the number of microseconds left
+ * until the frame it is producing is due. The CPUs are kept at
+ * hispeed_freq or above until then, and may drop again right after,
+ * where a boostpulse always lasts boostpulse_duration.
+ */
+static ssize_t store_frame_deadline(struct kobject *kobj,
+				    struct attribute *attr,
+				    const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+	u64 now, endtime;
+
+	ret = kstrtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (!val || val > USEC_PER_SEC)
+		return -EINVAL;
+
+	now = ktime_to_us(ktime_get());
+	endtime = now + val;
+	if (endtime > boostpulse_endtime)
+		boostpulse_endtime = endtime;
+
+	trace_cpufreq_interactive_boost("frame");
+	__cpufreq_interactive_boost(endtime > min_sample_time ?
+				    endtime - min_sample_time : 0);
+	return count;
+}
+
+static struct global_attr frame_deadline =
+	__ATTR(frame_deadline, 0200, NULL, store_frame_deadline);
+
 static ssize_t show_boostpulse_duration(
 	struct kobject *kobj, struct attribute *attr, char *buf)
 {
@@ -870,9 +1038,11 @@ static struct attribute *interactive_attributes[] = {
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
 	&timer_slack.attr,
+	&sched_min_window.attr,
 	&boost.attr,
 	&boostpulse.attr,
 	&boostpulse_duration.attr,
+	&frame_deadline.attr,
 	NULL,
 };
 
@@ -965,6 +1135,9 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		idle_notifier_register(&cpufreq_interactive_idle_nb);
 		cpufreq_register_notifier(
 			&cpufreq_notifier_block, CPUFREQ_TRANSITION_NOTIFIER);
+		if (cpufreq_register_sched_notify(
+				cpufreq_interactive_sched_notify))
+			pr_warn("interactive: scheduler input already in use\n");
 		mutex_unlock(&gov_lock);
 		break;
 
@@ -984,6 +1157,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			return 0;
 		}
 
+		cpufreq_unregister_sched_notify(
+			cpufreq_interactive_sched_notify);
 		cpufreq_unregister_notifier(
 			&cpufreq_notifier_block, CPUFREQ_TRANSITION_NOTIFIER);
 		idle_notifier_unregister(&cpufreq_interactive_idle_nb);
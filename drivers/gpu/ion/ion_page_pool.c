@@ -0,0 +1,390 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/freezer.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
+#include <linux/wait.h>
+#include "ion_priv.h"
+
+/*
+ * Pages handed back to a pool are zeroed by a background thread, so
+ * that allocations find them ready. All pools share the thread and a
+ * shrinker that gives their pages back to the system under pressure.
+ *
+ * pools_lock only covers the list of pools. The thread holds it just to
+ * pick a pool with dirty pages, which it marks as zeroing so that
+ * ion_page_pool_destroy() waits for it, and zeroes the pages under the
+ * pool's own lock; the shrinker is never kept out for a whole sweep.
+ */
+static LIST_HEAD(pools);
+static DEFINE_MUTEX(pools_lock);
+static DECLARE_WAIT_QUEUE_HEAD(pool_zero_wait);
+static DECLARE_WAIT_QUEUE_HEAD(pool_zero_done);
+static struct task_struct *pool_zero_thread;
+
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	struct scatterlist sg;
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(nth_page(page, i));
+
+	/* Devices must not see what the previous owner left in memory */
+	sg_init_table(&sg, 1);
+	sg_set_page(&sg, page, PAGE_SIZE << pool->order, 0);
+	sg_dma_address(&sg) = sg_phys(&sg);
+	dma_sync_sg_for_device(NULL, &sg, 1, DMA_BIDIRECTIONAL);
+}
+
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	page = alloc_pages(pool->gfp_mask, pool->order);
+	if (page)
+		ion_page_pool_zero(pool, page);
+
+	return page;
+}
+
+static struct page *ion_page_pool_remove(struct ion_page_pool *pool,
+					 bool dirty)
+{
+	struct list_head *items = dirty ? &pool->dirty_items : &pool->items;
+	struct page *page;
+
+	if (list_empty(items))
+		return NULL;
+
+	page = list_first_entry(items, struct page, lru);
+	list_del(&page->lru);
+	if (dirty)
+		pool->dirty_count--;
+	else
+		pool->count--;
+
+	return page;
+}
+
+/**
+ * ion_page_pool_alloc - get zeroed pages of the pool's order
+ * @pool:	the pool
+ *
+ * Pages that were zeroed in the background are handed out first, then
+ * freed pages still waiting for that, and only then new pages from
+ * the page allocator. Returns NULL if none of these has any.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page;
+	bool dirty = false;
+
+	spin_lock(&pool->lock);
+	page = ion_page_pool_remove(pool, false);
+	if (!page) {
+		page = ion_page_pool_remove(pool, true);
+		dirty = page != NULL;
+	}
+	if (page)
+		pool->hits++;
+	else
+		pool->misses++;
+	spin_unlock(&pool->lock);
+
+	if (!page)
+		return ion_page_pool_alloc_pages(pool);
+
+	if (dirty)
+		ion_page_pool_zero(pool, page);
+
+	return page;
+}
+
+/**
+ * ion_page_pool_free - give pages back to a pool
+ * @pool:	the pool
+ * @page:	pages of the pool's order, as returned by ion_page_pool_alloc()
+ *
+ * The pages are kept for reuse and zeroed in the background, unless the
+ * pool already holds its maximum; then they go back to the system.
+ */
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&pool->lock);
+	if (pool->count + pool->dirty_count >= pool->max_count) {
+		spin_unlock(&pool->lock);
+		__free_pages(page, pool->order);
+		return;
+	}
+	list_add_tail(&page->lru, &pool->dirty_items);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	wake_up(&pool_zero_wait);
+}
+
+static bool ion_page_pool_has_dirty(void)
+{
+	struct ion_page_pool *pool;
+	bool dirty = false;
+
+	mutex_lock(&pools_lock);
+	list_for_each_entry(pool, &pools, list) {
+		if (pool->dirty_count) {
+			dirty = true;
+			break;
+		}
+	}
+	mutex_unlock(&pools_lock);
+
+	return dirty;
+}
+
+/* Pick a pool with dirty pages and mark it as zeroing */
+static struct ion_page_pool *ion_page_pool_next_dirty(void)
+{
+	struct ion_page_pool *pool, *found = NULL;
+
+	mutex_lock(&pools_lock);
+	list_for_each_entry(pool, &pools, list) {
+		spin_lock(&pool->lock);
+		if (pool->dirty_count) {
+			pool->zeroing = true;
+			found = pool;
+		}
+		spin_unlock(&pool->lock);
+		if (found)
+			break;
+	}
+	mutex_unlock(&pools_lock);
+
+	return found;
+}
+
+static bool ion_page_pool_zeroing(struct ion_page_pool *pool)
+{
+	bool zeroing;
+
+	spin_lock(&pool->lock);
+	zeroing = pool->zeroing;
+	spin_unlock(&pool->lock);
+
+	return zeroing;
+}
+
+static int ion_page_pool_zero_fn(void *unused)
+{
+	struct ion_page_pool *pool;
+	struct page *page;
+
+	set_user_nice(current, 19);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(pool_zero_wait,
+				     ion_page_pool_has_dirty() ||
+				     kthread_should_stop());
+
+		while ((pool = ion_page_pool_next_dirty())) {
+			for (;;) {
+				spin_lock(&pool->lock);
+				page = ion_page_pool_remove(pool, true);
+				spin_unlock(&pool->lock);
+				if (!page)
+					break;
+
+				ion_page_pool_zero(pool, page);
+
+				spin_lock(&pool->lock);
+				list_add_tail(&page->lru, &pool->items);
+				pool->count++;
+				spin_unlock(&pool->lock);
+
+				cond_resched();
+			}
+
+			spin_lock(&pool->lock);
+			pool->zeroing = false;
+			spin_unlock(&pool->lock);
+			wake_up_all(&pool_zero_done);
+		}
+	}
+
+	return 0;
+}
+
+/* Free up to nr_to_scan small pages, dirty ones first; returns how many */
+static int ion_page_pool_shrink_one(struct ion_page_pool *pool,
+				    int nr_to_scan)
+{
+	struct page *page;
+	int freed = 0;
+
+	while (freed < nr_to_scan) {
+		spin_lock(&pool->lock);
+		page = ion_page_pool_remove(pool, true);
+		if (!page)
+			page = ion_page_pool_remove(pool, false);
+		if (page)
+			pool->shrunk++;
+		spin_unlock(&pool->lock);
+		if (!page)
+			break;
+
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+	}
+
+	return freed;
+}
+
+static int ion_page_pool_total(void)
+{
+	struct ion_page_pool *pool;
+	int total = 0;
+
+	list_for_each_entry(pool, &pools, list)
+		total += (pool->count + pool->dirty_count) << pool->order;
+
+	return total;
+}
+
+/* Counts and frees in small pages, smallest orders first */
+static int ion_page_pool_shrink(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	struct ion_page_pool *pool;
+	int nr_to_scan = sc->nr_to_scan;
+	int total;
+
+	if (!mutex_trylock(&pools_lock))
+		return nr_to_scan ? -1 : 0;
+
+	if (nr_to_scan) {
+		list_for_each_entry_reverse(pool, &pools, list) {
+			nr_to_scan -= ion_page_pool_shrink_one(pool,
+							       nr_to_scan);
+			if (nr_to_scan <= 0)
+				break;
+		}
+	}
+	total = ion_page_pool_total();
+	mutex_unlock(&pools_lock);
+
+	return total;
+}
+
+static struct shrinker ion_page_pool_shrinker = {
+	.shrink = ion_page_pool_shrink,
+	.seeks = DEFAULT_SEEKS * 16,
+};
+
+/**
+ * ion_page_pool_create - create a pool of zeroed pages
+ * @gfp_mask:	flags to allocate new pages with
+ * @order:	order of the pages in the pool
+ *
+ * Pools are kept ordered by decreasing order, and the shrinker walks
+ * them from the smallest order, as the large pages are the hard ones
+ * to get back.
+ */
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
+{
+	struct ion_page_pool *pool, *pos;
+	int ret = 0;
+
+	pool = kzalloc(sizeof(struct ion_page_pool), GFP_KERNEL);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&pool->items);
+	INIT_LIST_HEAD(&pool->dirty_items);
+	spin_lock_init(&pool->lock);
+	pool->gfp_mask = gfp_mask & ~__GFP_ZERO;
+	pool->order = order;
+	/* Keep up to 1/64th of memory in each pool */
+	pool->max_count = max_t(unsigned long, 1,
+				(totalram_pages >> 6) >> order);
+
+	mutex_lock(&pools_lock);
+	if (!pool_zero_thread) {
+		pool_zero_thread = kthread_run(ion_page_pool_zero_fn, NULL,
+					       "ion_pool_zero");
+		if (IS_ERR(pool_zero_thread)) {
+			ret = PTR_ERR(pool_zero_thread);
+			pool_zero_thread = NULL;
+			goto out;
+		}
+		register_shrinker(&ion_page_pool_shrinker);
+	}
+
+	list_for_each_entry(pos, &pools, list)
+		if (pos->order < order)
+			break;
+	list_add_tail(&pool->list, &pos->list);
+out:
+	mutex_unlock(&pools_lock);
+
+	if (ret) {
+		kfree(pool);
+		return ERR_PTR(ret);
+	}
+
+	return pool;
+}
+
+/**
+ * ion_page_pool_destroy - free a pool and all the pages it holds
+ * @pool:	the pool
+ */
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	mutex_lock(&pools_lock);
+	list_del(&pool->list);
+	/* The zeroing thread may still hold some of the pool's pages */
+	wait_event(pool_zero_done, !ion_page_pool_zeroing(pool));
+	ion_page_pool_shrink_one(pool, INT_MAX);
+	if (list_empty(&pools)) {
+		unregister_shrinker(&ion_page_pool_shrinker);
+		kthread_stop(pool_zero_thread);
+		pool_zero_thread = NULL;
+	}
+	mutex_unlock(&pools_lock);
+
+	kfree(pool);
+}
+
+/**
+ * ion_page_pool_print_debug - show the state of a pool
+ * @pool:	the pool
+ * @s:		the heap's debugfs file
+ */
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s)
+{
+	seq_printf(s, "order %2u: %5d zeroed %5d dirty %7lu hits %7lu misses %7lu shrunk\n",
+		   pool->order, pool->count, pool->dirty_count,
+		   pool->hits, pool->misses, pool->shrunk);
+}
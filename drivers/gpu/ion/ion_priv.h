@@ -313,4 +313,46 @@ void ion_cp_heap_get_base(struct ion_heap *heap, unsigned long *base,
 
 void ion_mem_map_show(struct ion_heap *heap);
 
+/**
+ * struct ion_page_pool - pool of zeroed pages of a single order
+ * @count:		number of zeroed pages in the pool
+ * @dirty_count:	number of freed pages waiting to be zeroed
+ * @max_count:		pages beyond this are given back to the system
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @shrunk:		pages given back to the system by the shrinker
+ * @gfp_mask:		flags to allocate new pages with
+ * @order:		order of the pages in the pool
+ * @lock:		protects the lists and counters
+ * @items:		zeroed pages, linked through page->lru
+ * @dirty_items:	freed pages, linked through page->lru
+ * @list:		entry in the list of all pools
+ *
+ * Lets a heap reuse the pages of freed buffers, and high-order pages in
+ * particular, instead of going to the page allocator for every buffer.
+ * Freed pages are zeroed by a background thread before they are handed
+ * out again, and a shrinker gives them back when memory runs low.
+ */
+struct ion_page_pool {
+	int count;
+	int dirty_count;
+	int max_count;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long shrunk;
+	gfp_t gfp_mask;
+	unsigned int order;
+	spinlock_t lock;
+	bool zeroing;		/* picked by the zeroing thread */
+	struct list_head items;
+	struct list_head dirty_items;
+	struct list_head list;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order);
+void ion_page_pool_destroy(struct ion_page_pool *pool);
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool);
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page);
+void ion_page_pool_print_debug(struct ion_page_pool *pool, struct seq_file *s);
+
 #endif /* _ION_PRIV_H */
@@ -16,7 +16,9 @@
  */
 
 #include <linux/err.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/ktime.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
@@ -35,49 +37,170 @@ static atomic_t system_contig_heap_allocated;
 static unsigned int system_heap_has_outer_cache;
 static unsigned int system_heap_contig_has_outer_cache;
 
+static const unsigned int orders[] = {8, 4, 0};
+static const int num_orders = ARRAY_SIZE(orders);
+
+/* Allocation latency histogram buckets, in microseconds */
+static const unsigned int alloc_lat_buckets[] = {100, 1000, 10000};
+#define ALLOC_LAT_NR_BUCKETS	(ARRAY_SIZE(alloc_lat_buckets) + 1)
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool *pools[ARRAY_SIZE(orders)];
+	spinlock_t stats_lock;
+	unsigned long alloc_count;
+	u64 alloc_total_us;
+	unsigned long alloc_max_us;
+	unsigned long alloc_lat[ALLOC_LAT_NR_BUCKETS];
+};
+
+struct page_info {
+	struct page *page;
+	unsigned int order;
+	struct list_head list;
+};
+
+static unsigned int order_to_size(int order)
+{
+	return PAGE_SIZE << order;
+}
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < num_orders; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct page_info *alloc_largest_available(struct ion_system_heap *heap,
+						unsigned long size,
+						unsigned int max_order)
+{
+	struct page *page;
+	struct page_info *info;
+	int i;
+
+	info = kmalloc(sizeof(struct page_info), GFP_KERNEL);
+	if (!info)
+		return NULL;
+
+	for (i = 0; i < num_orders; i++) {
+		if (size < order_to_size(orders[i]))
+			continue;
+		if (max_order < orders[i])
+			continue;
+
+		page = ion_page_pool_alloc(heap->pools[i]);
+		if (!page)
+			continue;
+
+		info->page = page;
+		info->order = orders[i];
+		return info;
+	}
+
+	kfree(info);
+	return NULL;
+}
+
+static void free_buffer_page(struct ion_system_heap *heap, struct page *page,
+			     unsigned int order)
+{
+	ion_page_pool_free(heap->pools[order_to_index(order)], page);
+}
+
+static void ion_system_heap_account(struct ion_system_heap *heap,
+				    ktime_t start)
+{
+	unsigned long us = ktime_us_delta(ktime_get(), start);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(alloc_lat_buckets); i++)
+		if (us < alloc_lat_buckets[i])
+			break;
+
+	spin_lock(&heap->stats_lock);
+	heap->alloc_count++;
+	heap->alloc_total_us += us;
+	if (us > heap->alloc_max_us)
+		heap->alloc_max_us = us;
+	heap->alloc_lat[i]++;
+	spin_unlock(&heap->stats_lock);
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
 	struct sg_table *table;
 	struct scatterlist *sg;
-	int i, j;
-	int npages = PAGE_ALIGN(size) / PAGE_SIZE;
+	struct list_head pages;
+	struct page_info *info, *tmp_info;
+	int i = 0;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
+	ktime_t start = ktime_get();
+
+	INIT_LIST_HEAD(&pages);
+	while (size_remaining > 0) {
+		info = alloc_largest_available(sys_heap, size_remaining,
+					       max_order);
+		if (!info)
+			goto err;
+		list_add_tail(&info->list, &pages);
+		size_remaining -= order_to_size(info->order);
+		max_order = info->order;
+		i++;
+	}
 
 	table = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
 	if (!table)
-		return -ENOMEM;
-	i = sg_alloc_table(table, npages, GFP_KERNEL);
-	if (i)
-		goto err0;
-	for_each_sg(table->sgl, sg, table->nents, i) {
-		struct page *page;
-		page = alloc_page(GFP_KERNEL|__GFP_ZERO);
-		if (!page)
-			goto err1;
-		sg_set_page(sg, page, PAGE_SIZE, 0);
+		goto err;
+
+	if (sg_alloc_table(table, i, GFP_KERNEL))
+		goto err1;
+
+	sg = table->sgl;
+	list_for_each_entry_safe(info, tmp_info, &pages, list) {
+		sg_set_page(sg, info->page, order_to_size(info->order), 0);
+		sg = sg_next(sg);
+		list_del(&info->list);
+		kfree(info);
 	}
+
 	buffer->priv_virt = table;
 	atomic_add(size, &system_heap_allocated);
+	ion_system_heap_account(sys_heap, start);
 	return 0;
 err1:
-	for_each_sg(table->sgl, sg, i, j)
-		__free_page(sg_page(sg));
-	sg_free_table(table);
-err0:
 	kfree(table);
+err:
+	list_for_each_entry_safe(info, tmp_info, &pages, list) {
+		free_buffer_page(sys_heap, info->page, info->order);
+		kfree(info);
+	}
 	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
 	int i;
 	struct scatterlist *sg;
 	struct sg_table *table = buffer->priv_virt;
 
 	for_each_sg(table->sgl, sg, table->nents, i)
-		__free_page(sg_page(sg));
+		free_buffer_page(sys_heap, sg_page(sg), get_order(sg->length));
 	if (buffer->sg_table)
 		sg_free_table(buffer->sg_table);
 	kfree(buffer->sg_table);
@@ -104,17 +227,20 @@ void *ion_system_heap_map_kernel(struct ion_heap *heap,
 		return ERR_PTR(-EINVAL);
 	} else {
 		struct scatterlist *sg;
-		int i;
+		int i, j, k = 0;
 		void *vaddr;
 		struct sg_table *table = buffer->priv_virt;
-		struct page **pages = kmalloc(
-					sizeof(struct page *) * table->nents,
-					GFP_KERNEL);
+		int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+		struct page **pages = vmalloc(sizeof(struct page *) * npages);
+
+		if (!pages)
+			return ERR_PTR(-ENOMEM);
 
 		for_each_sg(table->sgl, sg, table->nents, i)
-			pages[i] = sg_page(sg);
-		vaddr = vmap(pages, table->nents, VM_MAP, PAGE_KERNEL);
-		kfree(pages);
+			for (j = 0; j < sg->length / PAGE_SIZE; j++)
+				pages[k++] = nth_page(sg_page(sg), j);
+		vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+		vfree(pages);
 
 		return vaddr;
 	}
@@ -161,17 +287,31 @@ int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 	} else {
 		struct sg_table *table = buffer->priv_virt;
 		unsigned long addr = vma->vm_start;
-		unsigned long offset = vma->vm_pgoff;
+		unsigned long offset = vma->vm_pgoff * PAGE_SIZE;
 		struct scatterlist *sg;
-		int i;
+		int i, ret;
 
 		for_each_sg(table->sgl, sg, table->nents, i) {
-			if (offset) {
-				offset--;
+			struct page *page = sg_page(sg);
+			unsigned long remainder = vma->vm_end - addr;
+			unsigned long len = sg->length;
+
+			if (offset >= sg->length) {
+				offset -= sg->length;
 				continue;
+			} else if (offset) {
+				page += offset / PAGE_SIZE;
+				len = sg->length - offset;
+				offset = 0;
 			}
-			vm_insert_page(vma, addr, sg_page(sg));
-			addr += PAGE_SIZE;
+			len = min(len, remainder);
+			ret = remap_pfn_range(vma, addr, page_to_pfn(page), len,
+					      vma->vm_page_prot);
+			if (ret)
+				return ret;
+			addr += len;
+			if (addr >= vma->vm_end)
+				break;
 		}
 		return 0;
 	}
@@ -231,7 +371,7 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 				WARN(1, "Could not translate virtual address to physical address\n");
 				return -EINVAL;
 			}
-			outer_cache_op(pstart, pstart + PAGE_SIZE);
+			outer_cache_op(pstart, pstart + sg->length);
 		}
 	}
 	return 0;
@@ -240,9 +380,35 @@ int ion_system_heap_cache_ops(struct ion_heap *heap, struct ion_buffer *buffer,
 static int ion_system_print_debug(struct ion_heap *heap, struct seq_file *s,
 				  const struct rb_root *unused)
 {
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	unsigned long count, max_us, lat[ALLOC_LAT_NR_BUCKETS];
+	u64 total_us;
+	int i;
+
 	seq_printf(s, "total bytes currently allocated: %lx\n",
 			(unsigned long) atomic_read(&system_heap_allocated));
 
+	for (i = 0; i < num_orders; i++)
+		ion_page_pool_print_debug(sys_heap->pools[i], s);
+
+	spin_lock(&sys_heap->stats_lock);
+	count = sys_heap->alloc_count;
+	total_us = sys_heap->alloc_total_us;
+	max_us = sys_heap->alloc_max_us;
+	memcpy(lat, sys_heap->alloc_lat, sizeof(lat));
+	spin_unlock(&sys_heap->stats_lock);
+
+	if (count)
+		do_div(total_us, count);
+	seq_printf(s, "allocations: %lu avg %llu us max %lu us\n",
+		   count, total_us, max_us);
+	for (i = 0; i < ARRAY_SIZE(alloc_lat_buckets); i++)
+		seq_printf(s, "  < %5u us: %lu\n", alloc_lat_buckets[i], lat[i]);
+	seq_printf(s, "  >=%5u us: %lu\n",
+		   alloc_lat_buckets[ARRAY_SIZE(alloc_lat_buckets) - 1], lat[i]);
+
 	return 0;
 }
 
@@ -336,20 +502,51 @@ static struct ion_heap_ops vmalloc_ops = {
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *pheap)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
+	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
+	heap->heap.ops = &vmalloc_ops;
+	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	spin_lock_init(&heap->stats_lock);
+
+	for (i = 0; i < num_orders; i++) {
+		struct ion_page_pool *pool;
+		gfp_t gfp = __GFP_HIGHMEM;
+
+		if (orders[i])
+			gfp |= __GFP_COMP | __GFP_NORETRY |
+			       __GFP_NO_KSWAPD | __GFP_NOWARN;
+		else
+			gfp |= GFP_KERNEL;
+
+		pool = ion_page_pool_create(gfp, orders[i]);
+		if (IS_ERR(pool))
+			goto err;
+		heap->pools[i] = pool;
+	}
+
 	system_heap_has_outer_cache = pheap->has_outer_cache;
-	return heap;
+	return &heap->heap;
+err:
+	while (--i >= 0)
+		ion_page_pool_destroy(heap->pools[i]);
+	kfree(heap);
+	return ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	int i;
+
+	for (i = 0; i < num_orders; i++)
+		ion_page_pool_destroy(sys_heap->pools[i]);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
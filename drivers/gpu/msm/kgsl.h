@@ -72,6 +72,8 @@
 	do { _stat += (_size); if (_stat > _max) _max = _stat; } while (0)
 
 
+#define KGSL_ALLOC_LATENCY_BUCKETS	16
+
 #define KGSL_MEMFREE_HIST_SIZE	((int)(PAGE_SIZE * 2))
 
 struct kgsl_memfree_hist_elem {
@@ -129,6 +131,7 @@ struct kgsl_driver {
 		unsigned int mapped;
 		unsigned int mapped_max;
 		unsigned int histogram[16];
+		unsigned int alloc_latency[KGSL_ALLOC_LATENCY_BUCKETS];
 	} stats;
 };
 
@@ -0,0 +1,274 @@
+/* Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+
+#include "kgsl_pool.h"
+
+/*
+ * Pages freed by KGSL are kept here instead of going back to the page
+ * allocator, so that the buffers of the next frames can reuse them.
+ * Freed pages are zeroed and flushed out of the caches once, by a
+ * worker, and handed out ready for the GPU. Only the page sizes that
+ * _kgsl_sharedmem_page_alloc() asks for are pooled: 4K and 64K.
+ */
+struct kgsl_page_pool {
+	unsigned int order;
+	int count;		/* pages on the clean list */
+	int dirty_count;	/* pages waiting for the worker */
+	int max_count;
+	unsigned int hits;
+	unsigned int misses;
+	spinlock_t lock;
+	struct list_head clean;
+	struct list_head dirty;
+};
+
+static struct kgsl_page_pool kgsl_pools[] = {
+	{ .order = 4 },
+	{ .order = 0 },
+};
+
+static void kgsl_pool_clean_fn(struct work_struct *work);
+static DECLARE_WORK(kgsl_pool_clean_work, kgsl_pool_clean_fn);
+
+static struct kgsl_page_pool *kgsl_pool_find(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		if (kgsl_pools[i].order == order)
+			return &kgsl_pools[i];
+
+	return NULL;
+}
+
+static void kgsl_pool_zero_page(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++) {
+		void *ptr = kmap_atomic(nth_page(page, i));
+
+		memset(ptr, 0, PAGE_SIZE);
+		dmac_flush_range(ptr, ptr + PAGE_SIZE);
+		kunmap_atomic(ptr);
+	}
+
+#ifdef CONFIG_OUTER_CACHE
+	outer_flush_range(page_to_phys(page),
+			  page_to_phys(page) + (PAGE_SIZE << order));
+#endif
+}
+
+static struct page *kgsl_pool_remove(struct kgsl_page_pool *pool, bool dirty)
+{
+	struct list_head *list = dirty ? &pool->dirty : &pool->clean;
+	struct page *page;
+
+	if (list_empty(list))
+		return NULL;
+
+	page = list_first_entry(list, struct page, lru);
+	list_del(&page->lru);
+	if (dirty)
+		pool->dirty_count--;
+	else
+		pool->count--;
+
+	return page;
+}
+
+static void kgsl_pool_clean_fn(struct work_struct *work)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		struct page *page;
+
+		for (;;) {
+			spin_lock(&pool->lock);
+			page = kgsl_pool_remove(pool, true);
+			spin_unlock(&pool->lock);
+			if (!page)
+				break;
+
+			kgsl_pool_zero_page(page, pool->order);
+
+			spin_lock(&pool->lock);
+			list_add_tail(&page->lru, &pool->clean);
+			pool->count++;
+			spin_unlock(&pool->lock);
+
+			cond_resched();
+		}
+	}
+}
+
+/**
+ * kgsl_pool_alloc_page - get zeroed pages out of the pool
+ * @order: order of the allocation
+ *
+ * The pages are zeroed and flushed from the CPU caches. Returns NULL if
+ * the pool has none of this order; the caller must then get the pages
+ * from the system and clear them itself.
+ */
+struct page *kgsl_pool_alloc_page(unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+	struct page *page = NULL;
+
+	if (pool) {
+		spin_lock(&pool->lock);
+		page = kgsl_pool_remove(pool, false);
+		if (page)
+			pool->hits++;
+		else
+			pool->misses++;
+		spin_unlock(&pool->lock);
+	}
+
+	return page;
+}
+
+/**
+ * kgsl_pool_free_page - give pages back to the pool
+ * @page: first page of the allocation
+ * @order: order of the allocation
+ *
+ * Pages that are still mapped to user space, that the pool does not
+ * take or that would grow it past its limit go back to the system.
+ */
+void kgsl_pool_free_page(struct page *page, unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+
+	if (!pool || page_count(page) != 1)
+		goto free;
+
+	spin_lock(&pool->lock);
+	if (pool->count + pool->dirty_count >= pool->max_count) {
+		spin_unlock(&pool->lock);
+		goto free;
+	}
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	spin_unlock(&pool->lock);
+
+	schedule_work(&kgsl_pool_clean_work);
+	return;
+free:
+	__free_pages(page, order);
+}
+
+/* Number of 4K pages held by the pools */
+unsigned int kgsl_pool_size(void)
+{
+	unsigned int size = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		size += (kgsl_pools[i].count + kgsl_pools[i].dirty_count)
+			<< kgsl_pools[i].order;
+
+	return size;
+}
+
+unsigned int kgsl_pool_hits(void)
+{
+	unsigned int hits = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		hits += kgsl_pools[i].hits;
+
+	return hits;
+}
+
+unsigned int kgsl_pool_misses(void)
+{
+	unsigned int misses = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		misses += kgsl_pools[i].misses;
+
+	return misses;
+}
+
+/* Give up to nr_to_scan 4K pages back, dirty and small ones first */
+static int kgsl_pool_shrink(struct shrinker *shrinker,
+			    struct shrink_control *sc)
+{
+	int nr_to_scan = sc->nr_to_scan;
+	int i;
+
+	for (i = ARRAY_SIZE(kgsl_pools) - 1; i >= 0 && nr_to_scan > 0; i--) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		struct page *page;
+
+		while (nr_to_scan > 0) {
+			spin_lock(&pool->lock);
+			page = kgsl_pool_remove(pool, true);
+			if (!page)
+				page = kgsl_pool_remove(pool, false);
+			spin_unlock(&pool->lock);
+			if (!page)
+				break;
+
+			__free_pages(page, pool->order);
+			nr_to_scan -= 1 << pool->order;
+		}
+	}
+
+	return kgsl_pool_size();
+}
+
+static struct shrinker kgsl_pool_shrinker = {
+	.shrink = kgsl_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void kgsl_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		spin_lock_init(&pool->lock);
+		INIT_LIST_HEAD(&pool->clean);
+		INIT_LIST_HEAD(&pool->dirty);
+		/* Each pool may hold up to 1/32nd of memory */
+		pool->max_count = max_t(int, 1,
+					(totalram_pages >> 5) >> pool->order);
+	}
+
+	register_shrinker(&kgsl_pool_shrinker);
+}
+
+void kgsl_pool_exit(void)
+{
+	struct shrink_control sc = { .nr_to_scan = INT_MAX };
+
+	unregister_shrinker(&kgsl_pool_shrinker);
+	cancel_work_sync(&kgsl_pool_clean_work);
+	kgsl_pool_shrink(&kgsl_pool_shrinker, &sc);
+}
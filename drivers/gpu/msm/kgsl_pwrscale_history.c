@@ -0,0 +1,291 @@
+/* Copyright (c) 2014, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/export.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+
+#include "kgsl.h"
+#include "kgsl_pwrscale.h"
+#include "kgsl_device.h"
+
+/*
+ * GPU DCVS that runs entirely in the kernel, for targets that have no
+ * TrustZone DCVS. Busy and total time reported by the device are
+ * collected into windows of at least window_us, and the load of the
+ * last history_size windows, scaled to the fastest power level, drives
+ * the power level:
+ *
+ *  - a window busier than up_threshold percent moves one level up
+ *    right away, so that a heavy frame does not miss its deadline
+ *  - an average over the history below down_threshold percent moves
+ *    one level down, unless the load at that level would immediately
+ *    cross up_threshold again
+ *  - an uninterrupted busy stretch longer than CEILING jumps straight
+ *    to the fastest level
+ */
+
+#define HISTORY_MAX		16
+
+/* 5 msec captures up to 3 re-draws per frame for 60fps content */
+#define DEFAULT_WINDOW_US	5000
+#define DEFAULT_HISTORY_SIZE	4
+#define DEFAULT_UP_THRESHOLD	80
+#define DEFAULT_DOWN_THRESHOLD	40
+
+/* Longer than any standard frame but shorter than the idle timer */
+#define CEILING			50000
+
+struct history_priv {
+	unsigned int window_us;
+	unsigned int history_size;
+	unsigned int up_threshold;
+	unsigned int down_threshold;
+
+	struct kgsl_power_stats bin;
+	/* Busy percentage of each window, scaled to the fastest level */
+	unsigned int load[HISTORY_MAX];
+	unsigned int head;
+	unsigned int nr_samples;
+};
+
+static unsigned int history_freq(struct kgsl_pwrctrl *pwr, unsigned int level)
+{
+	return pwr->pwrlevels[level].gpu_freq;
+}
+
+static void history_reset(struct history_priv *priv)
+{
+	priv->bin.total_time = 0;
+	priv->bin.busy_time = 0;
+	priv->head = 0;
+	priv->nr_samples = 0;
+}
+
+static unsigned int history_average(struct history_priv *priv)
+{
+	unsigned int i, n, sum = 0;
+
+	n = min(priv->nr_samples, priv->history_size);
+	if (n == 0)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		sum += priv->load[(priv->head + HISTORY_MAX - 1 - i) %
+				  HISTORY_MAX];
+
+	return sum / n;
+}
+
+static void history_idle(struct kgsl_device *device,
+			 struct kgsl_pwrscale *pwrscale)
+{
+	struct kgsl_pwrctrl *pwr = &device->pwrctrl;
+	struct history_priv *priv = pwrscale->priv;
+	struct kgsl_power_stats stats;
+	unsigned int level = pwr->active_pwrlevel;
+	unsigned int fmax = history_freq(pwr, 0);
+	unsigned int fcur = history_freq(pwr, level);
+	unsigned int fnext;
+	unsigned int load, scaled, avg, cur_load, next_load;
+
+	device->ftbl->power_stats(device, &stats);
+	priv->bin.total_time += stats.total_time;
+	priv->bin.busy_time += stats.busy_time;
+
+	if (stats.total_time == 0 || priv->bin.total_time < priv->window_us)
+		return;
+
+	if (priv->bin.busy_time > CEILING) {
+		history_reset(priv);
+		kgsl_pwrctrl_pwrlevel_change(device, pwr->max_pwrlevel);
+		return;
+	}
+
+	load = div64_s64(priv->bin.busy_time * 100, priv->bin.total_time);
+	priv->bin.total_time = 0;
+	priv->bin.busy_time = 0;
+
+	scaled = fmax ? div_u64((u64)load * fcur, fmax) : load;
+	priv->load[priv->head] = scaled;
+	priv->head = (priv->head + 1) % HISTORY_MAX;
+	priv->nr_samples++;
+
+	if (load > priv->up_threshold) {
+		if (level > 0)
+			kgsl_pwrctrl_pwrlevel_change(device, level - 1);
+		return;
+	}
+
+	if (level + 1 >= pwr->num_pwrlevels)
+		return;
+
+	/* Only scale down once the whole history has been seen */
+	if (priv->nr_samples < priv->history_size)
+		return;
+
+	fnext = history_freq(pwr, level + 1);
+	if (fcur == 0 || fnext == 0)
+		return;
+
+	/* Loads the history would have meant at this level and the next */
+	avg = history_average(priv);
+	cur_load = div_u64((u64)avg * fmax, fcur);
+	next_load = div_u64((u64)avg * fmax, fnext);
+
+	if (cur_load < priv->down_threshold &&
+	    next_load < priv->up_threshold) {
+		kgsl_pwrctrl_pwrlevel_change(device, level + 1);
+		/* Judge the new level on its own samples */
+		priv->nr_samples = 0;
+	}
+}
+
+static void history_busy(struct kgsl_device *device,
+			 struct kgsl_pwrscale *pwrscale)
+{
+	device->on_time = ktime_to_us(ktime_get());
+}
+
+static void history_sleep(struct kgsl_device *device,
+			  struct kgsl_pwrscale *pwrscale)
+{
+	history_reset(pwrscale->priv);
+}
+
+static void history_wake(struct kgsl_device *device,
+			 struct kgsl_pwrscale *pwrscale)
+{
+	if (device->state != KGSL_STATE_NAP)
+		kgsl_pwrctrl_pwrlevel_change(device,
+					     device->pwrctrl.default_pwrlevel);
+}
+
+static ssize_t history_show_val(unsigned int val, char *buf)
+{
+	return snprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
+static int history_store_val(struct kgsl_device *device, const char *buf,
+			     unsigned int *val, unsigned int min,
+			     unsigned int max)
+{
+	unsigned long v;
+	int ret;
+
+	ret = kstrtoul(buf, 0, &v);
+	if (ret)
+		return ret;
+	if (v < min || v > max)
+		return -EINVAL;
+
+	mutex_lock(&device->mutex);
+	*val = v;
+	mutex_unlock(&device->mutex);
+
+	return 0;
+}
+
+#define HISTORY_ATTR(_name, _min, _max)					\
+static ssize_t history_##_name##_show(struct kgsl_device *device,	\
+				      struct kgsl_pwrscale *pwrscale,	\
+				      char *buf)			\
+{									\
+	struct history_priv *priv = pwrscale->priv;			\
+	return history_show_val(priv->_name, buf);			\
+}									\
+static ssize_t history_##_name##_store(struct kgsl_device *device,	\
+				       struct kgsl_pwrscale *pwrscale,	\
+				       const char *buf, size_t count)	\
+{									\
+	struct history_priv *priv = pwrscale->priv;			\
+	int ret = history_store_val(device, buf, &priv->_name,		\
+				    _min, _max);			\
+	return ret ? ret : count;					\
+}									\
+PWRSCALE_POLICY_ATTR(_name, 0644, history_##_name##_show,		\
+		     history_##_name##_store)
+
+HISTORY_ATTR(window_us, 1000, 100000);
+HISTORY_ATTR(history_size, 1, HISTORY_MAX);
+HISTORY_ATTR(up_threshold, 1, 100);
+HISTORY_ATTR(down_threshold, 0, 100);
+
+static ssize_t history_load_show(struct kgsl_device *device,
+				 struct kgsl_pwrscale *pwrscale,
+				 char *buf)
+{
+	struct history_priv *priv = pwrscale->priv;
+	unsigned int avg;
+
+	mutex_lock(&device->mutex);
+	avg = history_average(priv);
+	mutex_unlock(&device->mutex);
+
+	return history_show_val(avg, buf);
+}
+
+PWRSCALE_POLICY_ATTR(load, 0444, history_load_show, NULL);
+
+static struct attribute *history_attrs[] = {
+	&policy_attr_window_us.attr,
+	&policy_attr_history_size.attr,
+	&policy_attr_up_threshold.attr,
+	&policy_attr_down_threshold.attr,
+	&policy_attr_load.attr,
+	NULL
+};
+
+static struct attribute_group history_attr_group = {
+	.attrs = history_attrs,
+};
+
+static int history_init(struct kgsl_device *device,
+			struct kgsl_pwrscale *pwrscale)
+{
+	struct history_priv *priv;
+
+	priv = pwrscale->priv = kzalloc(sizeof(struct history_priv),
+					GFP_KERNEL);
+	if (pwrscale->priv == NULL)
+		return -ENOMEM;
+
+	priv->window_us = DEFAULT_WINDOW_US;
+	priv->history_size = DEFAULT_HISTORY_SIZE;
+	priv->up_threshold = DEFAULT_UP_THRESHOLD;
+	priv->down_threshold = DEFAULT_DOWN_THRESHOLD;
+	kgsl_pwrscale_policy_add_files(device, pwrscale, &history_attr_group);
+
+	return 0;
+}
+
+static void history_close(struct kgsl_device *device,
+			  struct kgsl_pwrscale *pwrscale)
+{
+	kgsl_pwrscale_policy_remove_files(device, pwrscale,
+					  &history_attr_group);
+	kfree(pwrscale->priv);
+	pwrscale->priv = NULL;
+}
+
+struct kgsl_pwrscale_policy kgsl_pwrscale_policy_history = {
+	.name = "history",
+	.init = history_init,
+	.busy = history_busy,
+	.idle = history_idle,
+	.sleep = history_sleep,
+	.wake = history_wake,
+	.close = history_close
+};
+EXPORT_SYMBOL(kgsl_pwrscale_policy_history);
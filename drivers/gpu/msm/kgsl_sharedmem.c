@@ -18,11 +18,13 @@
 #include <linux/slab.h>
 #include <linux/kmemleak.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 
 #include "kgsl.h"
 #include "kgsl_sharedmem.h"
 #include "kgsl_cffdump.h"
 #include "kgsl_device.h"
+#include "kgsl_pool.h"
 
 /* An attribute for showing per-process memory statistics */
 struct kgsl_mem_entry_attribute {
@@ -220,6 +222,12 @@ static int kgsl_drv_memstat_show(struct device *dev,
 		val = kgsl_driver.stats.mapped;
 	else if (!strncmp(attr->attr.name, "mapped_max", 10))
 		val = kgsl_driver.stats.mapped_max;
+	else if (!strncmp(attr->attr.name, "page_pool_hits", 14))
+		val = kgsl_pool_hits();
+	else if (!strncmp(attr->attr.name, "page_pool_misses", 16))
+		val = kgsl_pool_misses();
+	else if (!strncmp(attr->attr.name, "page_pool", 9))
+		val = kgsl_pool_size() << PAGE_SHIFT;
 
 	return snprintf(buf, PAGE_SIZE, "%u\n", val);
 }
@@ -239,6 +247,25 @@ static int kgsl_drv_histogram_show(struct device *dev,
 	return len;
 }
 
+/*
+ * Bucket i counts the page allocations that took less than 16 << i
+ * microseconds, the last bucket everything slower
+ */
+static int kgsl_drv_alloc_latency_show(struct device *dev,
+				       struct device_attribute *attr,
+				       char *buf)
+{
+	int len = 0;
+	int i;
+
+	for (i = 0; i < KGSL_ALLOC_LATENCY_BUCKETS; i++)
+		len += snprintf(buf + len, PAGE_SIZE - len, "%d ",
+			kgsl_driver.stats.alloc_latency[i]);
+
+	len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
 DEVICE_ATTR(vmalloc, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(vmalloc_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(page_alloc, 0444, kgsl_drv_memstat_show, NULL);
@@ -248,6 +275,10 @@ DEVICE_ATTR(coherent_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(histogram, 0444, kgsl_drv_histogram_show, NULL);
+DEVICE_ATTR(alloc_latency, 0444, kgsl_drv_alloc_latency_show, NULL);
+DEVICE_ATTR(page_pool, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_pool_hits, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(page_pool_misses, 0444, kgsl_drv_memstat_show, NULL);
 
 static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_vmalloc,
@@ -259,6 +290,10 @@ static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_mapped,
 	&dev_attr_mapped_max,
 	&dev_attr_histogram,
+	&dev_attr_alloc_latency,
+	&dev_attr_page_pool,
+	&dev_attr_page_pool_hits,
+	&dev_attr_page_pool_misses,
 	NULL
 };
 
@@ -302,10 +337,22 @@ static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 	}
 }
 
+static void outer_cache_range_op_pages(struct page **pages, int count, int op)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		_outer_cache_range_op(op, page_to_phys(pages[i]), PAGE_SIZE);
+}
+
 #else
 static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 {
 }
+
+static void outer_cache_range_op_pages(struct page **pages, int count, int op)
+{
+}
 #endif
 
 static int kgsl_page_alloc_vmfault(struct kgsl_memdesc *memdesc,
@@ -371,7 +418,7 @@ static void kgsl_page_alloc_free(struct kgsl_memdesc *memdesc)
 		for_each_sg(memdesc->sg, sg, sglen, i){
 			if (sg->length == 0)
 				break;
-			__free_pages(sg_page(sg), get_order(sg->length));
+			kgsl_pool_free_page(sg_page(sg), get_order(sg->length));
 		}
 }
 
@@ -539,6 +586,7 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	pgprot_t page_prot = pgprot_writecombine(PAGE_KERNEL);
 	void *ptr;
 	unsigned int align;
+	ktime_t start = ktime_get();
 
 	align = (memdesc->flags & KGSL_MEMALIGN_MASK) >> KGSL_MEMALIGN_SHIFT;
 
@@ -609,6 +657,14 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 		else
 			gfp_mask |= GFP_KERNEL;
 
+		/* Pooled pages are already clear and out of the caches */
+		page = kgsl_pool_alloc_page(get_order(page_size));
+		if (page != NULL) {
+			sg_set_page(&memdesc->sg[sglen++], page, page_size, 0);
+			len -= page_size;
+			continue;
+		}
+
 		page = alloc_pages(gfp_mask, get_order(page_size));
 
 		if (page == NULL) {
@@ -659,14 +715,14 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	 * microseconds at best.  The only downside is that there needs to be
 	 * enough temporary space in vmalloc to accomodate the map. This
 	 * shouldn't be a problem, but if it happens, fall back to a much slower
-	 * path
+	 * path. Only the pages that did not come from the pool need this.
 	 */
 
-	ptr = vmap(pages, pcount, VM_IOREMAP, page_prot);
+	ptr = pcount ? vmap(pages, pcount, VM_IOREMAP, page_prot) : NULL;
 
 	if (ptr != NULL) {
-		memset(ptr, 0, memdesc->size);
-		dmac_flush_range(ptr, ptr + memdesc->size);
+		memset(ptr, 0, pcount << PAGE_SHIFT);
+		dmac_flush_range(ptr, ptr + (pcount << PAGE_SHIFT));
 		vunmap(ptr);
 	} else {
 		/* Very, very, very slow path */
@@ -679,14 +735,17 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 		}
 	}
 
-	outer_cache_range_op_sg(memdesc->sg, memdesc->sglen,
-				KGSL_CACHE_OP_FLUSH);
+	outer_cache_range_op_pages(pages, pcount, KGSL_CACHE_OP_FLUSH);
 
 	order = get_order(size);
 
 	if (order < 16)
 		kgsl_driver.stats.histogram[order]++;
 
+	order = fls(ktime_us_delta(ktime_get(), start) >> 4);
+	kgsl_driver.stats.alloc_latency[min(order,
+					    KGSL_ALLOC_LATENCY_BUCKETS - 1)]++;
+
 done:
 	KGSL_STATS_ADD(memdesc->size, kgsl_driver.stats.page_alloc,
 		kgsl_driver.stats.page_alloc_max);
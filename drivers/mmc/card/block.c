@@ -59,6 +59,9 @@ MODULE_ALIAS("mmc:block");
 #define INAND_CMD38_ARG_SECTRIM1 0x81
 #define INAND_CMD38_ARG_SECTRIM2 0x88
 
+#define PACKED_CMD_VER	0x01
+#define PACKED_CMD_WR	0x02
+
 static DEFINE_MUTEX(block_mutex);
 
 /*
@@ -77,6 +80,42 @@ static int max_devices;
 static DECLARE_BITMAP(dev_use, 256);
 static DECLARE_BITMAP(name_use, 256);
 
+/* Why mmc_blk_prep_packed_list() stopped adding requests to a group */
+enum mmc_blk_pack_stop {
+	MMC_BLK_PACK_EMPTY_QUEUE,
+	MMC_BLK_PACK_MAX_ENTRIES,
+	MMC_BLK_PACK_MAX_BLOCKS,
+	MMC_BLK_PACK_MAX_SEGMENTS,
+	MMC_BLK_PACK_WRONG_DIR,
+	MMC_BLK_PACK_FLUSH_DISCARD,
+	MMC_BLK_PACK_REL_WR,
+	MMC_BLK_PACK_WP_REGION,
+	MMC_BLK_PACK_STOP_MAX,
+};
+
+static const char * const mmc_blk_pack_stop_names[] = {
+	[MMC_BLK_PACK_EMPTY_QUEUE]	= "empty_queue",
+	[MMC_BLK_PACK_MAX_ENTRIES]	= "max_entries",
+	[MMC_BLK_PACK_MAX_BLOCKS]	= "max_blocks",
+	[MMC_BLK_PACK_MAX_SEGMENTS]	= "max_segments",
+	[MMC_BLK_PACK_WRONG_DIR]	= "wrong_data_dir",
+	[MMC_BLK_PACK_FLUSH_DISCARD]	= "flush_or_discard",
+	[MMC_BLK_PACK_REL_WR]		= "rel_write",
+	[MMC_BLK_PACK_WP_REGION]	= "wp_region",
+};
+
+/*
+ * Updated by the queue thread only, so the counters are not locked;
+ * a reader may see them slightly out of step with each other.
+ */
+struct mmc_blk_packed_stats {
+	unsigned long	packed_cmds;	/* packed writes completed */
+	unsigned long	packed_reqs;	/* requests completed by them */
+	unsigned long	single_wrs;	/* writes that could not be packed */
+	unsigned long	failures;	/* packed writes reported failed */
+	unsigned long	stop[MMC_BLK_PACK_STOP_MAX];
+};
+
 /*
  * There is one mmc_blk_data per slot.
  */
@@ -89,6 +128,7 @@ struct mmc_blk_data {
 	unsigned int	flags;
 #define MMC_BLK_CMD23	(1 << 0)	/* Can do SET_BLOCK_COUNT for multiblock */
 #define MMC_BLK_REL_WR	(1 << 1)	/* MMC Reliable write support */
+#define MMC_BLK_PACKED_CMD	(1 << 2)	/* MMC packed command support */
 
 	unsigned int	usage;
 	unsigned int	read_only;
@@ -102,6 +142,11 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+
+	unsigned int	packed_en;	/* packing allowed through sysfs */
+	struct mmc_blk_packed_stats packed_stats;
+	struct device_attribute packed_en_attr;
+	struct device_attribute packed_stats_attr;
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -177,6 +222,80 @@ out:
 	return ret;
 }
 
+static ssize_t packed_en_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	int ret;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	ret = snprintf(buf, PAGE_SIZE, "%u\n", md->packed_en);
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t packed_en_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int ret;
+	char *end;
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	unsigned long set = simple_strtoul(buf, &end, 0);
+
+	if (end == buf) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	md->packed_en = !!set;
+	ret = count;
+out:
+	mmc_blk_put(md);
+	return ret;
+}
+
+static ssize_t packed_stats_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+	struct mmc_blk_packed_stats *stats = &md->packed_stats;
+	unsigned long cmds = stats->packed_cmds;
+	unsigned long reqs = stats->packed_reqs;
+	unsigned long wrs = reqs + stats->single_wrs;
+	int i, ret;
+
+	ret = snprintf(buf, PAGE_SIZE,
+		       "packed_cmds %lu\n"
+		       "packed_reqs %lu\n"
+		       "single_writes %lu\n"
+		       "failures %lu\n"
+		       "reqs_per_packed %lu.%02lu\n"
+		       "packed_pct %lu\n",
+		       cmds, reqs, stats->single_wrs, stats->failures,
+		       cmds ? reqs / cmds : 0,
+		       cmds ? (reqs * 100 / cmds) % 100 : 0,
+		       wrs ? reqs * 100 / wrs : 0);
+
+	for (i = 0; i < MMC_BLK_PACK_STOP_MAX; i++)
+		ret += snprintf(buf + ret, PAGE_SIZE - ret, "stop_%s %lu\n",
+				mmc_blk_pack_stop_names[i], stats->stop[i]);
+
+	mmc_blk_put(md);
+	return ret;
+}
+
+/* Any write resets the statistics */
+static ssize_t packed_stats_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
+
+	memset(&md->packed_stats, 0, sizeof(md->packed_stats));
+	mmc_blk_put(md);
+	return count;
+}
+
 static int mmc_blk_open(struct block_device *bdev, fmode_t mode)
 {
 	struct mmc_blk_data *md = mmc_blk_get(bdev->bd_disk);
@@ -433,14 +552,6 @@ static const struct block_device_operations mmc_bdops = {
 #endif
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	sbc;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
-};
-
 static inline int mmc_blk_part_switch(struct mmc_card *card,
 				      struct mmc_blk_data *md)
 {
@@ -807,6 +918,12 @@ static int mmc_blk_issue_flush(struct mmc_queue *mq, struct request *req)
 	return 1;
 }
 
+static inline bool mmc_req_rel_wr(struct request *req)
+{
+	return ((req->cmd_flags & REQ_FUA) || (req->cmd_flags & REQ_META)) &&
+		(rq_data_dir(req) == WRITE);
+}
+
 /*
  * Reformat current write as a reliable write, supporting
  * both legacy and the enhanced reliable write MMC cards.
@@ -970,8 +1087,8 @@ static int sd_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 
 		mmc_set_data_timeout(&brq.data, card);
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+		brq.data.sg = mq->mqrq_cur->sg;
+		brq.data.sg_len = mmc_queue_map_sg(mq, mq->mqrq_cur);
 
 		/*
 		 * Adjust the sg list so it is the same size as the
@@ -994,11 +1111,11 @@ static int sd_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 #ifdef CONFIG_MMC_PERF_PROFILING
 		start = ktime_get();
 #endif
-		mmc_queue_bounce_pre(mq);
+		mmc_queue_bounce_pre(mq->mqrq_cur);
 
 		mmc_wait_for_req(card->host, &brq.mrq);
 
-		mmc_queue_bounce_post(mq);
+		mmc_queue_bounce_post(mq->mqrq_cur);
 #ifdef CONFIG_MMC_PERF_PROFILING
 		diff = ktime_sub(ktime_get(), start);
 		if (ktime_to_us(diff) > 400000)
@@ -1243,313 +1360,974 @@ recovery:
 	return 0;
 }
 
-static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
+enum mmc_blk_status {
+	MMC_BLK_SUCCESS = 0,
+	MMC_BLK_PARTIAL,	/* more of the request is left */
+	MMC_BLK_CMD_ERR,	/* sbc, r/w or stop command failed */
+	MMC_BLK_RETRY,
+	MMC_BLK_ABORT,
+	MMC_BLK_XFER_ERR,	/* lost the card while it was programming */
+	MMC_BLK_NOT_READY,	/* card stayed busy after a write */
+	MMC_BLK_DATA_ERR,
+	MMC_BLK_URGENT,		/* stopped for an urgent request */
+};
+
+#if defined(CONFIG_MMC_DISABLE_WP_RFG_5)
+/*
+ * 2012 March, SHR ICS reports radio_config cannot be written.
+ * To workaround this issue, we disable write protection
+ * of radio_config on SHR/SHR#K.
+ * To protect the RF calibration data, we perform manually write
+ * protection for rfg_0 - rfg_4, rfg_6-rfg_7: writes there are
+ * completed without touching the card.
+ */
+static bool mmc_blk_wp_region(struct mmc_card *card, struct request *req)
 {
-	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0, retry = 0;
-	int reinit_retry = 1;
+	u32 arg = blk_rq_pos(req);
+
+	if (rq_data_dir(req) != WRITE || !mmc_card_mmc(card) ||
+	    !card->write_prot_type)
+		return false;
+
+	if (!mmc_card_blockaddr(card))
+		arg <<= 9;
+	return (arg > 212993 && arg < 223234) ||
+	       (arg > 225282 && arg < 229376);
+}
+
+static bool mmc_blk_wp_skip(struct mmc_blk_data *md, struct mmc_card *card,
+			    struct request *req)
+{
+	if (!mmc_blk_wp_region(card, req))
+		return false;
+
+	spin_lock_irq(&md->lock);
+	__blk_end_request_all(req, 0);
+	spin_unlock_irq(&md->lock);
+	return true;
+}
+#else
+static inline bool mmc_blk_wp_region(struct mmc_card *card,
+				     struct request *req)
+{
+	return false;
+}
+
+static inline bool mmc_blk_wp_skip(struct mmc_blk_data *md,
+				   struct mmc_card *card, struct request *req)
+{
+	return false;
+}
+#endif
+
+/*
+ * Everything after the r/w command itself went through: check the
+ * response, wait for a write to be programmed and look at the data.
+ */
+static int mmc_blk_xfer_check(struct mmc_card *card,
+			      struct mmc_queue_req *mq_rq)
+{
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	struct request *req = mq_rq->req;
+	unsigned int bytes;
+	int no_ready = 0;
 	int err;
+
+	/*
+	 * Check for errors relating to the execution of the
+	 * initial command - such as address errors.  No data
+	 * has been transferred.
+	 */
+	if (brq->cmd.resp[0] & CMD_ERRORS) {
+		pr_err("%s: r/w command failed, status = %#x\n",
+			req->rq_disk->disk_name, brq->cmd.resp[0]);
+		return MMC_BLK_ABORT;
+	}
+
+	/*
+	 * Everything else is either success, or a data error of some
+	 * kind.  If it was a write, we may have transitioned to
+	 * program mode, which we have to wait for it to complete.
+	 */
+	if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
+		int i = 0;
+		unsigned long timeout = jiffies + HZ * 2;
+		u32 status;
+		do {
+			err = get_card_status(card, &status, 5);
+			if (err) {
+				printk(KERN_ERR "%s: error %d requesting status\n",
+				       req->rq_disk->disk_name, err);
+				return MMC_BLK_XFER_ERR;
+			}
+			if (time_after(jiffies, timeout) && (i > 1000)) {
+				if ((status & R1_READY_FOR_DATA) &&
+					(R1_CURRENT_STATE(status) == 4)) {
+					printk(KERN_ERR "%s: timeout but get card ready i = %d\n",
+					mmc_hostname(card->host), i);
+					break;
+				}
+				no_ready = 1;
+				printk(KERN_ERR "%s: card is not ready (%d)\n",
+					mmc_hostname(card->host), i);
+				break;
+			}
+			i++;
+			/*
+			 * Some cards mishandle the status bits,
+			 * so make sure to check both the busy
+			 * indication and the card state.
+			 */
+		} while (!(status & R1_READY_FOR_DATA) ||
+			 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+	}
+
+	/* The host stopped the write, see mmc_notify_urgent() */
+	if (brq->data.error == -EINTR)
+		return MMC_BLK_URGENT;
+
+	if (brq->data.error) {
+		pr_err("%s: error %d transferring data, sector %u, nr %u, cmd response %#x, card status %#x\n",
+			req->rq_disk->disk_name, brq->data.error,
+			(unsigned)blk_rq_pos(req),
+			(unsigned)blk_rq_sectors(req),
+			brq->cmd.resp[0], brq->stop.resp[0]);
+		return MMC_BLK_DATA_ERR;
+	}
+
+	if (no_ready)
+		return MMC_BLK_NOT_READY;
+
+	/* A packed write carries more than its first request */
+	if (mmc_packed_cmd(mq_rq->cmd_type))
+		bytes = brq->data.blocks * brq->data.blksz;
+	else
+		bytes = blk_rq_bytes(req);
+	if (bytes != brq->data.bytes_xfered)
+		return MMC_BLK_PARTIAL;
+
+	return MMC_BLK_SUCCESS;
+}
+
+/*
+ * Called by mmc_start_req() once a request has completed, before the
+ * next one is started. Anything but MMC_BLK_SUCCESS keeps the next
+ * request from being started.
+ */
+static int mmc_blk_err_check(struct mmc_card *card,
+			     struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_mrq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct mmc_blk_request *brq = &mq_mrq->brq;
+
+	/*
+	 * sbc.error indicates a problem with the set block count
+	 * command.  No data will have been transferred.
+	 *
+	 * cmd.error indicates a problem with the r/w command.  No
+	 * data will have been transferred.
+	 *
+	 * stop.error indicates a problem with the stop command.  Data
+	 * may have been transferred, or may still be transferring.
+	 */
+	if (brq->sbc.error || brq->cmd.error || brq->stop.error)
+		return MMC_BLK_CMD_ERR;
+
+	return mmc_blk_xfer_check(card, mq_mrq);
+}
+
+/*
+ * On top of the checks of a normal write, look at the exception event
+ * status: the card reports there which entry of the group failed.
+ */
+static int mmc_blk_packed_err_check(struct mmc_card *card,
+				    struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+						   mmc_active);
+	struct request *req = mq_rq->req;
+	struct mmc_blk_data *md = req->rq_disk->private_data;
+	struct mmc_packed *packed = mq_rq->packed;
+	int err, check;
 	u32 status;
-	int  no_ready = 0;
+	u8 *ext_csd;
+
+	BUG_ON(!packed);
+
+	packed->retries--;
+	check = mmc_blk_err_check(card, areq);
+	if (check == MMC_BLK_URGENT)
+		return check;
+	err = get_card_status(card, &status, 0);
+	if (err) {
+		pr_err("%s: error %d sending status command\n",
+		       req->rq_disk->disk_name, err);
+		return MMC_BLK_ABORT;
+	}
+
+	if (!(status & R1_EXCEPTION_EVENT))
+		return check;
+
+	ext_csd = kzalloc(512, GFP_KERNEL);
+	if (!ext_csd) {
+		pr_err("%s: unable to allocate buffer for ext_csd\n",
+		       req->rq_disk->disk_name);
+		return MMC_BLK_ABORT;
+	}
+
+	err = mmc_send_ext_csd(card, ext_csd);
+	if (err) {
+		pr_err("%s: error %d sending ext_csd\n",
+		       req->rq_disk->disk_name, err);
+		check = MMC_BLK_ABORT;
+		goto free;
+	}
+
+	if ((ext_csd[EXT_CSD_EXP_EVENTS_STATUS] & EXT_CSD_PACKED_FAILURE) &&
+	    (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+	     EXT_CSD_PACKED_GENERIC_ERROR)) {
+		int idx = 0;
+
+		/* The failure index is 1-based; without one, resend all */
+		if (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+		    EXT_CSD_PACKED_INDEXED_ERROR)
+			idx = ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] - 1;
+		if (idx < 0 || idx >= packed->nr_entries)
+			idx = 0;
+		packed->idx_failure = idx;
+		check = MMC_BLK_PARTIAL;
+		md->packed_stats.failures++;
+		pr_err("%s: packed cmd failed, nr %u, sectors %u, "
+		       "failure index: %d\n",
+		       req->rq_disk->disk_name, packed->nr_entries,
+		       packed->blocks, packed->idx_failure);
+	}
+free:
+	kfree(ext_csd);
+
+	return check;
+}
+
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
+{
+	u32 readcmd, writecmd;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	struct mmc_blk_data *md = mq->data;
 
 	/*
 	 * Reliable writes are used to implement Forced Unit Access and
 	 * REQ_META accesses, and are supported only on MMCs.
 	 */
-	bool do_rel_wr = ((req->cmd_flags & REQ_FUA) ||
-			  (req->cmd_flags & REQ_META)) &&
-		(rq_data_dir(req) == WRITE) &&
+	bool do_rel_wr = mmc_req_rel_wr(req) &&
 		(md->flags & MMC_BLK_REL_WR);
 
-	do {
-		u32 readcmd, writecmd;
+	mqrq->cmd_type = MMC_PACKED_NONE;
 
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
 
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
 
-		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
-		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
 
-		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
+
+	if (brq->data.blocks > 1 || do_rel_wr) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
 		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
+		if (!mmc_host_is_spi(card->host) ||
+		    rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
 
-		if (brq.data.blocks > 1 || do_rel_wr) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host) ||
-			    rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
-		}
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
+	if (do_rel_wr)
+		mmc_apply_rel_rw(brq, card, req);
 
-#if defined(CONFIG_MMC_DISABLE_WP_RFG_5)
-			if (mmc_card_mmc(card)) {
-				if (card->write_prot_type) {
-					/* 2012 March, SHR ICS reports radio_config cannot be written.   */
-					/* To workaround this issue, we disable write protection         */
-					/* of radio_config on SHR/SHR#K.								 */
-					/* To protect the RF calibration data, we perform manuelly write */
-					/* protection for rfg_0 - rfg_4, rfg_6-rfg_7                     */
-					if ((brq.cmd.arg > 212993 && brq.cmd.arg < 223234) || (brq.cmd.arg > 225282 && brq.cmd.arg < 229376)) {
-						brq.data.bytes_xfered = (brq.data.blocks << 9);
-						spin_lock_irq(&md->lock);
-						ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
-						spin_unlock_irq(&md->lock);
-						mmc_release_host(card->host);
-						return 1;
-					}
-				}
-			}
-#endif
-		}
+	/*
+	 * Pre-defined multi-block transfers are preferable to
+	 * open ended-ones (and necessary for reliable writes).
+	 * However, it is not sufficient to just send CMD23,
+	 * and avoid the final CMD12, as on an error condition
+	 * CMD12 (stop) needs to be sent anyway. This, coupled
+	 * with Auto-CMD23 enhancements provided by some
+	 * hosts, means that the complexity of dealing
+	 * with this is best left to the host. If CMD23 is
+	 * supported by card and host, we'll fill sbc in and let
+	 * the host deal with handling it correctly. This means
+	 * that for hosts that don't expose MMC_CAP_CMD23, no
+	 * change of behavior will be observed.
+	 *
+	 * N.B: Some MMC cards experience perf degradation.
+	 * We'll avoid using CMD23-bounded multiblock writes for
+	 * these, while retaining features like reliable writes.
+	 */
 
-		if (do_rel_wr)
-			mmc_apply_rel_rw(&brq, card, req);
+	if ((md->flags & MMC_BLK_CMD23) &&
+	    mmc_op_multi(brq->cmd.opcode) &&
+	    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
+		brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+		brq->sbc.arg = brq->data.blocks |
+			(do_rel_wr ? MMC_CMD23_ARG_REL_WR : 0);
+		brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+		brq->mrq.sbc = &brq->sbc;
+	}
 
-		/*
-		 * Pre-defined multi-block transfers are preferable to
-		 * open ended-ones (and necessary for reliable writes).
-		 * However, it is not sufficient to just send CMD23,
-		 * and avoid the final CMD12, as on an error condition
-		 * CMD12 (stop) needs to be sent anyway. This, coupled
-		 * with Auto-CMD23 enhancements provided by some
-		 * hosts, means that the complexity of dealing
-		 * with this is best left to the host. If CMD23 is
-		 * supported by card and host, we'll fill sbc in and let
-		 * the host deal with handling it correctly. This means
-		 * that for hosts that don't expose MMC_CAP_CMD23, no
-		 * change of behavior will be observed.
-		 *
-		 * N.B: Some MMC cards experience perf degradation.
-		 * We'll avoid using CMD23-bounded multiblock writes for
-		 * these, while retaining features like reliable writes.
-		 */
+	mmc_set_data_timeout(&brq->data, card);
 
-		if ((md->flags & MMC_BLK_CMD23) &&
-		    mmc_op_multi(brq.cmd.opcode) &&
-		    (do_rel_wr || !(card->quirks & MMC_QUIRK_BLK_NO_CMD23))) {
-			brq.sbc.opcode = MMC_SET_BLOCK_COUNT;
-			brq.sbc.arg = brq.data.blocks |
-				(do_rel_wr ? (1 << 31) : 0);
-			brq.sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
-			brq.mrq.sbc = &brq.sbc;
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
+			}
 		}
+		brq->data.sg_len = i;
+	}
 
-		mmc_set_data_timeout(&brq.data, card);
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
 
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
+	mmc_queue_bounce_pre(mqrq);
+}
 
-		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
-		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
+static inline void mmc_blk_clear_packed(struct mmc_queue_req *mqrq)
+{
+	struct mmc_packed *packed = mqrq->packed;
 
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
-			}
-			brq.data.sg_len = i;
+	BUG_ON(!packed);
+
+	mqrq->cmd_type = MMC_PACKED_NONE;
+	packed->nr_entries = MMC_PACKED_NR_ZERO;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+	packed->retries = 0;
+	packed->blocks = 0;
+}
+
+/*
+ * Pull the writes queued behind req off the request queue, as long as
+ * they fit into one packed command together with it. Returns the size
+ * of the group, or 0 if req is to be issued on its own.
+ */
+static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_card *card = mq->card;
+	struct request *cur = req, *next = NULL;
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct mmc_blk_packed_stats *stats = &md->packed_stats;
+	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
+	unsigned int req_sectors = 0, phys_segments = 0;
+	unsigned int max_blk_count, max_phys_segs;
+	enum mmc_blk_pack_stop stop;
+	bool put_back = true;
+	u8 max_packed_rw;
+	u8 reqs = 0;
+
+	mqrq->cmd_type = MMC_PACKED_NONE;
+
+	if (!(md->flags & MMC_BLK_PACKED_CMD) || !md->packed_en ||
+	    rq_data_dir(cur) != WRITE)
+		return 0;
+
+	max_packed_rw = min_t(u8, card->ext_csd.max_packed_writes,
+			      MMC_PACKED_MAX_ENTRIES);
+
+	if (mmc_req_rel_wr(cur) &&
+	    (md->flags & MMC_BLK_REL_WR) && !en_rel_wr) {
+		stats->stop[MMC_BLK_PACK_REL_WR]++;
+		goto no_packed;
+	}
+
+	mmc_blk_clear_packed(mqrq);
+
+	/* CMD23 carries the block count in 16 bits */
+	max_blk_count = min(card->host->max_blk_count,
+			    card->host->max_req_size >> 9);
+	max_blk_count = min(max_blk_count, queue_max_hw_sectors(q));
+	if (unlikely(max_blk_count > 0xffff))
+		max_blk_count = 0xffff;
+
+	max_phys_segs = queue_max_segments(q);
+
+	/* The header takes a block and a segment of its own */
+	req_sectors += blk_rq_sectors(cur) + 1;
+	phys_segments += cur->nr_phys_segments + 1;
+
+	do {
+		if (reqs >= max_packed_rw - 1) {
+			stop = MMC_BLK_PACK_MAX_ENTRIES;
+			put_back = false;
+			break;
 		}
 
-		mmc_queue_bounce_pre(mq);
+		spin_lock_irq(q->queue_lock);
+		next = blk_fetch_request(q);
+		spin_unlock_irq(q->queue_lock);
+		if (!next) {
+			stop = MMC_BLK_PACK_EMPTY_QUEUE;
+			put_back = false;
+			break;
+		}
 
-		mmc_wait_for_req(card->host, &brq.mrq);
+		if (next->cmd_flags & REQ_DISCARD ||
+		    next->cmd_flags & REQ_FLUSH) {
+			stop = MMC_BLK_PACK_FLUSH_DISCARD;
+			break;
+		}
 
-		mmc_queue_bounce_post(mq);
+		if (rq_data_dir(cur) != rq_data_dir(next)) {
+			stop = MMC_BLK_PACK_WRONG_DIR;
+			break;
+		}
 
-		/*
-		 * sbc.error indicates a problem with the set block count
-		 * command.  No data will have been transferred.
-		 *
-		 * cmd.error indicates a problem with the r/w command.  No
-		 * data will have been transferred.
-		 *
-		 * stop.error indicates a problem with the stop command.  Data
-		 * may have been transferred, or may still be transferring.
-		 */
-		if (brq.sbc.error || brq.cmd.error || brq.stop.error) {
-			if (reinit_retry) {
-				reinit_retry = 0;
-				err = get_card_status(card, &status, 0);
-				if (err)
-					pr_info("%s: error %d sending status command\n",
-						req->rq_disk->disk_name, err);
-				else
-					pr_info("%s: card status %#x \n", req->rq_disk->disk_name, status);
-				pr_info("%s: reinit card\n", mmc_hostname(card->host));
-				if (mmc_reinit_card(card->host) == 0) {
-					mmc_blk_set_blksize(md, card);
-					continue;
-				}
-			}
-			switch (mmc_blk_cmd_recovery(card, req, &brq)) {
-			case ERR_RETRY:
-				if (retry++ < 5)
-					continue;
-			case ERR_ABORT:
-			case ERR_NOMEDIUM:
-				goto cmd_abort;
-			case ERR_CONTINUE:
-				break;
+		if (mmc_req_rel_wr(next) &&
+		    (md->flags & MMC_BLK_REL_WR) && !en_rel_wr) {
+			stop = MMC_BLK_PACK_REL_WR;
+			break;
+		}
+
+		/* Left for mmc_blk_wp_skip() to complete */
+		if (mmc_blk_wp_region(card, next)) {
+			stop = MMC_BLK_PACK_WP_REGION;
+			break;
+		}
+
+		req_sectors += blk_rq_sectors(next);
+		if (req_sectors > max_blk_count) {
+			stop = MMC_BLK_PACK_MAX_BLOCKS;
+			break;
+		}
+
+		phys_segments += next->nr_phys_segments;
+		if (phys_segments > max_phys_segs) {
+			stop = MMC_BLK_PACK_MAX_SEGMENTS;
+			break;
+		}
+
+		list_add_tail(&next->queuelist, &mqrq->packed->list);
+		cur = next;
+		reqs++;
+	} while (1);
+
+	stats->stop[stop]++;
+
+	if (put_back) {
+		spin_lock_irq(q->queue_lock);
+		blk_requeue_request(q, next);
+		spin_unlock_irq(q->queue_lock);
+	}
+
+	if (reqs > 0) {
+		list_add(&req->queuelist, &mqrq->packed->list);
+		mqrq->packed->nr_entries = ++reqs;
+		mqrq->packed->retries = reqs;
+		return reqs;
+	}
+
+no_packed:
+	mqrq->cmd_type = MMC_PACKED_NONE;
+	stats->single_wrs++;
+	return 0;
+}
+
+/*
+ * A packed write is a single CMD23/CMD25 pair whose first block is a
+ * header holding the CMD23 and CMD25 arguments of every request in the
+ * group; the data of the requests follows in the same order.
+ */
+static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	struct request *prq;
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_packed *packed = mqrq->packed;
+	bool do_rel_wr;
+	u32 *packed_cmd_hdr;
+	u8 i = 1;
+
+	BUG_ON(!packed);
+
+	mqrq->cmd_type = MMC_PACKED_WRITE;
+	packed->blocks = 0;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+
+	packed_cmd_hdr = packed->cmd_hdr;
+	memset(packed_cmd_hdr, 0, sizeof(packed->cmd_hdr));
+	packed_cmd_hdr[0] = (packed->nr_entries << 16) |
+		(PACKED_CMD_WR << 8) | PACKED_CMD_VER;
+
+	/*
+	 * Argument for each entry of packed group
+	 */
+	list_for_each_entry(prq, &packed->list, queuelist) {
+		do_rel_wr = mmc_req_rel_wr(prq) && (md->flags & MMC_BLK_REL_WR);
+		/* Argument of CMD23 */
+		packed_cmd_hdr[(i * 2)] =
+			(do_rel_wr ? MMC_CMD23_ARG_REL_WR : 0) |
+			blk_rq_sectors(prq);
+		/* Argument of CMD25 */
+		packed_cmd_hdr[((i * 2)) + 1] =
+			mmc_card_blockaddr(card) ?
+			blk_rq_pos(prq) : blk_rq_pos(prq) << 9;
+		packed->blocks += blk_rq_sectors(prq);
+		i++;
+	}
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.stop = &brq->stop;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | (packed->blocks + 1);
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = packed->blocks + 1;
+	brq->data.flags |= MMC_DATA_WRITE;
+
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_packed_err_check;
+
+	mmc_queue_bounce_pre(mqrq);
+}
+
+/*
+ * The card does not always say which entry of a partially transferred
+ * group failed: work it out from the byte count, keeping the index the
+ * card gave if that one is earlier.
+ */
+static void mmc_blk_packed_partial(struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	unsigned int xfered = mq_rq->brq.data.bytes_xfered;
+	struct request *prq;
+	int i = 0;
+
+	/* Skip the header */
+	xfered -= min_t(unsigned int, xfered, sizeof(packed->cmd_hdr));
+
+	list_for_each_entry(prq, &packed->list, queuelist) {
+		if (xfered < blk_rq_bytes(prq))
+			break;
+		xfered -= blk_rq_bytes(prq);
+		i++;
+	}
+
+	if (i < packed->nr_entries &&
+	    (packed->idx_failure == MMC_PACKED_NR_IDX ||
+	     i < packed->idx_failure))
+		packed->idx_failure = i;
+}
+
+/*
+ * Account a packed write that completed the first reqs requests of its
+ * group. Groups given back before they were sent are never counted.
+ */
+static void mmc_blk_packed_stats_done(struct mmc_blk_data *md, int reqs)
+{
+	if (reqs) {
+		md->packed_stats.packed_cmds++;
+		md->packed_stats.packed_reqs += reqs;
+	}
+}
+
+/*
+ * Complete the requests of a group up to the failed one, if any.
+ * Returns 1 if the rest of the group, starting with the failed
+ * request, has to be sent again.
+ */
+static int mmc_blk_end_packed_req(struct mmc_blk_data *md,
+				  struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request *prq;
+	int idx = packed->idx_failure, i = 0;
+
+	BUG_ON(!packed);
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.next);
+		if (idx == i) {
+			mmc_blk_packed_stats_done(md, i);
+
+			/* retry from error index */
+			packed->nr_entries -= idx;
+			mq_rq->req = prq;
+
+			if (packed->nr_entries == MMC_PACKED_NR_SINGLE) {
+				list_del_init(&prq->queuelist);
+				mmc_blk_clear_packed(mq_rq);
 			}
+			return 1;
 		}
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request_all(prq, 0);
+		spin_unlock_irq(&md->lock);
+		i++;
+	}
 
-		/*
-		 * Check for errors relating to the execution of the
-		 * initial command - such as address errors.  No data
-		 * has been transferred.
-		 */
-		if (brq.cmd.resp[0] & CMD_ERRORS) {
-			pr_err("%s: r/w command failed, status = %#x\n",
-				req->rq_disk->disk_name, brq.cmd.resp[0]);
-			goto cmd_abort;
+	mmc_blk_packed_stats_done(md, i);
+	mmc_blk_clear_packed(mq_rq);
+	return 0;
+}
+
+static void mmc_blk_abort_packed_req(struct mmc_blk_data *md,
+				     struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	struct mmc_card *card = md->queue.card;
+	struct request *prq;
+
+	BUG_ON(!packed);
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.next);
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		if (mmc_card_removed(card))
+			prq->cmd_flags |= REQ_QUIET;
+		__blk_end_request_all(prq, -EIO);
+		spin_unlock_irq(&md->lock);
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+}
+
+/*
+ * Give all but the first request of a group that was never sent back
+ * to the block layer, so that the first one can go out on its own.
+ */
+static void mmc_blk_revert_packed_req(struct mmc_queue *mq,
+				      struct mmc_queue_req *mq_rq)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request_queue *q = mq->queue;
+	struct request *prq;
+
+	BUG_ON(!packed);
+
+	/* The first request now goes out on its own */
+	md->packed_stats.single_wrs++;
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.prev);
+		list_del_init(&prq->queuelist);
+		if (prq != mq_rq->req) {
+			spin_lock_irq(q->queue_lock);
+			blk_requeue_request(q, prq);
+			spin_unlock_irq(q->queue_lock);
 		}
+	}
 
-		/*
-		 * Everything else is either success, or a data error of some
-		 * kind.  If it was a write, we may have transitioned to
-		 * program mode, which we have to wait for it to complete.
-		 */
-		if (!mmc_host_is_spi(card->host) && rq_data_dir(req) != READ) {
-			int i = 0;
-			unsigned long timeout = jiffies + HZ * 2;
-			u32 status;
-			do {
-				err = get_card_status(card, &status, 5);
-				if (err) {
-					printk(KERN_ERR "%s: error %d requesting status\n",
-					       req->rq_disk->disk_name, err);
-					goto cmd_err;
-				}
-				if (time_after(jiffies, timeout) && (i > 1000)) {
-					if ((status & R1_READY_FOR_DATA) &&
-						(R1_CURRENT_STATE(status) == 4)) {
-						printk(KERN_ERR "%s: timeout but get card ready i = %d\n",
-						mmc_hostname(card->host), i);
-						break;
-					}
-					no_ready = 1;
-					printk(KERN_ERR "%s: card is not ready (%d)\n",
-						mmc_hostname(card->host), i);
-					break;
-				}
-				i++;
-				/*
-				 * Some cards mishandle the status bits,
-				 * so make sure to check both the busy
-				 * indication and the card state.
-				 */
-			} while (!(status & R1_READY_FOR_DATA) ||
-				 (R1_CURRENT_STATE(status) == R1_STATE_PRG));
+	mmc_blk_clear_packed(mq_rq);
+}
+
+/*
+ * Give the requests of a write that was stopped for an urgent request
+ * back to the I/O scheduler, as if they had never been dispatched, so
+ * that the urgent request is served first.
+ */
+static void mmc_blk_reinsert_req(struct mmc_queue *mq,
+				 struct mmc_queue_req *mq_rq)
+{
+	struct request_queue *q = mq->queue;
+	struct request *prq;
+
+	spin_lock_irq(q->queue_lock);
+	if (mmc_packed_cmd(mq_rq->cmd_type)) {
+		/* Backwards, as each one goes to the head of its queue */
+		while (!list_empty(&mq_rq->packed->list)) {
+			prq = list_entry_rq(mq_rq->packed->list.prev);
+			list_del_init(&prq->queuelist);
+			if (blk_reinsert_request(q, prq))
+				blk_requeue_request(q, prq);
 		}
-		if (no_ready && reinit_retry) {
+		mmc_blk_clear_packed(mq_rq);
+	} else if (blk_reinsert_request(q, mq_rq->req)) {
+		blk_requeue_request(q, mq_rq->req);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	mq_rq->req = NULL;
+}
+
+/* Returns 0 if the card could be reinitialized */
+static int mmc_blk_reinit(struct mmc_blk_data *md, struct mmc_card *card,
+			  struct request *req)
+{
+	u32 status;
+	int err;
+
+	err = get_card_status(card, &status, 0);
+	if (err)
+		pr_info("%s: error %d sending status command\n",
+			req->rq_disk->disk_name, err);
+	else
+		pr_info("%s: card status %#x \n", req->rq_disk->disk_name, status);
+	pr_info("%s: reinit card\n", mmc_hostname(card->host));
+	if (mmc_reinit_card(card->host))
+		return -EIO;
+
+	mmc_blk_set_blksize(md, card);
+	return 0;
+}
+
+/*
+ * Start rqc, if any, and complete the request that was in flight
+ * before it, so that one request is always being prepared while the
+ * other is transferred. On errors the next request is held back until
+ * the previous one has been retried or failed.
+ */
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mq->mqrq_cur->brq;
+	int ret = 1, disable_multi = 0, retry = 0;
+	int reinit_retry = 1;
+	int status;
+	struct mmc_queue_req *mq_rq;
+	struct request *req;
+	struct mmc_async_req *areq;
+	u8 reqs = 0;
+
+	if (rqc && mmc_blk_wp_skip(md, card, rqc))
+		rqc = NULL;
+
+	if (!rqc && !mq->mqrq_prev->req)
+		return 0;
+
+	if (rqc)
+		reqs = mmc_blk_prep_packed_list(mq, rqc);
+
+	do {
+		if (rqc) {
+			if (reqs)
+				mmc_blk_packed_hdr_wrq_prep(mq->mqrq_cur, card,
+							    mq);
+			else
+				mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			areq = &mq->mqrq_cur->mmc_active;
+		} else
+			areq = NULL;
+		areq = mmc_start_req(card->host, areq, &status);
+		if (!areq)
+			return 0;
+
+		mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+		brq = &mq_rq->brq;
+		req = mq_rq->req;
+		mmc_queue_bounce_post(mq_rq);
+
+		/* Give errors one chance at reinitializing the card */
+		if (reinit_retry && (status == MMC_BLK_CMD_ERR ||
+				     status == MMC_BLK_NOT_READY ||
+				     status == MMC_BLK_DATA_ERR)) {
 			reinit_retry = 0;
-			pr_info("%s: card status %#x \n", req->rq_disk->disk_name, status);
-			pr_info("%s: reinit card\n", mmc_hostname(card->host));
-			if (mmc_reinit_card(card->host) == 0) {
-				mmc_blk_set_blksize(md, card);
+			if (!mmc_blk_reinit(md, card, req)) {
+				if (mmc_packed_cmd(mq_rq->cmd_type))
+					mmc_blk_packed_hdr_wrq_prep(mq_rq, card,
+								    mq);
+				else
+					mmc_blk_rw_rq_prep(mq_rq, card,
+							   disable_multi, mq);
+				mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
 				continue;
 			}
 		}
 
-		if (brq.data.error) {
-			pr_err("%s: error %d transferring data, sector %u, nr %u, cmd response %#x, card status %#x\n",
-				req->rq_disk->disk_name, brq.data.error,
-				(unsigned)blk_rq_pos(req),
-				(unsigned)blk_rq_sectors(req),
-				brq.cmd.resp[0], brq.stop.resp[0]);
-			if (reinit_retry) {
-				reinit_retry = 0;
-				err = get_card_status(card, &status, 0);
-				if (err)
-					pr_info("%s: error %d sending status command\n",
-						req->rq_disk->disk_name, err);
-				else
-					pr_info("%s: card status %#x \n", req->rq_disk->disk_name, status);
-				pr_info("%s: reinit card\n", mmc_hostname(card->host));
-				if (mmc_reinit_card(card->host) == 0) {
-					mmc_blk_set_blksize(md, card);
-					continue;
-				}
+		if (status == MMC_BLK_CMD_ERR) {
+			switch (mmc_blk_cmd_recovery(card, req, brq)) {
+			case ERR_RETRY:
+				status = MMC_BLK_RETRY;
+				break;
+			case ERR_ABORT:
+			case ERR_NOMEDIUM:
+				status = MMC_BLK_ABORT;
+				break;
+			case ERR_CONTINUE:
+				status = mmc_blk_xfer_check(card, mq_rq);
+				break;
 			}
+		}
 
-			if (rq_data_dir(req) == READ) {
-				if (brq.data.blocks > 1) {
-					/* Redo read one sector at a time */
-					pr_warning("%s: retrying using single block read\n",
-						req->rq_disk->disk_name);
-					disable_multi = 1;
-					continue;
-				}
-
+		switch (status) {
+		case MMC_BLK_SUCCESS:
+		case MMC_BLK_PARTIAL:
+		case MMC_BLK_NOT_READY:
+			/*
+			 * A block was successfully transferred.
+			 */
+			if (mmc_packed_cmd(mq_rq->cmd_type)) {
+				if (status == MMC_BLK_PARTIAL)
+					mmc_blk_packed_partial(mq_rq);
+				ret = mmc_blk_end_packed_req(md, mq_rq);
+				break;
+			}
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
+			spin_unlock_irq(&md->lock);
+			if (status == MMC_BLK_SUCCESS && ret) {
 				/*
-				 * After an error, we redo I/O one sector at a
-				 * time, so we only reach here after trying to
-				 * read a single sector.
+				 * All of the request was transferred, yet the
+				 * block layer has more of it: rqc is already
+				 * on its way, so fail the rest.
 				 */
-				spin_lock_irq(&md->lock);
-				ret = __blk_end_request(req, -EIO, brq.data.blksz);
-				spin_unlock_irq(&md->lock);
-				continue;
-			} else {
+				pr_err("%s: BUG rq_tot %d d_xfer %d\n",
+				       __func__, blk_rq_bytes(req),
+				       brq->data.bytes_xfered);
+				rqc = NULL;
+				goto cmd_abort;
+			}
+			break;
+		case MMC_BLK_RETRY:
+			if (retry++ < 5)
+				break;
+			/* Fall through */
+		case MMC_BLK_ABORT:
+			goto cmd_abort;
+		case MMC_BLK_CMD_ERR:
+		case MMC_BLK_XFER_ERR:
+			goto cmd_err;
+		case MMC_BLK_URGENT:
+			goto cmd_urgent;
+		case MMC_BLK_DATA_ERR:
+			if (rq_data_dir(req) != READ)
 				goto cmd_err;
+
+			if (brq->data.blocks > 1) {
+				/* Redo read one sector at a time */
+				pr_warning("%s: retrying using single block read\n",
+					req->rq_disk->disk_name);
+				disable_multi = 1;
+				break;
 			}
+
+			/*
+			 * After an error, we redo I/O one sector at a
+			 * time, so we only reach here after trying to
+			 * read a single sector.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, -EIO, brq->data.blksz);
+			spin_unlock_irq(&md->lock);
+			break;
 		}
 
-		/*
-		 * A block was successfully transferred.
-		 */
-		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
-		spin_unlock_irq(&md->lock);
+		if (status != MMC_BLK_SUCCESS && ret) {
+			/*
+			 * In case of a none complete request
+			 * prepare it again and resend.
+			 */
+			if (mmc_packed_cmd(mq_rq->cmd_type)) {
+				if (!mq_rq->packed->retries)
+					goto cmd_abort;
+				mmc_blk_packed_hdr_wrq_prep(mq_rq, card, mq);
+			} else
+				mmc_blk_rw_rq_prep(mq_rq, card, disable_multi,
+						   mq);
+			mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+		}
 	} while (ret);
 
+	/* The last request finished with an error, rqc was held back */
+	if (status != MMC_BLK_SUCCESS)
+		goto start_new_req;
+
 	return 1;
 
+ cmd_urgent:
+	/*
+	 * rqc was held back. A read can go right away, it is likely the
+	 * urgent request itself; anything else waits behind it too.
+	 */
+	if (rqc && rq_data_dir(rqc) != READ) {
+		mmc_blk_reinsert_req(mq, mq->mqrq_cur);
+		rqc = NULL;
+	}
+	mmc_blk_reinsert_req(mq, mq_rq);
+	goto start_new_req;
+
  cmd_err:
+	/* Which entries of a packed write made it is not known */
+	if (mmc_packed_cmd(mq_rq->cmd_type))
+		goto cmd_abort;
+
  	/*
  	 * If this is an SD card and we're writing, we can first
  	 * mark the known good sectors as ok.
@@ -1569,17 +2347,32 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *req)
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
  cmd_abort:
-	spin_lock_irq(&md->lock);
-	if (mmc_card_removed(card))
-		req->cmd_flags |= REQ_QUIET;
-	while (ret)
-		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
-	spin_unlock_irq(&md->lock);
+	if (mmc_packed_cmd(mq_rq->cmd_type)) {
+		mmc_blk_abort_packed_req(md, mq_rq);
+	} else {
+		spin_lock_irq(&md->lock);
+		if (mmc_card_removed(card))
+			req->cmd_flags |= REQ_QUIET;
+		while (ret)
+			ret = __blk_end_request(req, -EIO,
+						blk_rq_cur_bytes(req));
+		spin_unlock_irq(&md->lock);
+	}
+
+ start_new_req:
+	if (rqc) {
+		/* Send it on its own after an error */
+		if (mmc_packed_cmd(mq->mqrq_cur->cmd_type))
+			mmc_blk_revert_packed_req(mq, mq->mqrq_cur);
+
+		mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+	}
 
 	return 0;
 }
@@ -1728,9 +2521,13 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			if (mmc_card_sd(card))
 				remove_card(card->host);
 #endif
-			spin_lock_irq(&md->lock);
-			__blk_end_request_all(req, -EIO);
-			spin_unlock_irq(&md->lock);
+			/* req is NULL when called to drain the queue */
+			if (req) {
+				spin_lock_irq(&md->lock);
+				__blk_end_request_all(req, -EIO);
+				spin_unlock_irq(&md->lock);
+			}
+			mq->mqrq_cur->req = NULL;
 			mmc_release_host(card->host);
 			return 0;
 		}
@@ -1779,34 +2576,56 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 
 	if (mmc_bus_fails_resume(card->host) || card_no_ready ||
 		!retries) {
-		spin_lock_irq(&md->lock);
-		__blk_end_request_all(req, -EIO);
-		spin_unlock_irq(&md->lock);
+		if (req) {
+			spin_lock_irq(&md->lock);
+			__blk_end_request_all(req, -EIO);
+			spin_unlock_irq(&md->lock);
+		}
+		mq->mqrq_cur->req = NULL;
 		mmc_release_host(card->host);
 		return 0;
 	} else
 		mmc_release_host(card->host);
 #endif
 
-	mmc_claim_host(card->host);
-	ret = mmc_blk_part_switch(card, md);
-	if (ret) {
-		ret = 0;
-		goto out;
+	/*
+	 * The host stays claimed from the first request of a batch until
+	 * nothing is left in flight: the queue has run dry, or an error or
+	 * an urgent request sent back what was pending.
+	 */
+	if (req && !mq->host_claimed) {
+		mmc_claim_host(card->host);
+		mq->host_claimed = true;
+		ret = mmc_blk_part_switch(card, md);
+		if (ret) {
+			spin_lock_irq(&md->lock);
+			__blk_end_request_all(req, -EIO);
+			spin_unlock_irq(&md->lock);
+			mq->mqrq_cur->req = NULL;
+			mq->host_claimed = false;
+			mmc_release_host(card->host);
+			return 0;
+		}
 	}
 
-	if (req->cmd_flags & REQ_DISCARD) {
-		if (req->cmd_flags & REQ_SECURE)
+	if (req && (req->cmd_flags & (REQ_DISCARD | REQ_FLUSH))) {
+		/* complete ongoing async transfer before issuing discard */
+		if (card->host->areq)
+			mmc_blk_issue_rw_rq(mq, NULL);
+		if (!(req->cmd_flags & REQ_DISCARD))
+			ret = mmc_blk_issue_flush(mq, req);
+		else if (req->cmd_flags & REQ_SECURE)
 			ret = mmc_blk_issue_secdiscard_rq(mq, req);
 		else
 			ret = mmc_blk_issue_discard_rq(mq, req);
-	} else if (req->cmd_flags & REQ_FLUSH)
-		ret = mmc_blk_issue_flush(mq, req);
-	else
+	} else
 		ret = mmc_blk_issue_rw_rq(mq, req);
 
-out:
-	mmc_release_host(card->host);
+	if (mq->host_claimed && !card->host->areq) {
+		/* release host only when no request is left in flight */
+		mq->host_claimed = false;
+		mmc_release_host(card->host);
+	}
 	return ret;
 }
 
@@ -1918,6 +2737,15 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 		blk_queue_flush(md->queue.queue, REQ_FLUSH | REQ_FUA);
 	}
 
+	if (mmc_card_mmc(card) && !subname &&
+	    (md->flags & MMC_BLK_CMD23) &&
+	    card->ext_csd.packed_event_en) {
+		if (!mmc_packed_init(&md->queue, card)) {
+			md->flags |= MMC_BLK_PACKED_CMD;
+			md->packed_en = 1;
+		}
+	}
+
 	return md;
 
  err_putdisk:
@@ -2028,6 +2856,12 @@ static void mmc_blk_remove_req(struct mmc_blk_data *md)
 			 */
 			mmc_queue_resume(&md->queue);
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+			if (md->flags & MMC_BLK_PACKED_CMD) {
+				device_remove_file(disk_to_dev(md->disk),
+						   &md->packed_en_attr);
+				device_remove_file(disk_to_dev(md->disk),
+						   &md->packed_stats_attr);
+			}
 
 			/* Stop new requests from getting into the queue */
 			del_gendisk_async(md->disk);
@@ -2065,7 +2899,38 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
 	if (ret)
-		del_gendisk(md->disk);
+		goto force_ro_fail;
+
+	if (md->flags & MMC_BLK_PACKED_CMD) {
+		md->packed_en_attr.show = packed_en_show;
+		md->packed_en_attr.store = packed_en_store;
+		sysfs_attr_init(&md->packed_en_attr.attr);
+		md->packed_en_attr.attr.name = "packed";
+		md->packed_en_attr.attr.mode = S_IRUGO | S_IWUSR;
+		ret = device_create_file(disk_to_dev(md->disk),
+					 &md->packed_en_attr);
+		if (ret)
+			goto packed_en_fail;
+
+		md->packed_stats_attr.show = packed_stats_show;
+		md->packed_stats_attr.store = packed_stats_store;
+		sysfs_attr_init(&md->packed_stats_attr.attr);
+		md->packed_stats_attr.attr.name = "packed_stats";
+		md->packed_stats_attr.attr.mode = S_IRUGO | S_IWUSR;
+		ret = device_create_file(disk_to_dev(md->disk),
+					 &md->packed_stats_attr);
+		if (ret)
+			goto packed_stats_fail;
+	}
+
+	return 0;
+
+packed_stats_fail:
+	device_remove_file(disk_to_dev(md->disk), &md->packed_en_attr);
+packed_en_fail:
+	device_remove_file(disk_to_dev(md->disk), &md->force_ro);
+force_ro_fail:
+	del_gendisk(md->disk);
 
 	return ret;
 }
@@ -1,22 +1,78 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/mmc/core.h>
+#include <linux/mmc/host.h>
+
 struct request;
 struct task_struct;
 
+struct mmc_blk_request {
+	struct mmc_request	mrq;
+	struct mmc_command	sbc;
+	struct mmc_command	cmd;
+	struct mmc_command	stop;
+	struct mmc_data		data;
+};
+
+enum mmc_packed_type {
+	MMC_PACKED_NONE = 0,
+	MMC_PACKED_WRITE,
+};
+
+#define mmc_packed_cmd(type)	((type) != MMC_PACKED_NONE)
+#define mmc_packed_wr(type)	((type) == MMC_PACKED_WRITE)
+
+#define MMC_PACKED_NR_IDX	-1
+#define MMC_PACKED_NR_ZERO	0
+#define MMC_PACKED_NR_SINGLE	1
+
+/*
+ * The packed command header takes up the first block of the transfer:
+ * one word of version, type and count, one reserved word, then a
+ * CMD23/CMD25 argument pair per packed request.
+ */
+#define MMC_PACKED_HDR_WORDS	(512 / sizeof(u32))
+#define MMC_PACKED_MAX_ENTRIES	((MMC_PACKED_HDR_WORDS - 2) / 2)
+
+struct mmc_packed {
+	struct list_head	list;		/* requests in the group */
+	u32			cmd_hdr[MMC_PACKED_HDR_WORDS];
+	unsigned int		blocks;		/* data blocks, w/o header */
+	u8			nr_entries;
+	u8			retries;
+	s16			idx_failure;	/* first failed entry */
+};
+
+/*
+ * A block request on its way to the host. The queue has two of them so
+ * that the next request can be prepared, and its sg list mapped, while
+ * the previous one is still being transferred.
+ */
+struct mmc_queue_req {
+	struct request		*req;
+	struct mmc_blk_request	brq;
+	struct scatterlist	*sg;
+	char			*bounce_buf;
+	struct scatterlist	*bounce_sg;
+	unsigned int		bounce_sg_len;
+	struct mmc_async_req	mmc_active;
+	enum mmc_packed_type	cmd_type;
+	struct mmc_packed	*packed;
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
 	struct semaphore	thread_sem;
 	unsigned int		flags;
-	struct request		*req;
 	int			(*issue_fn)(struct mmc_queue *, struct request *);
 	void			*data;
 	struct request_queue	*queue;
-	struct scatterlist	*sg;
-	char			*bounce_buf;
-	struct scatterlist	*bounce_sg;
-	unsigned int		bounce_sg_len;
+	struct mmc_queue_req	mqrq[2];
+	struct mmc_queue_req	*mqrq_cur;
+	struct mmc_queue_req	*mqrq_prev;
+	bool			host_claimed;	/* by mmc_blk_issue_rq() */
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
@@ -25,9 +81,12 @@ extern void mmc_cleanup_queue(struct mmc_queue *);
 extern void mmc_queue_suspend(struct mmc_queue *);
 extern void mmc_queue_resume(struct mmc_queue *);
 
-extern unsigned int mmc_queue_map_sg(struct mmc_queue *);
-extern void mmc_queue_bounce_pre(struct mmc_queue *);
-extern void mmc_queue_bounce_post(struct mmc_queue *);
+extern int mmc_packed_init(struct mmc_queue *, struct mmc_card *);
+
+extern unsigned int mmc_queue_map_sg(struct mmc_queue *,
+				     struct mmc_queue_req *);
+extern void mmc_queue_bounce_pre(struct mmc_queue_req *);
+extern void mmc_queue_bounce_post(struct mmc_queue_req *);
 extern int mmc_reinit_card(struct mmc_host *host);
 extern int mmc_schedule_card_removal_work(struct delayed_work *work,
 				     unsigned long delay);
@@ -234,6 +234,192 @@ static void mmc_wait_done(struct mmc_request *mrq)
 	complete(mrq->done_data);
 }
 
+static void mmc_wait_data_done(struct mmc_request *mrq)
+{
+	struct mmc_host *host = mrq->host;
+	unsigned long flags;
+
+	/*
+	 * Nothing left to stop. Under host->lock, so that an urgent
+	 * notice either comes before and is dropped here, or sees the
+	 * request completed. mrq may be gone once completed.
+	 */
+	spin_lock_irqsave(&host->lock, flags);
+	if (host->urgent_mrq == mrq)
+		host->urgent_mrq = NULL;
+	complete(&mrq->completion);
+	spin_unlock_irqrestore(&host->lock, flags);
+	wake_up(&host->areq_wq);
+}
+
+static void __mmc_start_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	init_completion(&mrq->completion);
+	mrq->done_data = &mrq->completion;
+	mrq->done = mmc_wait_data_done;
+	mrq->host = host;
+	if (mmc_card_removed(host->card)) {
+		mrq->cmd->error = -ENOMEDIUM;
+		mmc_wait_data_done(mrq);
+		return;
+	}
+
+	mmc_start_request(host, mrq);
+}
+
+/*
+ * Wait for the async request in flight. If an urgent request comes in
+ * meanwhile and the request in flight is a write, ask the host to stop
+ * it: it then completes with -EINTR as data error, for the caller to
+ * send it again after the urgent one.
+ */
+static void mmc_wait_for_req_done(struct mmc_host *host,
+				  struct mmc_request *mrq)
+{
+	DEFINE_WAIT(wait);
+
+	for (;;) {
+		prepare_to_wait(&host->areq_wq, &wait, TASK_UNINTERRUPTIBLE);
+		if (completion_done(&mrq->completion) ||
+		    ACCESS_ONCE(host->urgent_mrq) == mrq)
+			break;
+		io_schedule();
+	}
+	finish_wait(&host->areq_wq, &wait);
+
+	/* A notice for mrq is only dropped when mrq completes */
+	if (ACCESS_ONCE(host->urgent_mrq) == mrq && host->ops->stop_request)
+		host->ops->stop_request(host);
+
+	wait_for_completion_io(&mrq->completion);
+}
+
+/**
+ *	mmc_notify_urgent - an urgent request is waiting
+ *	@host: MMC host
+ *
+ *	Tell the host an urgent request is waiting behind the async
+ *	write in flight, if any. mmc_start_req() stops that write when
+ *	the host knows how to. Nothing is recorded when no write is in
+ *	flight, and the notice is dropped when the write completes, so
+ *	it never stops a later one. May be called from atomic context.
+ */
+void mmc_notify_urgent(struct mmc_host *host)
+{
+	struct mmc_async_req *areq;
+	struct mmc_request *mrq;
+	unsigned long flags;
+	bool notified = false;
+
+	/*
+	 * host->areq may already be done with, or be set up again: the
+	 * notice is recorded for the request itself, and only if it is
+	 * a write still in flight.
+	 */
+	spin_lock_irqsave(&host->lock, flags);
+	areq = host->areq;
+	if (areq) {
+		mrq = areq->mrq;
+		if (mrq->data && (mrq->data->flags & MMC_DATA_WRITE) &&
+		    !completion_done(&mrq->completion)) {
+			host->urgent_mrq = mrq;
+			notified = true;
+		}
+	}
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (notified)
+		wake_up(&host->areq_wq);
+}
+EXPORT_SYMBOL(mmc_notify_urgent);
+
+/**
+ *	mmc_pre_req - Prepare for a new request
+ *	@host: MMC host to prepare command
+ *	@mrq: MMC request to prepare for
+ *	@is_first_req: true if there is no previous started request
+ *		       that may run in parallel to this call, otherwise false
+ *
+ *	mmc_pre_req() is called in prior to mmc_start_req() to let
+ *	host prepare for the new request. Preparation of a request may be
+ *	performed while another request is running on the host.
+ */
+static void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq, is_first_req);
+}
+
+/**
+ *	mmc_post_req - Post process a completed request
+ *	@host: MMC host to post process command
+ *	@mrq: MMC request to post process for
+ *	@err: Error, if non zero, clean up any resources made in pre_req
+ *
+ *	Let the host post process a completed request. Post processing of
+ *	a request may be performed while another request is running.
+ */
+static void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq,
+			 int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+
+/**
+ *	mmc_start_req - start a non-blocking request
+ *	@host: MMC host to start command
+ *	@areq: async request to start
+ *	@error: out parameter returns 0 for success, otherwise non zero
+ *
+ *	Start a new MMC custom command request for a host.
+ *	If there is an ongoing async request wait for completion
+ *	of that request and start the new one and return.
+ *	Does not wait for the new request to complete.
+ *
+ *	Returns the completed request, NULL in case of none completed.
+ *	Wait for an ongoing request (previously started) to complete and
+ *	return the completed request. If there is no ongoing request, NULL
+ *	is returned without waiting. NULL is not an error condition.
+ */
+struct mmc_async_req *mmc_start_req(struct mmc_host *host,
+				    struct mmc_async_req *areq, int *error)
+{
+	int err = 0;
+	struct mmc_async_req *data = host->areq;
+
+	/* Prepare a new request */
+	if (areq)
+		mmc_pre_req(host, areq->mrq, !host->areq);
+
+	if (host->areq) {
+		mmc_wait_for_req_done(host, host->areq->mrq);
+		err = host->areq->err_check(host->card, host->areq);
+		if (err) {
+			mmc_post_req(host, host->areq->mrq, 0);
+			if (areq)
+				mmc_post_req(host, areq->mrq, -EINVAL);
+
+			host->areq = NULL;
+			goto out;
+		}
+	}
+
+	if (areq)
+		__mmc_start_req(host, areq->mrq);
+
+	if (host->areq)
+		mmc_post_req(host, host->areq->mrq, 0);
+
+	host->areq = areq;
+ out:
+	if (error)
+		*error = err;
+	return data;
+}
+EXPORT_SYMBOL(mmc_start_req);
+
 /**
  *	mmc_wait_for_req - start a request and wait for completion
  *	@host: MMC host to start command
@@ -254,6 +440,10 @@ void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 		return;
 	}
 
+	/* Not prepared through pre_req(), whatever the caller left here */
+	if (mrq->data)
+		mrq->data->host_cookie = 0;
+
 	mmc_start_request(host, mrq);
 
 	wait_for_completion_io(&complete);
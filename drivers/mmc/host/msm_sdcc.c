@@ -713,6 +713,9 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 	if (host->dma.result & DMOV_RSLT_DONE) {
 		host->curr.data_xfered = host->curr.xfer_size;
 		host->curr.xfer_remain -= host->curr.xfer_size;
+	} else if (mrq->data->error == -EINTR) {
+		/* Flushed by msmsdcc_stop_request() */
+		msmsdcc_reset_and_restore(host);
 	} else {
 		/* Error or flush  */
 		if (host->dma.result & DMOV_RSLT_ERROR)
@@ -730,8 +733,9 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 		if (!mrq->data->error)
 			mrq->data->error = -EIO;
 	}
-	dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg, host->dma.num_ents,
-		     host->dma.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
+			     host->dma.num_ents, host->dma.dir);
 
 	if (host->curr.user_pages) {
 		struct scatterlist *sg = host->dma.sg;
@@ -897,8 +901,9 @@ static void msmsdcc_sps_complete_tlet(unsigned long data)
 	}
 
 	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -968,8 +973,9 @@ static void msmsdcc_sps_exit_curr_xfer(struct msmsdcc_host *host)
 		mrq->data->error = -EIO;
 
 	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -1045,8 +1051,12 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	else
 		host->dma.dir = DMA_TO_DEVICE;
 
-	n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
-			host->dma.num_ents, host->dma.dir);
+	/* Already mapped by msmsdcc_pre_req() */
+	if (data->host_cookie)
+		n = host->dma.num_ents;
+	else
+		n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
+				host->dma.num_ents, host->dma.dir);
 
 	if (n != host->dma.num_ents) {
 		pr_err("[SD] %s: Unable to map in all sg elements\n",
@@ -1122,8 +1132,9 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 
 unmap:
 	if (err) {
-		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
-				host->dma.num_ents, host->dma.dir);
+		if (!data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
+					host->dma.num_ents, host->dma.dir);
 		pr_err("[SD] %s: cannot do DMA, fall back to PIO mode err=%d\n",
 				mmc_hostname(host->mmc), err);
 	}
@@ -1168,9 +1179,12 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 		sps_pipe_handle = host->sps.cons.pipe_handle;
 	}
 
-	/* Make sg buffers DMA ready */
-	rc = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-			host->sps.dir);
+	/* Make sg buffers DMA ready, unless msmsdcc_pre_req() did */
+	if (data->host_cookie)
+		rc = data->sg_len;
+	else
+		rc = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+				host->sps.dir);
 
 	if (rc != data->sg_len) {
 		pr_err("[SD] %s: Unable to map in all sg elements, rc=%d\n",
@@ -1222,8 +1236,9 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 
 dma_map_err:
 	/* unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			host->sps.dir);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 out:
 	return rc;
 }
@@ -1354,6 +1369,15 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 	if (!(datactrl & MCI_DPSM_DMAENABLE)) {
 		host->use_pio = 1;
 
+		/* The CPU is going to touch the buffers after all */
+		if (data->host_cookie) {
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				     data->sg_len,
+				     (data->flags & MMC_DATA_READ) ?
+				     DMA_FROM_DEVICE : DMA_TO_DEVICE);
+			data->host_cookie = 0;
+		}
+
 		if (data->flags & MMC_DATA_READ) {
 			pio_irqmask = MCI_RXFIFOHALFFULLMASK;
 			if (host->curr.xfer_remain < MCI_FIFOSIZE)
@@ -2114,6 +2138,88 @@ msmsdcc_request_start(struct msmsdcc_host *host, struct mmc_request *mrq)
 	}
 }
 
+/*
+ * DMA is used for transfers that are a multiple of the FIFO size, when
+ * a DMA engine is set up; see msmsdcc_start_data().
+ */
+static bool msmsdcc_is_dma_possible(struct msmsdcc_host *host,
+				    struct mmc_data *data)
+{
+	if (msmsdcc_check_dma_op_req(data))
+		return false;
+
+	if (host->is_dma_mode)
+		return host->dma.channel != -1 && host->dma.crci != -1;
+
+	return host->is_sps_mode;
+}
+
+/*
+ * Map the next request for DMA, which also does the cache maintenance,
+ * while the previous one is still on the bus. msmsdcc_config_dma() and
+ * msmsdcc_sps_start_xfer() skip the mapping when host_cookie is set.
+ */
+static void
+msmsdcc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+		bool is_first_request)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	enum dma_data_direction dir;
+	int n;
+
+	if (unlikely(!data)) {
+		pr_err("[SD] %s: %s cannot prepare null data\n",
+		       mmc_hostname(mmc), __func__);
+		return;
+	}
+
+	if (unlikely(data->host_cookie)) {
+		/* Very wrong */
+		data->host_cookie = 0;
+		pr_err("[SD] %s: %s Request reposted for prepare\n",
+		       mmc_hostname(mmc), __func__);
+		return;
+	}
+
+	if (!msmsdcc_is_dma_possible(host, data))
+		return;
+
+	if (data->sg_len > msmsdcc_get_nr_sg(host))
+		return;
+
+	dir = (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	n = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len, dir);
+	if (n != data->sg_len) {
+		if (n)
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				     data->sg_len, dir);
+		return;
+	}
+
+	data->host_cookie = 1;
+}
+
+static void
+msmsdcc_post_req(struct mmc_host *mmc, struct mmc_request *mrq, int err)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (unlikely(!data)) {
+		pr_err("[SD] %s: %s cannot post process null data\n",
+		       mmc_hostname(mmc), __func__);
+		return;
+	}
+
+	if (data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     (data->flags & MMC_DATA_READ) ?
+			     DMA_FROM_DEVICE : DMA_TO_DEVICE);
+
+	data->host_cookie = 0;
+}
+
 static void
 msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
@@ -3556,10 +3662,15 @@ exit:
 	return rc;
 }
 
+static int msmsdcc_stop_request(struct mmc_host *mmc);
+
 static const struct mmc_host_ops msmsdcc_ops = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
+	.pre_req	= msmsdcc_pre_req,
+	.post_req	= msmsdcc_post_req,
 	.request	= msmsdcc_request,
+	.stop_request	= msmsdcc_stop_request,
 	.set_ios	= msmsdcc_set_ios,
 	.get_ro		= msmsdcc_get_ro,
 #ifdef CONFIG_MMC_MSM_SDIO_SUPPORT
@@ -3578,7 +3689,10 @@ static int msmsdcc_sdc_get_status(struct mmc_host *mmc)
 static const struct mmc_host_ops msmsdcc_ops_sd = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
+	.pre_req	= msmsdcc_pre_req,
+	.post_req	= msmsdcc_post_req,
 	.request	= msmsdcc_request,
+	.stop_request	= msmsdcc_stop_request,
 	.set_ios	= msmsdcc_set_ios,
 	.get_ro		= msmsdcc_get_ro,
 #ifdef CONFIG_MMC_MSM_SDIO_SUPPORT
@@ -4259,6 +4373,57 @@ static void msmsdcc_dump_sdcc_state(struct msmsdcc_host *host)
 	}
 
 }
+
+/*
+ * Stop the data transfer of mrq, which then ends with the error set in
+ * its data, once the stop command has been sent. Called with the host
+ * lock held.
+ */
+static void msmsdcc_abort_data(struct msmsdcc_host *host,
+			       struct mmc_request *mrq)
+{
+	host->curr.data_xfered = 0;
+	if (host->dma.sg && host->is_dma_mode) {
+		msm_dmov_stop_cmd(host->dma.channel, &host->dma.hdr, 0);
+	} else if (host->sps.sg && host->is_sps_mode) {
+		/* Stop current SPS transfer */
+		msmsdcc_sps_exit_curr_xfer(host);
+	} else {
+		msmsdcc_reset_and_restore(host);
+		msmsdcc_stop_data(host);
+		if (mrq->data && mrq->data->stop)
+			msmsdcc_start_command(host, mrq->data->stop, 0);
+		else
+			msmsdcc_request_end(host, mrq);
+	}
+}
+
+/*
+ * Stop a write while its data is being transferred, so that an urgent
+ * request can go first. Once the write command has been answered, and
+ * until DATAEND, the card takes CMD12 and programs what it got so far.
+ */
+static int msmsdcc_stop_request(struct mmc_host *mmc)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_request *mrq;
+	unsigned long flags;
+	int ret = -EBUSY;
+
+	spin_lock_irqsave(&host->lock, flags);
+	mrq = host->curr.mrq;
+	if (mrq && mrq->data && (mrq->data->flags & MMC_DATA_WRITE) &&
+	    host->curr.data && !host->curr.cmd && !host->curr.got_dataend &&
+	    !mrq->data->error) {
+		mrq->data->error = -EINTR;
+		msmsdcc_abort_data(host, mrq);
+		ret = 0;
+	}
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	return ret;
+}
+
 static void msmsdcc_req_tout_timer_hdlr(unsigned long data)
 {
 	struct msmsdcc_host *host = (struct msmsdcc_host *)data;
@@ -4291,22 +4456,7 @@ static void msmsdcc_req_tout_timer_hdlr(unsigned long data)
 		if (host->curr.data) {
 			if (mrq->data && !mrq->data->error)
 				mrq->data->error = -ETIMEDOUT;
-			host->curr.data_xfered = 0;
-			if (host->dma.sg && host->is_dma_mode) {
-				msm_dmov_stop_cmd(host->dma.channel,
-						&host->dma.hdr, 0);
-			} else if (host->sps.sg && host->is_sps_mode) {
-				/* Stop current SPS transfer */
-				msmsdcc_sps_exit_curr_xfer(host);
-			} else {
-				msmsdcc_reset_and_restore(host);
-				msmsdcc_stop_data(host);
-				if (mrq->data && mrq->data->stop)
-					msmsdcc_start_command(host,
-							mrq->data->stop, 0);
-				else
-					msmsdcc_request_end(host, mrq);
-			}
+			msmsdcc_abort_data(host, mrq);
 		} else {
 			host->prog_enable = 0;
 			host->curr.wait_for_auto_prog_done = 0;
@@ -4596,6 +4746,10 @@ msmsdcc_probe(struct platform_device *pdev)
 	if (!plat->disable_cmd23 && host->plat->sdcc_v4_sup)
 		mmc->caps |= MMC_CAP_CMD23;
 
+	/* Packed writes go out as CMD23 bounded transfers to the eMMC */
+	if ((mmc->caps & MMC_CAP_CMD23) && plat->nonremovable)
+		mmc->caps2 |= MMC_CAP2_PACKED_WR;
+
 	mmc->caps |= plat->uhs_caps;
 	/*
 	 * XPC controls the maximum current in the default speed mode of SDXC
@@ -20,6 +20,7 @@
 #include <linux/file.h>
 #include <linux/fs.h>
 #include <linux/list.h>
+#include <linux/math64.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -37,8 +38,23 @@
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * binder_main_lock protects the object graph: procs, threads, nodes,
+ * refs and transaction stacks. The buffer space of each proc has a lock
+ * of its own (alloc_lock), so that mapping pages for a transaction and
+ * copying its payload in from the sender are done without
+ * binder_main_lock held.
+ *
+ * The work lists of a proc (its todo list, the todo lists of its threads,
+ * the async_todo lists of its nodes and delivered_death) are protected by
+ * its inner_lock, a spinlock taken inside binder_main_lock and never
+ * nested with another proc's. Work is queued and dequeued with both held,
+ * so either is enough to look at a list: threads waiting for work check
+ * their lists with only inner_lock held.
+ */
+static DEFINE_MUTEX(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DECLARE_WAIT_QUEUE_HEAD(binder_tmp_ref_wait);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
@@ -155,6 +171,34 @@ struct binder_stats {
 
 static struct binder_stats binder_stats;
 
+/*
+ * Transaction latencies, in log2 buckets of microseconds: bucket 0
+ * counts latencies below 1us, bucket i those in [2^(i-1), 2^i) us and
+ * the last one everything longer. Queue time runs from a transaction
+ * or reply being queued until a thread of the receiving proc picks it
+ * up; handle time from a thread picking up a transaction until it
+ * sends the reply. Both are charged to the receiving proc.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+enum binder_latency_type {
+	BINDER_LATENCY_QUEUE,
+	BINDER_LATENCY_HANDLE,
+	BINDER_LATENCY_COUNT
+};
+
+static const char * const binder_latency_strings[] = {
+	"queue",
+	"handle",
+};
+
+struct binder_latency_hist {
+	u32 count[BINDER_LATENCY_BUCKETS];
+	u64 max; /* ns */
+};
+
+static struct binder_latency_hist binder_latency[BINDER_LATENCY_COUNT];
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
 	binder_stats.obj_deleted[type]++;
@@ -165,6 +209,42 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+enum binder_lock_site {
+	BINDER_LOCK_IOCTL,
+	BINDER_LOCK_TRANSACTION,
+	BINDER_LOCK_READ,
+	BINDER_LOCK_POLL,
+	BINDER_LOCK_OPEN,
+	BINDER_LOCK_DEFERRED,
+	BINDER_LOCK_RELEASE,
+	BINDER_LOCK_DEBUGFS,
+	BINDER_LOCK_SITE_COUNT
+};
+
+static const char * const binder_lock_site_strings[] = {
+	"ioctl",
+	"transaction",
+	"read",
+	"poll",
+	"open",
+	"deferred",
+	"release",
+	"debugfs",
+};
+
+/* Times are in ns; a hold is charged to the site that took the lock */
+struct binder_lock_stats {
+	u64 count;
+	u64 contended;
+	u64 wait_time;
+	u64 hold_time;
+	u64 max_hold_time;
+};
+
+static struct binder_lock_stats binder_main_lock_stats[BINDER_LOCK_SITE_COUNT];
+static enum binder_lock_site binder_main_lock_site;
+static u64 binder_main_lock_acquired;
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -299,13 +379,20 @@ struct binder_proc {
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct mutex alloc_lock; /* buffers, free/allocated_buffers, pages */
+	struct binder_lock_stats alloc_lock_stats;
+	u64 alloc_lock_acquired;
 
 	struct page **pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	int tmp_ref; /* senders copying into our buffers */
+	int is_dead; /* release in progress, refuse new transactions */
+	spinlock_t inner_lock; /* work lists, see binder_main_lock */
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency_hist latency[BINDER_LATENCY_COUNT];
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
@@ -356,11 +443,140 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	u64	queued;		/* local_clock() when put on a todo list */
+	u64	received;	/* and when a thread picked it up */
 };
 
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
+
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static u64 binder_lock_acquire(struct mutex *lock,
+			       struct binder_lock_stats *stats)
+{
+	u64 start = local_clock();
+	u64 now;
+
+	if (!mutex_trylock(lock)) {
+		mutex_lock(lock);
+		stats->contended++;
+	}
+	now = local_clock();
+	stats->count++;
+	if (now > start)
+		stats->wait_time += now - start;
+	return now;
+}
+
+static void binder_lock_release(struct mutex *lock,
+				struct binder_lock_stats *stats, u64 acquired)
+{
+	u64 now = local_clock();
+	u64 held = now > acquired ? now - acquired : 0;
+
+	stats->hold_time += held;
+	if (held > stats->max_hold_time)
+		stats->max_hold_time = held;
+	mutex_unlock(lock);
+}
+
+static void binder_lock(enum binder_lock_site site)
+{
+	trace_binder_lock(binder_lock_site_strings[site]);
+	binder_main_lock_acquired = binder_lock_acquire(&binder_main_lock,
+					&binder_main_lock_stats[site]);
+	binder_main_lock_site = site;
+	trace_binder_locked(binder_lock_site_strings[site]);
+}
+
+static void binder_unlock(void)
+{
+	trace_binder_unlock(binder_lock_site_strings[binder_main_lock_site]);
+	binder_lock_release(&binder_main_lock,
+			    &binder_main_lock_stats[binder_main_lock_site],
+			    binder_main_lock_acquired);
+}
+
+static void binder_alloc_lock(struct binder_proc *proc)
+{
+	proc->alloc_lock_acquired = binder_lock_acquire(&proc->alloc_lock,
+						&proc->alloc_lock_stats);
+}
+
+static void binder_alloc_unlock(struct binder_proc *proc)
+{
+	binder_lock_release(&proc->alloc_lock, &proc->alloc_lock_stats,
+			    proc->alloc_lock_acquired);
+}
+
+/* Queue work on list, a work list of proc */
+static void binder_enqueue_work(struct binder_proc *proc,
+				struct binder_work *work,
+				struct list_head *list)
+{
+	spin_lock(&proc->inner_lock);
+	list_add_tail(&work->entry, list);
+	spin_unlock(&proc->inner_lock);
+}
+
+/* Take work off whichever work list of proc it is on, if any */
+static void binder_dequeue_work(struct binder_proc *proc,
+				struct binder_work *work)
+{
+	spin_lock(&proc->inner_lock);
+	list_del_init(&work->entry);
+	spin_unlock(&proc->inner_lock);
+}
+
+/* Take the first work off list, a work list of proc; NULL if empty */
+static struct binder_work *binder_dequeue_work_head(struct binder_proc *proc,
+						    struct list_head *list)
+{
+	struct binder_work *w = NULL;
+
+	spin_lock(&proc->inner_lock);
+	if (!list_empty(list)) {
+		w = list_first_entry(list, struct binder_work, entry);
+		list_del_init(&w->entry);
+	}
+	spin_unlock(&proc->inner_lock);
+	return w;
+}
+
+static bool binder_worklist_empty(struct binder_proc *proc,
+				  struct list_head *list)
+{
+	bool empty;
+
+	spin_lock(&proc->inner_lock);
+	empty = list_empty(list);
+	spin_unlock(&proc->inner_lock);
+	return empty;
+}
+
+/* Account the time since start to proc; returns it in ns */
+static u64 binder_latency_add(struct binder_proc *proc,
+			      enum binder_latency_type type, u64 start)
+{
+	u64 now = local_clock();
+	u64 delta = now > start ? now - start : 0;
+	int bucket;
+
+	bucket = min_t(int, fls_long(div_u64(delta, NSEC_PER_USEC)),
+		       BINDER_LATENCY_BUCKETS - 1);
+
+	proc->latency[type].count[bucket]++;
+	if (delta > proc->latency[type].max)
+		proc->latency[type].max = delta;
+	binder_latency[type].count[bucket]++;
+	if (delta > binder_latency[type].max)
+		binder_latency[type].max = delta;
+
+	return delta;
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -587,13 +803,15 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
-	struct binder_buffer *buffer;
+	struct rb_node *n;
+	struct binder_buffer *buffer, *found = NULL;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	binder_alloc_lock(proc);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -602,10 +820,13 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 			n = n->rb_left;
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
-		else
-			return buffer;
+		else {
+			found = buffer;
+			break;
+		}
 	}
-	return NULL;
+	binder_alloc_unlock(proc);
+	return found;
 }
 
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
@@ -706,9 +927,10 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -788,6 +1010,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
+	buffer->allow_user_free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
 		struct binder_buffer *new_buffer = (void *)buffer->data + size;
@@ -812,6 +1035,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	binder_alloc_lock(proc);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 is_async);
+	binder_alloc_unlock(proc);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -869,8 +1105,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -924,6 +1160,14 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	binder_alloc_lock(proc);
+	binder_free_buf_locked(proc, buffer);
+	binder_alloc_unlock(proc);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1000,8 +1244,9 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 		} else
 			node->local_strong_refs++;
 		if (!node->has_strong_ref && target_list) {
-			list_del_init(&node->work.entry);
-			list_add_tail(&node->work.entry, target_list);
+			binder_dequeue_work(node->proc, &node->work);
+			binder_enqueue_work(node->proc, &node->work,
+					    target_list);
 		}
 	} else {
 		if (!internal)
@@ -1012,7 +1257,8 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 					"for %d\n", node->debug_id);
 				return -EINVAL;
 			}
-			list_add_tail(&node->work.entry, target_list);
+			binder_enqueue_work(node->proc, &node->work,
+					    target_list);
 		}
 	}
 	return 0;
@@ -1035,14 +1281,16 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 	}
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
-			list_add_tail(&node->work.entry, &node->proc->todo);
+			binder_enqueue_work(node->proc, &node->work,
+					    &node->proc->todo);
 			wake_up_interruptible(&node->proc->wait);
 		}
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
+			/* A dead node was taken off its lists on release */
 			if (node->proc) {
+				binder_dequeue_work(node->proc, &node->work);
 				rb_erase(&node->rb_node, &node->proc->nodes);
 				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 					     "binder: refless node %d deleted\n",
@@ -1166,7 +1414,7 @@ static void binder_delete_ref(struct binder_ref *ref)
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
-		list_del(&ref->death->work.entry);
+		binder_dequeue_work(ref->proc, &ref->death->work);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1382,8 +1630,10 @@ static void binder_transaction(struct binder_proc *proc,
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
-	size_t *offp, *off_end;
+	struct binder_buffer *buffer;
+	size_t *offp = NULL, *off_end;
 	size_t off_min;
+	int bad_copy = 0;
 	struct binder_proc *target_proc;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
@@ -1487,20 +1737,11 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_binder;
 	}
 	e->to_proc = target_proc->pid;
 
@@ -1545,37 +1786,102 @@ static void binder_transaction(struct binder_proc *proc,
 		t->from = NULL;
 	t->sender_euid = proc->tsk->cred->euid;
 	t->to_proc = target_proc;
-	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
-		return_error = BR_FAILED_REPLY;
-		goto err_binder_alloc_buf_failed;
-	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
 	if (target_node)
 		binder_inc_node(target_node, 1, 0, NULL);
 
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
+	/*
+	 * Mapping pages into the target and copying the payload can
+	 * sleep for a long time, so binder_main_lock is dropped around
+	 * them. Nobody else can get to the buffer until it is queued, and
+	 * the tmp_ref keeps target_proc from being released meanwhile;
+	 * threads may go away though, so they are looked up again below.
+	 */
+	target_proc->tmp_ref++;
+	binder_unlock();
+
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (buffer) {
+		buffer->debug_id = t->debug_id;
+		buffer->transaction = t;
+		buffer->target_node = target_node;
+		trace_binder_transaction_alloc_buf(buffer);
+
+		offp = (size_t *)(buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+
+		if (copy_from_user(buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			bad_copy = 1;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid,
+				thread->pid);
+			bad_copy = 1;
+		}
+	}
+
+	binder_lock(BINDER_LOCK_TRANSACTION);
+	if (!--target_proc->tmp_ref && target_proc->is_dead)
+		wake_up(&binder_tmp_ref_wait);
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+	t->buffer = buffer;
+	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+		goto err_binder_alloc_buf_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
+	if (bad_copy) {
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
+	if (target_proc->is_dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target;
+	}
+	if (reply) {
+		if (in_reply_to->from != target_thread) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_target;
+		}
+	} else if (!(t->flags & TF_ONE_WAY)) {
+		struct binder_transaction *tmp;
+
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+		}
+	}
+	if (target_thread) {
+		if (e->debug_id == t->debug_id)
+			e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+	t->to_thread = target_thread;
+	trace_binder_transaction(reply, t, target_node);
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1741,6 +2047,9 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		trace_binder_transaction_reply(t, in_reply_to,
+			binder_latency_add(proc, BINDER_LATENCY_HANDLE,
+					   in_reply_to->received));
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1757,9 +2066,10 @@ static void binder_transaction(struct binder_proc *proc,
 			target_node->has_async_transaction = 1;
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	t->queued = local_clock();
+	binder_enqueue_work(target_proc, &t->work, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
+	binder_enqueue_work(proc, tcomplete, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
 	return;
@@ -1772,11 +2082,16 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_target:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	goto err_free_tcomplete;
 err_binder_alloc_buf_failed:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+err_free_tcomplete:
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1788,6 +2103,7 @@ err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
 err_no_context_mgr_node:
+	trace_binder_transaction_failed(e->debug_id, return_error);
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1981,11 +2297,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
+				struct binder_work *w;
+
 				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
+				w = binder_dequeue_work_head(proc,
+					&buffer->target_node->async_todo);
+				if (w)
+					binder_enqueue_work(proc, w, &thread->todo);
 				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+					buffer->target_node->has_async_transaction = 0;
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -2104,9 +2424,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-						list_add_tail(&ref->death->work.entry, &thread->todo);
+						binder_enqueue_work(proc, &ref->death->work, &thread->todo);
 					} else {
-						list_add_tail(&ref->death->work.entry, &proc->todo);
+						binder_enqueue_work(proc, &ref->death->work, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
 				}
@@ -2134,9 +2454,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-						list_add_tail(&death->work.entry, &thread->todo);
+						binder_enqueue_work(proc, &death->work, &thread->todo);
 					} else {
-						list_add_tail(&death->work.entry, &proc->todo);
+						binder_enqueue_work(proc, &death->work, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
 				} else {
@@ -2170,13 +2490,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				break;
 			}
 
-			list_del_init(&death->work.entry);
+			binder_dequeue_work(proc, &death->work);
 			if (death->work.type == BINDER_WORK_DEAD_BINDER_AND_CLEAR) {
 				death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 				if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
-					list_add_tail(&death->work.entry, &thread->todo);
+					binder_enqueue_work(proc, &death->work, &thread->todo);
 				} else {
-					list_add_tail(&death->work.entry, &proc->todo);
+					binder_enqueue_work(proc, &death->work, &proc->todo);
 					wake_up_interruptible(&proc->wait);
 				}
 			}
@@ -2202,16 +2522,19 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 	}
 }
 
+/* Called without binder_main_lock held */
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
-	return !list_empty(&proc->todo) ||
+	return !binder_worklist_empty(proc, &proc->todo) ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
+/* Called without binder_main_lock held */
 static int binder_has_thread_work(struct binder_thread *thread)
 {
-	return !list_empty(&thread->todo) || thread->return_error != BR_OK ||
+	return !binder_worklist_empty(thread->proc, &thread->todo) ||
+		thread->return_error != BR_OK ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
@@ -2256,7 +2579,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2280,7 +2603,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock(BINDER_LOCK_READ);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2322,7 +2645,7 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
-			list_del(&w->entry);
+			binder_dequeue_work(proc, w);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2369,7 +2692,7 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
-				list_del_init(&w->entry);
+				binder_dequeue_work(proc, w);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
@@ -2411,12 +2734,12 @@ retry:
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
 				      death->cookie);
 
+			binder_dequeue_work(proc, w);
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
 			} else
-				list_move(&w->entry, &proc->delivered_death);
+				binder_enqueue_work(proc, w, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2482,9 +2805,14 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
-		list_del(&t->work.entry);
+		trace_binder_transaction_received(t,
+			binder_latency_add(proc, BINDER_LATENCY_QUEUE,
+					   t->queued));
+
+		binder_dequeue_work(proc, &t->work);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
+			t->received = local_clock();
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
 			thread->transaction_stack = t;
@@ -2514,12 +2842,12 @@ done:
 	return 0;
 }
 
-static void binder_release_work(struct list_head *list)
+static void binder_release_work(struct binder_proc *proc,
+				struct list_head *list)
 {
 	struct binder_work *w;
-	while (!list_empty(list)) {
-		w = list_first_entry(list, struct binder_work, entry);
-		list_del_init(&w->entry);
+
+	while ((w = binder_dequeue_work_head(proc, list))) {
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			struct binder_transaction *t;
@@ -2609,7 +2937,7 @@ static int binder_free_thread(struct binder_proc *proc,
 	}
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
-	binder_release_work(&thread->todo);
+	binder_release_work(proc, &thread->todo);
 	kfree(thread);
 	binder_stats_deleted(BINDER_STAT_THREAD);
 	return active_transactions;
@@ -2622,12 +2950,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock(BINDER_LOCK_POLL);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2655,11 +2983,13 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
+	trace_binder_ioctl(cmd, arg);
+
 	ret = wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock(BINDER_LOCK_IOCTL);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2771,7 +3101,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2909,16 +3239,18 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	spin_lock_init(&proc->inner_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_lock(BINDER_LOCK_OPEN);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2977,6 +3309,18 @@ static void binder_deferred_release(struct binder_proc *proc)
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	/*
+	 * Senders that dropped binder_main_lock to copy into our buffers
+	 * must be done with them before anything is torn down. New ones
+	 * see is_dead and fail the transaction.
+	 */
+	proc->is_dead = 1;
+	while (proc->tmp_ref) {
+		binder_unlock();
+		wait_event(binder_tmp_ref_wait, !ACCESS_ONCE(proc->tmp_ref));
+		binder_lock(BINDER_LOCK_RELEASE);
+	}
+
 	hlist_del(&proc->proc_node);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -2999,7 +3343,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
-		list_del_init(&node->work.entry);
+		binder_dequeue_work(proc, &node->work);
 		if (hlist_empty(&node->refs)) {
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
@@ -3018,7 +3362,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 					death++;
 					if (list_empty(&ref->death->work.entry)) {
 						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
-						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
+						binder_enqueue_work(ref->proc, &ref->death->work, &ref->proc->todo);
 						wake_up_interruptible(&ref->proc->wait);
 					} else
 						BUG();
@@ -3037,7 +3381,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		outgoing_refs++;
 		binder_delete_ref(ref);
 	}
-	binder_release_work(&proc->todo);
+	binder_release_work(proc, &proc->todo);
 	buffers = 0;
 
 	while ((n = rb_first(&proc->allocated_buffers))) {
@@ -3098,7 +3442,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock(BINDER_LOCK_DEFERRED);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3125,7 +3469,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3306,9 +3650,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	binder_alloc_lock(proc);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	binder_alloc_unlock(proc);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3438,8 +3784,10 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	binder_alloc_lock(proc);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	binder_alloc_unlock(proc);
 	seq_printf(m, "  buffers: %d\n", count);
 
 	count = 0;
@@ -3466,7 +3814,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(BINDER_LOCK_DEBUGFS);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3478,7 +3826,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3489,7 +3837,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(BINDER_LOCK_DEBUGFS);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3498,7 +3846,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3509,13 +3857,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(BINDER_LOCK_DEBUGFS);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3525,11 +3873,101 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(BINDER_LOCK_DEBUGFS);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
+	return 0;
+}
+
+static void print_binder_lock_stats(struct seq_file *m, const char *name,
+				    struct binder_lock_stats *stats)
+{
+	if (!stats->count)
+		return;
+	seq_printf(m, "%-12s %10llu %10llu %12llu %12llu %10llu %10llu\n",
+		   name, stats->count, stats->contended,
+		   div_u64(stats->wait_time, NSEC_PER_USEC),
+		   div_u64(stats->hold_time, NSEC_PER_USEC),
+		   div64_u64(stats->hold_time, stats->count),
+		   div_u64(stats->max_hold_time, NSEC_PER_USEC));
+}
+
+static int binder_lock_stats_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct binder_lock_stats stats;
+	char name[16];
+	int i;
+
+	binder_lock(BINDER_LOCK_DEBUGFS);
+
+	seq_printf(m, "%-12s %10s %10s %12s %12s %10s %10s\n", "lock",
+		   "count", "contended", "wait_us", "hold_us", "avg_ns",
+		   "max_us");
+
+	seq_puts(m, "main:\n");
+	for (i = 0; i < BINDER_LOCK_SITE_COUNT; i++)
+		print_binder_lock_stats(m, binder_lock_site_strings[i],
+					&binder_main_lock_stats[i]);
+
+	seq_puts(m, "alloc:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		mutex_lock(&proc->alloc_lock);
+		stats = proc->alloc_lock_stats;
+		mutex_unlock(&proc->alloc_lock);
+		snprintf(name, sizeof(name), "%d", proc->pid);
+		print_binder_lock_stats(m, name, &stats);
+	}
+
+	binder_unlock();
+	return 0;
+}
+
+static void print_binder_latency(struct seq_file *m, const char *name,
+				 struct binder_latency_hist *latency)
+{
+	int type, i;
+
+	for (type = 0; type < BINDER_LATENCY_COUNT; type++) {
+		struct binder_latency_hist *hist = &latency[type];
+		u32 total = 0;
+
+		for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+			total += hist->count[i];
+		if (!total)
+			continue;
+
+		seq_printf(m, "%-8s %-6s", name, binder_latency_strings[type]);
+		for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+			seq_printf(m, " %u", hist->count[i]);
+		seq_printf(m, " max %llu\n",
+			   div_u64(hist->max, NSEC_PER_USEC));
+	}
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	char name[16];
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		binder_lock(BINDER_LOCK_DEBUGFS);
+
+	seq_printf(m, "binder latency: buckets of [2^(i-1), 2^i) us, "
+		   "last open, max in us\n");
+	print_binder_latency(m, "all", binder_latency);
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		snprintf(name, sizeof(name), "%d", proc->pid);
+		print_binder_latency(m, name, proc->latency);
+	}
+
+	if (do_lock)
+		binder_unlock();
 	return 0;
 }
 
@@ -3578,6 +4016,8 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(lock_stats);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3618,6 +4058,16 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("lock_stats",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_lock_stats_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
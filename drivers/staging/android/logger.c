@@ -24,7 +24,9 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/log2.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,17 +35,30 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * Offsets into the log are free-running byte counts, reduced modulo the log
+ * size with logger_offset() only when the buffer is accessed; comparing two
+ * of them tells which one is older even after the buffer wrapped.
+ *
+ * Writers never exclude each other while copying their entry in. Space is
+ * reserved under 'lock', which only covers dropping the oldest entries and
+ * moving 'reserve' forward, then each writer copies its entry and commits
+ * it. 'w_off' follows the committed entries: whichever writer finds the
+ * entry at 'w_off' committed moves it forward, so entries become visible in
+ * order even when writers finish out of order.
+ *
+ * Readers do not take any log-wide lock either; see logger_peek().
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
-	size_t			head;	/* new readers start here */
+	wait_queue_head_t	commit_wq; /* writers waiting for a commit */
+	spinlock_t		lock;	/* protects head and reserve updates */
+	unsigned long		head;	/* oldest entry, new readers start here */
+	unsigned long		reserve; /* end of space handed to writers */
+	unsigned long		w_off;	/* end of committed entries */
 	size_t			size;	/* size of the log */
 };
 
@@ -51,12 +66,13 @@ struct logger_log {
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes users of this file */
+	struct logger_entry	*entry;	/* copy of the entry at r_off */
+	unsigned long		r_off;	/* current read head offset */
 	bool			r_all;	/* reader can read all entries */
 	int			r_ver;	/* reader ABI version */
 };
@@ -64,6 +80,38 @@ struct logger_reader {
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/* Largest entry a reader may have to hold */
+#define LOGGER_ENTRY_MAX_LEN \
+	(sizeof(struct logger_entry) + LOGGER_ENTRY_MAX_PAYLOAD)
+
+/*
+ * In the buffer, each entry is preceded by a commit word and padded to a
+ * multiple of 4 bytes, so that the commit word is never split by the end
+ * of the buffer and can be read and written atomically. The commit word
+ * is cleared when the space is reserved and set once the entry is
+ * complete.
+ */
+#define LOGGER_ENTRY_ALIGN	4
+#define LOGGER_COMMITTED	1
+
+static inline size_t logger_entry_size(size_t len)
+{
+	return ALIGN(sizeof(u32) + sizeof(struct logger_entry) + len,
+		     LOGGER_ENTRY_ALIGN);
+}
+
+static inline u32 *logger_commit_word(struct logger_log *log,
+				      unsigned long off)
+{
+	return (u32 *) (log->buffer + logger_offset(off));
+}
+
+/* is the entry at 'off' older than the oldest entry still in the log? */
+static inline bool logger_lapped(struct logger_log *log, unsigned long off)
+{
+	return (long) (ACCESS_ONCE(log->head) - off) > 0;
+}
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -88,39 +136,40 @@ static inline struct logger_log *file_get_log(struct file *file)
 }
 
 /*
- * get_entry_header - returns a pointer to the logger_entry header within
- * 'log' starting at offset 'off'. A temporary logger_entry 'scratch' must
- * be provided. Typically the return value will be a pointer within
- * 'logger->buf'.  However, a pointer to 'scratch' may be returned if
- * the log entry spans the end and beginning of the circular buffer.
+ * do_read_log - copies 'count' bytes at offset 'off' of 'log' into 'buf',
+ * handling the wrap around the end of the buffer.
  */
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static void do_read_log(struct logger_log *log, unsigned long off,
+			void *buf, size_t count)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
+	size_t len;
+
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
 
-	return (struct logger_entry *) (log->buffer + off);
+	if (count != len)
+		memcpy(buf + len, log->buffer, count - len);
 }
 
 /*
- * get_entry_msg_len - Grabs the length of the message of the entry
- * starting from from 'off'.
- *
- * Caller needs to hold log->mutex.
+ * get_entry_header - returns a pointer to the logger_entry header of the
+ * entry starting at offset 'off' in 'log'. A temporary logger_entry
+ * 'scratch' must be provided. Typically the return value will be a pointer
+ * within 'logger->buf'.  However, a pointer to 'scratch' may be returned if
+ * the header spans the end and beginning of the circular buffer.
  */
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
+static struct logger_entry *get_entry_header(struct logger_log *log,
+		unsigned long off, struct logger_entry *scratch)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	size_t hdr = logger_offset(off + sizeof(u32));
 
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	if (log->size - hdr < sizeof(struct logger_entry)) {
+		do_read_log(log, hdr, scratch, sizeof(struct logger_entry));
+		return scratch;
+	}
+
+	return (struct logger_entry *) (log->buffer + hdr);
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -156,78 +205,69 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * logger_peek - finds the next entry readable by 'reader' and copies it to
+ * reader->entry, leaving reader->r_off pointing at it. Returns true if an
+ * entry was found.
  *
- * Caller must hold log->mutex.
+ * Writers never wait for readers, so the entry may be overwritten while we
+ * copy it. Writers move log->head past an entry before reusing its space,
+ * so a copy is known to be intact if the head still has not passed it
+ * afterwards; otherwise we were lapped and restart from the new head.
+ *
+ * Caller must hold reader->mutex.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static bool logger_peek(struct logger_log *log, struct logger_reader *reader)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
+	struct logger_entry *entry = reader->entry;
+	unsigned long off, w_off;
 	size_t len;
-	size_t msg_start;
 
-	/*
-	 * First, copy the header to userspace, using the version of
-	 * the header requested
-	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
-
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(reader->r_off + sizeof(struct logger_entry));
-
-	/*
-	 * We read from the msg in two disjoint operations. First, we read from
-	 * the current msg head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
-	 */
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
-
-	/*
-	 * Second, we read any remaining bytes, starting back at the head of
-	 * the log.
-	 */
-	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
-
-	reader->r_off = logger_offset(reader->r_off +
-		sizeof(struct logger_entry) + count);
-
-	return count + get_user_hdr_len(reader->r_ver);
-}
-
-/*
- * get_next_entry_by_uid - Starting at 'off', returns an offset into
- * 'log->buffer' which contains the first entry readable by 'euid'
- */
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
-{
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
+retry:
+	w_off = ACCESS_ONCE(log->w_off);
+	/* entries below w_off are complete: read them after w_off */
+	smp_rmb();
+
+	off = reader->r_off;
+	if (logger_lapped(log, off))
+		off = ACCESS_ONCE(log->head);
+
+	while ((long) (w_off - off) > 0) {
+		bool match;
+
+		do_read_log(log, off + sizeof(u32), entry,
+			    sizeof(struct logger_entry));
+		len = entry->len;
+
+		match = len <= LOGGER_ENTRY_MAX_PAYLOAD &&
+			(reader->r_all || entry->euid == current_euid());
+		if (match)
+			do_read_log(log, off + sizeof(u32) +
+				    sizeof(struct logger_entry),
+				    entry->msg, len);
+
+		/* check for overwrites only after copying */
+		smp_rmb();
+		if (logger_lapped(log, off)) {
+			reader->r_off = ACCESS_ONCE(log->head);
+			goto retry;
+		}
 
-		entry = get_entry_header(log, off, &scratch);
+		/* an intact entry is never that long */
+		if (WARN_ON_ONCE(len > LOGGER_ENTRY_MAX_PAYLOAD)) {
+			off = w_off;
+			break;
+		}
 
-		if (entry->euid == euid)
-			return off;
+		if (match) {
+			reader->r_off = off;
+			return true;
+		}
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(off + next_len);
+		off += logger_entry_size(len);
 	}
 
-	return off;
+	reader->r_off = off;
+	return false;
 }
 
 /*
@@ -247,18 +287,20 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry *entry = reader->entry;
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
-start:
+	mutex_lock(&reader->mutex);
+
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
-		if (!ret)
+		if (logger_peek(log, reader)) {
+			ret = 0;
 			break;
+		}
 
 		if (file->f_flags & O_NONBLOCK) {
 			ret = -EAGAIN;
@@ -270,143 +312,182 @@ start:
 			break;
 		}
 
+		mutex_unlock(&reader->mutex);
 		schedule();
+		mutex_lock(&reader->mutex);
 	}
 
 	finish_wait(&log->wq, &wait);
 	if (ret)
-		return ret;
-
-	mutex_lock(&log->mutex);
-
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
-		goto start;
-	}
+		goto out;
 
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = hdr_len + entry->len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* get exactly one entry, from our private copy */
+	if (copy_header_to_user(reader->r_ver, entry, buf) ||
+	    copy_to_user(buf + hdr_len, entry->msg, entry->len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	reader->r_off += logger_entry_size(entry->len);
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_reserve - reserves 'size' bytes at the write head for a new entry
+ * and returns their offset, dropping the oldest entries to make room.
  *
- * Caller must hold log->mutex.
+ * Only entries that are already committed can be dropped. If the whole log
+ * is taken by entries still being written, which needs a small log and
+ * many concurrent writers, sleep until logger_commit() moves w_off.
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static unsigned long logger_reserve(struct logger_log *log, size_t size)
 {
-	size_t count = 0;
+	struct logger_entry scratch;
+	struct logger_entry *entry;
+	unsigned long off;
+
+	spin_lock(&log->lock);
+
+	while (log->reserve + size - log->head > log->size) {
+		if (log->head == ACCESS_ONCE(log->w_off)) {
+			spin_unlock(&log->lock);
+			wait_event(log->commit_wq,
+				   ACCESS_ONCE(log->head) !=
+				   ACCESS_ONCE(log->w_off));
+			spin_lock(&log->lock);
+			continue;
+		}
+
+		entry = get_entry_header(log, log->head, &scratch);
+		log->head += logger_entry_size(entry->len);
+	}
+
+	off = log->reserve;
+	*logger_commit_word(log, off) = 0;
+
+	/*
+	 * Readers must see the new head before any of the space behind it
+	 * is overwritten, and committers the cleared commit word before
+	 * the new reserve.
+	 */
+	smp_wmb();
+	log->reserve = off + size;
 
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	spin_unlock(&log->lock);
 
 	return off;
 }
 
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_commit - marks the entry at 'off' complete, then moves w_off past
+ * every complete entry it finds at w_off, including ours if all older
+ * entries are complete. A writer that finishes before an older one leaves
+ * moving w_off past its entry to the older writer.
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static void logger_commit(struct logger_log *log, unsigned long off)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	struct logger_entry scratch;
+	struct logger_entry *entry;
+	unsigned long w_off;
+	bool moved = false;
+
+	/* the entry must be complete before it is marked so */
+	smp_wmb();
+	ACCESS_ONCE(*logger_commit_word(log, off)) = LOGGER_COMMITTED;
+
+	/*
+	 * Pairs with the barrier in other committers: of two writers
+	 * committing adjacent entries at the same time, at least one sees
+	 * the other's commit word.
+	 */
+	smp_mb();
+
+	while (1) {
+		w_off = ACCESS_ONCE(log->w_off);
+		if (w_off == ACCESS_ONCE(log->reserve))
+			break;
+
+		smp_rmb();
+		if (ACCESS_ONCE(*logger_commit_word(log, w_off)) !=
+		    LOGGER_COMMITTED)
+			break;
+
+		/* if w_off moved meanwhile, this may be junk: cmpxchg fails */
+		entry = get_entry_header(log, w_off, &scratch);
+		if (cmpxchg(&log->w_off, w_off,
+			    w_off + logger_entry_size(entry->len)) == w_off)
+			moved = true;
 	}
 
-	return 0;
+	/* the successful cmpxchg orders the new w_off before this check */
+	if (moved && waitqueue_active(&log->commit_wq))
+		wake_up(&log->commit_wq);
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at offset 'off'
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void do_write_log(struct logger_log *log, unsigned long off,
+			 const void *buf, size_t count)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t len;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_clear_log - zeroes 'count' bytes of 'log' at offset 'off'
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void do_clear_log(struct logger_log *log, unsigned long off,
+			 size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
 
 	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
+		memset(log->buffer, 0, count - len);
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * do_write_log_user - writes 'count' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off'
  *
  * Returns 'count' on success, negative error code on failure.
  */
 static ssize_t do_write_log_from_user(struct logger_log *log,
+				      unsigned long off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
 	return count;
 }
 
@@ -419,9 +500,9 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	unsigned long off, msg;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -438,19 +519,13 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	off = logger_reserve(log, logger_entry_size(header.len));
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	msg = off + sizeof(u32);
+	do_write_log(log, msg, &header, sizeof(struct logger_entry));
+	msg += sizeof(struct logger_entry);
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
 		ssize_t nr;
 
@@ -458,10 +533,14 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, msg + ret, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			/*
+			 * The space cannot be given back once later writers
+			 * may be behind it: commit the entry blanked out.
+			 */
+			do_clear_log(log, msg, header.len);
+			logger_commit(log, off);
 			return nr;
 		}
 
@@ -469,10 +548,12 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
+	logger_commit(log, off);
 
 	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	smp_mb();
+	if (waitqueue_active(&log->wq))
+		wake_up_interruptible(&log->wq);
 
 	return ret;
 }
@@ -504,17 +585,18 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->entry = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->entry) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		reader->r_ver = 1;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
-
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -532,7 +614,7 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+		kfree(reader->entry);
 		kfree(reader);
 	}
 
@@ -562,18 +644,61 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (logger_peek(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_unread_len - returns how many bytes of entries, headers and
+ * messages as read() returns them, are left for 'reader' to read. The
+ * commit words and padding the buffer adds are not counted.
+ *
+ * Caller must hold reader->mutex.
+ */
+static size_t logger_unread_len(struct logger_log *log,
+				struct logger_reader *reader)
+{
+	size_t hdr_len = get_user_hdr_len(reader->r_ver);
+	struct logger_entry entry;
+	unsigned long off, w_off;
+	size_t len;
+
+retry:
+	w_off = ACCESS_ONCE(log->w_off);
+	/* entries below w_off are complete: read them after w_off */
+	smp_rmb();
+
+	off = reader->r_off;
+	if (logger_lapped(log, off))
+		off = ACCESS_ONCE(log->head);
+
+	len = 0;
+	while ((long) (w_off - off) > 0) {
+		do_read_log(log, off + sizeof(u32), &entry,
+			    sizeof(struct logger_entry));
+
+		/* check for overwrites only after copying */
+		smp_rmb();
+		if (logger_lapped(log, off)) {
+			reader->r_off = ACCESS_ONCE(log->head);
+			goto retry;
+		}
+
+		/* an intact entry is never that long */
+		if (WARN_ON_ONCE(entry.len > LOGGER_ENTRY_MAX_PAYLOAD))
+			break;
+
+		len += hdr_len + entry.len;
+		off += logger_entry_size(entry.len);
+	}
+
+	return len;
+}
+
 static long logger_set_version(struct logger_reader *reader, void __user *arg)
 {
 	int version;
@@ -590,11 +715,14 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -605,26 +733,17 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = logger_unread_len(log, reader);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
 
-		if (log->w_off != reader->r_off)
+		if (logger_peek(log, reader))
 			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+				reader->entry->len;
 		else
 			ret = 0;
 		break;
@@ -633,9 +752,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
+		/* readers notice they were lapped and catch up */
+		spin_lock(&log->lock);
 		log->head = log->w_off;
+		spin_unlock(&log->lock);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -656,7 +776,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader)
+		mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -678,7 +799,7 @@ static const struct file_operations logger_fops = {
  * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(LOGGER_ENTRY_ALIGN); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -688,17 +809,18 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.commit_wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .commit_wq), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.head = 0, \
+	.reserve = 0, \
+	.w_off = 0, \
 	.size = SIZE, \
 };
 
-DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 96*1024)
+DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 128*1024)
 DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 32*1024)
 DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 32*1024)
-DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 96*1024)
+DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 128*1024)
 
 static struct logger_log *get_log_from_minor(int minor)
 {
@@ -717,6 +839,9 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	if (WARN_ON(!is_power_of_2(log->size)))
+		return -EINVAL;
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -16,6 +16,18 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Besides being called as a shrinker, the driver subscribes to vmpressure
+ * events: a critical event runs the same check from process context, and
+ * all events are passed on to user-space through /dev/lowmemorykiller.
+ * A read returns the level and pressure of the latest event, as in
+ * "medium 72", and poll() reports when a new one has arrived. Writing
+ * "low", "medium" or "critical" sets the lowest level the file reports.
+ *
+ * A killed task only frees its memory once it gets to run exit_mm(),
+ * which can take a while when the system is thrashing. A reaper thread
+ * unmaps the private memory of each victim right after the kill; the
+ * reaper_* parameters count what it did and how long after the kill.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -31,12 +43,23 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/freezer.h>
+#include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/rbtree.h>
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
+#include <linux/slab.h>
 #include <linux/swap.h>
+#include <linux/uaccess.h>
+#include <linux/delay.h>
+#include <linux/vmpressure.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_HIGHMEM
 #define _ZONE ZONE_HIGHMEM
@@ -70,6 +93,324 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
+/*
+ * Thread group leaders ordered by oom_adj, so that victims are found
+ * by walking down from the highest adj instead of scanning every task.
+ * A task is keyed by the oom_adj it had when it was last (re)inserted,
+ * which /proc keeps in step with the signal_struct through
+ * lowmem_adj_index_update().
+ *
+ * The lock only guards the tree: the walk drops it around the work on
+ * each task, and the hooks are called with no task locks held.
+ */
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static struct rb_root lowmem_adj_tree = RB_ROOT;
+
+static void __lowmem_adj_index_add(struct task_struct *p)
+{
+	struct rb_node **link = &lowmem_adj_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct task_struct *entry;
+
+	p->lmk_adj = p->signal->oom_adj;
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct task_struct, lmk_node);
+		if (p->lmk_adj < entry->lmk_adj)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&p->lmk_node, parent, link);
+	rb_insert_color(&p->lmk_node, &lowmem_adj_tree);
+}
+
+static void __lowmem_adj_index_del(struct task_struct *p)
+{
+	rb_erase(&p->lmk_node, &lowmem_adj_tree);
+	RB_CLEAR_NODE(&p->lmk_node);
+}
+
+/*
+ * Called for every new task once it is on the task list; dup_task_struct()
+ * has already cleared the lmk_node copied from the parent.
+ */
+void lowmem_adj_index_fork(struct task_struct *p)
+{
+	if (thread_group_leader(p) && !(p->flags & PF_KTHREAD))
+		lowmem_adj_index_add(p);
+}
+
+/* Called when p becomes the leader of its thread group in exec */
+void lowmem_adj_index_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	if (RB_EMPTY_NODE(&p->lmk_node))
+		__lowmem_adj_index_add(p);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_adj_index_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	if (!RB_EMPTY_NODE(&p->lmk_node))
+		__lowmem_adj_index_del(p);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/*
+ * Where the walk goes on after p, which was at adj when the lock was
+ * dropped: the node before it, or, if p has since left the tree or moved,
+ * the last one at adj or below.
+ */
+static struct rb_node *lowmem_adj_index_prev(struct task_struct *p, int adj)
+{
+	struct rb_node *n = lowmem_adj_tree.rb_node;
+	struct rb_node *prev = NULL;
+
+	if (!RB_EMPTY_NODE(&p->lmk_node) && p->lmk_adj == adj)
+		return rb_prev(&p->lmk_node);
+
+	while (n) {
+		if (rb_entry(n, struct task_struct, lmk_node)->lmk_adj <= adj) {
+			prev = n;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+	return prev;
+}
+
+/* Called after the oom_adj of p's thread group has been written */
+void lowmem_adj_index_update(struct task_struct *p)
+{
+	struct task_struct *leader;
+
+	rcu_read_lock();
+	spin_lock(&lowmem_adj_lock);
+	leader = p->group_leader;
+	if (!RB_EMPTY_NODE(&leader->lmk_node) &&
+	    leader->lmk_adj != leader->signal->oom_adj) {
+		__lowmem_adj_index_del(leader);
+		__lowmem_adj_index_add(leader);
+	}
+	spin_unlock(&lowmem_adj_lock);
+	rcu_read_unlock();
+}
+
+/*
+ * Victims waiting for the reaper. The shrinker kills at most one task
+ * per lowmem_deathpending period, so a few slots are plenty; when they
+ * are full the victim is left to free its memory on its own.
+ */
+#define LOWMEM_REAP_QUEUE	8
+#define LOWMEM_REAP_RETRIES	10
+
+struct lowmem_victim {
+	struct task_struct *task;
+	ktime_t kill_time;
+};
+
+static int lowmem_reaper_enable = 1;
+static DEFINE_SPINLOCK(lowmem_reap_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_reap_wait);
+static struct lowmem_victim lowmem_reap_queue[LOWMEM_REAP_QUEUE];
+static unsigned int lowmem_reap_head, lowmem_reap_tail;
+static struct task_struct *lowmem_reaper_thread;
+
+static unsigned int lowmem_reaped;		/* victims reaped */
+static unsigned int lowmem_reap_skipped;	/* exited, shared or queue full */
+static unsigned int lowmem_reap_failed;		/* mmap_sem stayed busy */
+static unsigned long lowmem_reaped_pages;
+static unsigned int lowmem_reap_time_max;	/* kill to reaped, in us */
+static unsigned long lowmem_reap_time_total;
+
+/* Called with a reference on the victim */
+static void lowmem_reap_queue_task(struct task_struct *tsk)
+{
+	struct lowmem_victim *v;
+
+	if (!lowmem_reaper_enable || !lowmem_reaper_thread)
+		return;
+
+	spin_lock(&lowmem_reap_lock);
+	if (lowmem_reap_head - lowmem_reap_tail >= LOWMEM_REAP_QUEUE) {
+		lowmem_reap_skipped++;
+		spin_unlock(&lowmem_reap_lock);
+		return;
+	}
+	v = &lowmem_reap_queue[lowmem_reap_head % LOWMEM_REAP_QUEUE];
+	get_task_struct(tsk);
+	v->task = tsk;
+	v->kill_time = ktime_get();
+	lowmem_reap_head++;
+	spin_unlock(&lowmem_reap_lock);
+
+	wake_up(&lowmem_reap_wait);
+}
+
+static bool lowmem_reap_dequeue(struct lowmem_victim *v)
+{
+	bool ret = false;
+
+	spin_lock(&lowmem_reap_lock);
+	if (lowmem_reap_tail != lowmem_reap_head) {
+		*v = lowmem_reap_queue[lowmem_reap_tail % LOWMEM_REAP_QUEUE];
+		lowmem_reap_tail++;
+		ret = true;
+	}
+	spin_unlock(&lowmem_reap_lock);
+
+	return ret;
+}
+
+/*
+ * Whether a process outside the victim's thread group, and not itself
+ * killed, uses mm: a CLONE_VM child, a vfork parent or a kthread.
+ */
+static bool lowmem_mm_shared(struct task_struct *victim, struct mm_struct *mm)
+{
+	struct task_struct *p, *t;
+	bool shared = false;
+
+	rcu_read_lock();
+	for_each_process(p) {
+		if (same_thread_group(p, victim))
+			continue;
+		t = p;
+		do {
+			if (t->mm) {
+				if (t->mm == mm && !fatal_signal_pending(p))
+					shared = true;
+				break;
+			}
+		} while_each_thread(p, t);
+		if (shared)
+			break;
+	}
+	rcu_read_unlock();
+
+	return shared;
+}
+
+static int __lowmem_reap_task(struct task_struct *tsk, unsigned long *freed)
+{
+	struct task_struct *p;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned long rss;
+	int ret = 0;
+
+	/* The victim is exiting: its threads may go away under the walk */
+	rcu_read_lock();
+	p = find_lock_task_mm(tsk);
+	if (!p) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	mm = p->mm;
+	atomic_inc(&mm->mm_users);
+	task_unlock(p);
+	rcu_read_unlock();
+
+	/*
+	 * The victim may hold mmap_sem for writing while it waits for
+	 * memory itself, so don't block on it.
+	 */
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	if (lowmem_mm_shared(tsk, mm)) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	set_bit(MMF_LMK_REAPED, &mm->flags);
+
+	/*
+	 * Private mappings hold the anonymous pages, including COW copies
+	 * of file pages; shared pages would not be freed by unmapping them
+	 * here anyway. Locked and special mappings are left to exit_mmap().
+	 */
+	rss = get_mm_rss(mm);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_HUGETLB |
+				     VM_PFNMAP))
+			continue;
+		zap_page_range(vma, vma->vm_start, vma->vm_end - vma->vm_start,
+			       NULL);
+	}
+	*freed = rss - min(rss, get_mm_rss(mm));
+
+out_unlock:
+	up_read(&mm->mmap_sem);
+out:
+	/* Drops the last reference if the victim has already exited */
+	mmput(mm);
+	return ret;
+}
+
+static void lowmem_reap_task(struct lowmem_victim *v)
+{
+	struct task_struct *tsk = v->task;
+	unsigned long freed = 0;
+	unsigned int delta;
+	int attempts = 0;
+	int ret;
+
+	while ((ret = __lowmem_reap_task(tsk, &freed)) == -EAGAIN &&
+	       ++attempts < LOWMEM_REAP_RETRIES)
+		msleep(100);
+
+	switch (ret) {
+	case 0:
+		delta = ktime_us_delta(ktime_get(), v->kill_time);
+		lowmem_reaped++;
+		lowmem_reaped_pages += freed;
+		lowmem_reap_time_total += delta;
+		if (delta > lowmem_reap_time_max)
+			lowmem_reap_time_max = delta;
+		lowmem_print(2, "reaped %d (%s), %lu pages, %u us after kill\n",
+			     tsk->pid, tsk->comm, freed, delta);
+
+		/* What is left goes with exit_mmap(); don't wait for it */
+		if (lowmem_deathpending == tsk)
+			lowmem_deathpending = NULL;
+		break;
+	case -EAGAIN:
+		lowmem_reap_failed++;
+		lowmem_print(2, "failed to reap %d (%s)\n", tsk->pid, tsk->comm);
+		break;
+	default:
+		spin_lock(&lowmem_reap_lock);
+		lowmem_reap_skipped++;
+		spin_unlock(&lowmem_reap_lock);
+		break;
+	}
+
+	put_task_struct(tsk);
+}
+
+static int lowmem_reaper(void *unused)
+{
+	struct lowmem_victim v;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(lowmem_reap_wait,
+				     lowmem_reap_head != lowmem_reap_tail ||
+				     kthread_should_stop());
+
+		while (lowmem_reap_dequeue(&v))
+			lowmem_reap_task(&v);
+	}
+
+	return 0;
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -181,8 +522,54 @@ void tune_lmk_param(int *other_free, int *other_file, struct shrink_control *sc)
 	}
 }
 
+/*
+ * The thread of tsk's process that holds its memory, with a reference
+ * on it, if the process is worth killing at min_adj. Called under
+ * rcu_read_lock(): the reference on tsk does not keep its thread list
+ * from changing under the walks.
+ */
+static struct task_struct *lowmem_candidate(struct task_struct *tsk,
+					    int min_adj, int *oom_adj,
+					    int *tasksize)
+{
+	struct task_struct *p;
+
+	if (tsk->flags & PF_KTHREAD)
+		return NULL;
+
+	/* if task no longer has any memory ignore it */
+	if (test_task_flag(tsk, TIF_MM_RELEASED))
+		return NULL;
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return NULL;
+
+	/* Already killed and being freed by the reaper */
+	if (test_bit(MMF_LMK_REAPED, &p->mm->flags)) {
+		task_unlock(p);
+		return NULL;
+	}
+
+	*oom_adj = p->signal->oom_adj;
+	if (*oom_adj < min_adj) {
+		task_unlock(p);
+		return NULL;
+	}
+	*tasksize = get_mm_rss(p->mm);
+	if (*tasksize <= 0) {
+		task_unlock(p);
+		return NULL;
+	}
+	get_task_struct(p);
+	task_unlock(p);
+
+	return p;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
+	struct rb_node *n;
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
 	int rem = 0;
@@ -235,44 +622,53 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_adj = min_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
+	/*
+	 * Each process is looked at with a reference on it and the index
+	 * unlocked, so that forks and exits don't wait for the whole walk.
+	 */
+	spin_lock(&lowmem_adj_lock);
+	n = rb_last(&lowmem_adj_tree);
+	while (n) {
 		struct task_struct *p;
-		int oom_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+		int oom_adj, adj;
 
-		/* if task no longer has any memory ignore it */
-		if (test_task_flag(tsk, TIF_MM_RELEASED))
-			continue;
+		tsk = rb_entry(n, struct task_struct, lmk_node);
+		adj = tsk->lmk_adj;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
+		/* Everything further down has a lower adj */
+		if (adj < min_adj)
+			break;
+		if (selected && adj < selected_oom_adj)
+			break;
 
-		oom_adj = p->signal->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
+		get_task_struct(tsk);
+		spin_unlock(&lowmem_adj_lock);
+
+		rcu_read_lock();
+		p = lowmem_candidate(tsk, min_adj, &oom_adj, &tasksize);
+		rcu_read_unlock();
+		if (p && selected &&
+		    (oom_adj < selected_oom_adj ||
+		     (oom_adj == selected_oom_adj &&
+		      tasksize <= selected_tasksize))) {
+			put_task_struct(p);
+			p = NULL;
 		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
+		if (p) {
+			if (selected)
+				put_task_struct(selected);
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+
+		spin_lock(&lowmem_adj_lock);
+		n = lowmem_adj_index_prev(tsk, adj);
+		put_task_struct(tsk);
 	}
+	spin_unlock(&lowmem_adj_lock);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -280,11 +676,12 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		send_sig(SIGKILL, selected, 0);
+		lowmem_reap_queue_task(selected);
 		rem -= selected_tasksize;
+		put_task_struct(selected);
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
 	return rem;
 }
 
@@ -293,17 +690,234 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static const char * const lowmem_level_names[VMPRESSURE_NUM_LEVELS] = {
+	[VMPRESSURE_LOW]	= "low",
+	[VMPRESSURE_MEDIUM]	= "medium",
+	[VMPRESSURE_CRITICAL]	= "critical",
+};
+
+/*
+ * Latest vmpressure event, and per level the number of events seen so
+ * far: a reader has a new event to report when the count of any level
+ * it listens to has moved past its snapshot.
+ */
+static DEFINE_SPINLOCK(lowmem_event_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_event_wait);
+static struct vmpressure_event lowmem_last_event;
+static unsigned long lowmem_event_count[VMPRESSURE_NUM_LEVELS];
+
+struct lowmem_reader {
+	enum vmpressure_levels min_level;
+	unsigned long seen[VMPRESSURE_NUM_LEVELS];
+};
+
+static void lowmem_critical_fn(struct work_struct *work)
+{
+	struct shrink_control sc = {
+		.gfp_mask = GFP_HIGHUSER_MOVABLE,
+		.nr_to_scan = 1,
+	};
+
+	lowmem_shrink(&lowmem_shrinker, &sc);
+}
+
+static DECLARE_WORK(lowmem_critical_work, lowmem_critical_fn);
+
+static int lowmem_vmpressure_notify(struct notifier_block *self,
+				    unsigned long level, void *data)
+{
+	struct vmpressure_event *event = data;
+
+	spin_lock(&lowmem_event_lock);
+	lowmem_last_event = *event;
+	lowmem_event_count[level]++;
+	spin_unlock(&lowmem_event_lock);
+
+	wake_up_interruptible(&lowmem_event_wait);
+
+	/*
+	 * Reclaim is barely making progress: check the minfree levels
+	 * now instead of waiting for the next shrinker call.
+	 */
+	if (level == VMPRESSURE_CRITICAL)
+		schedule_work(&lowmem_critical_work);
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call	= lowmem_vmpressure_notify,
+};
+
+/* Called with lowmem_event_lock held */
+static bool lowmem_reader_pending(struct lowmem_reader *reader)
+{
+	int i;
+
+	for (i = reader->min_level; i < VMPRESSURE_NUM_LEVELS; i++)
+		if (lowmem_event_count[i] != reader->seen[i])
+			return true;
+	return false;
+}
+
+static bool lowmem_event_pending(struct lowmem_reader *reader)
+{
+	bool ret;
+
+	spin_lock(&lowmem_event_lock);
+	ret = lowmem_reader_pending(reader);
+	spin_unlock(&lowmem_event_lock);
+
+	return ret;
+}
+
+static int lowmem_event_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	/* Only report events that arrive after the open */
+	spin_lock(&lowmem_event_lock);
+	memcpy(reader->seen, lowmem_event_count, sizeof(reader->seen));
+	spin_unlock(&lowmem_event_lock);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_event_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t lowmem_event_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *pos)
+{
+	struct lowmem_reader *reader = file->private_data;
+	struct vmpressure_event event;
+	char tmp[32];
+	int len, ret;
+
+	for (;;) {
+		spin_lock(&lowmem_event_lock);
+		if (lowmem_reader_pending(reader)) {
+			event = lowmem_last_event;
+			memcpy(reader->seen, lowmem_event_count,
+			       sizeof(reader->seen));
+			spin_unlock(&lowmem_event_lock);
+			break;
+		}
+		spin_unlock(&lowmem_event_lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		ret = wait_event_interruptible(lowmem_event_wait,
+					       lowmem_event_pending(reader));
+		if (ret)
+			return ret;
+	}
+
+	len = snprintf(tmp, sizeof(tmp), "%s %lu\n",
+		       lowmem_level_names[event.level], event.pressure);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, tmp, len))
+		return -EFAULT;
+
+	return len;
+}
+
+static ssize_t lowmem_event_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *pos)
+{
+	struct lowmem_reader *reader = file->private_data;
+	char tmp[16];
+	int i;
+
+	if (count >= sizeof(tmp))
+		return -EINVAL;
+	if (copy_from_user(tmp, buf, count))
+		return -EFAULT;
+	tmp[count] = '\0';
+
+	for (i = 0; i < VMPRESSURE_NUM_LEVELS; i++) {
+		if (sysfs_streq(tmp, lowmem_level_names[i])) {
+			reader->min_level = i;
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static unsigned int lowmem_event_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_reader *reader = file->private_data;
+
+	poll_wait(file, &lowmem_event_wait, wait);
+	if (lowmem_event_pending(reader))
+		return POLLIN | POLLRDNORM | POLLPRI;
+
+	return 0;
+}
+
+static const struct file_operations lowmem_event_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_event_open,
+	.release = lowmem_event_release,
+	.read = lowmem_event_read,
+	.write = lowmem_event_write,
+	.poll = lowmem_event_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice lowmem_event_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmemorykiller",
+	.fops = &lowmem_event_fops,
+};
+
 static int __init lowmem_init(void)
 {
+	int ret;
+
+	ret = misc_register(&lowmem_event_dev);
+	if (ret) {
+		pr_err("lowmemorykiller: failed to register misc device\n");
+		return ret;
+	}
+
+	lowmem_reaper_thread = kthread_run(lowmem_reaper, NULL, "lmk_reaper");
+	if (IS_ERR(lowmem_reaper_thread)) {
+		pr_err("lowmemorykiller: failed to start reaper\n");
+		lowmem_reaper_thread = NULL;
+	}
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	vmpressure_notifier_register(&lowmem_vmpressure_nb);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_victim v;
+
+	vmpressure_notifier_unregister(&lowmem_vmpressure_nb);
+	cancel_work_sync(&lowmem_critical_work);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
+	misc_deregister(&lowmem_event_dev);
+
+	if (lowmem_reaper_thread)
+		kthread_stop(lowmem_reaper_thread);
+	while (lowmem_reap_dequeue(&v))
+		put_task_struct(v.task);
 }
 
 module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
@@ -313,6 +927,14 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(lmk_fast_run, lmk_fast_run, int, S_IRUGO | S_IWUSR);
+module_param_named(reaper, lowmem_reaper_enable, int, S_IRUGO | S_IWUSR);
+module_param_named(reaper_reaped, lowmem_reaped, uint, S_IRUGO);
+module_param_named(reaper_skipped, lowmem_reap_skipped, uint, S_IRUGO);
+module_param_named(reaper_failed, lowmem_reap_failed, uint, S_IRUGO);
+module_param_named(reaper_pages, lowmem_reaped_pages, ulong, S_IRUGO);
+module_param_named(reaper_time_max_us, lowmem_reap_time_max, uint, S_IRUGO);
+module_param_named(reaper_time_total_us, lowmem_reap_time_total, ulong,
+		   S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
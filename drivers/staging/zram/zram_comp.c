@@ -0,0 +1,254 @@
+/*
+ * Compressed RAM block device - compression streams
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/gfp.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_comp.h"
+
+/*
+ * Algorithms offered through the comp_algorithm sysfs node. Each one
+ * is only usable if the matching crypto module is built or loadable.
+ */
+static const char * const backends[] = {
+	"lzo",
+	"lz4",
+	"deflate",
+	NULL
+};
+
+int zram_comp_available(const char *name)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(backends[i], name))
+			return crypto_has_comp(name, 0, 0);
+	}
+
+	return 0;
+}
+
+/* List usable algorithms, with the current one in brackets */
+ssize_t zram_comp_available_show(const char *cur, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; backends[i]; i++) {
+		if (!crypto_has_comp(backends[i], 0, 0))
+			continue;
+
+		if (!strcmp(cur, backends[i]))
+			sz += sprintf(buf + sz, "[%s] ", backends[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", backends[i]);
+	}
+
+	if (sz)
+		buf[sz - 1] = '\n';
+
+	return sz;
+}
+
+static void zram_comp_strm_free(struct zram_comp_strm *strm)
+{
+	if (!IS_ERR_OR_NULL(strm->tfm))
+		crypto_free_comp(strm->tfm);
+	free_pages((unsigned long)strm->buffer, 1);
+	kfree(strm);
+}
+
+/*
+ * Streams are only allocated when the device is initialized or
+ * max_comp_streams is raised, never from the I/O path.
+ */
+static struct zram_comp_strm *zram_comp_strm_alloc(struct zram_comp *comp)
+{
+	struct zram_comp_strm *strm;
+
+	strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+	if (!strm)
+		return NULL;
+
+	strm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	/*
+	 * Allocate 2 pages: 1 for compressed data, plus 1 extra for
+	 * the case when compressed size is larger than the original one
+	 */
+	strm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(strm->tfm) || !strm->buffer) {
+		zram_comp_strm_free(strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+/*
+ * Get an idle stream, sleeping until another reader or writer
+ * releases its stream if all of them are busy.
+ */
+struct zram_comp_strm *zram_comp_strm_find(struct zram_comp *comp)
+{
+	struct zram_comp_strm *strm;
+
+	spin_lock(&comp->strm_lock);
+	while (list_empty(&comp->idle_strm)) {
+		comp->strm_waits++;
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+		spin_lock(&comp->strm_lock);
+	}
+
+	strm = list_entry(comp->idle_strm.next, struct zram_comp_strm, list);
+	list_del(&strm->list);
+	spin_unlock(&comp->strm_lock);
+
+	return strm;
+}
+
+void zram_comp_strm_release(struct zram_comp *comp,
+			struct zram_comp_strm *strm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&strm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* max_strm was lowered while this stream was in use */
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zram_comp_strm_free(strm);
+}
+
+/*
+ * Change the number of streams. Excess idle streams are freed
+ * immediately, busy ones as they are released.
+ */
+int zram_comp_set_max_streams(struct zram_comp *comp, int max_strm)
+{
+	struct zram_comp_strm *strm;
+
+	if (max_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = max_strm;
+	while (comp->avail_strm > max_strm &&
+			!list_empty(&comp->idle_strm)) {
+		strm = list_entry(comp->idle_strm.next,
+				struct zram_comp_strm, list);
+		list_del(&strm->list);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zram_comp_strm_free(strm);
+		spin_lock(&comp->strm_lock);
+	}
+
+	while (comp->avail_strm < comp->max_strm) {
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+
+		strm = zram_comp_strm_alloc(comp);
+
+		spin_lock(&comp->strm_lock);
+		if (!strm) {
+			comp->avail_strm--;
+			break;
+		}
+		list_add(&strm->list, &comp->idle_strm);
+		wake_up(&comp->strm_wait);
+	}
+	spin_unlock(&comp->strm_lock);
+
+	/* Keep whatever we managed to allocate, as long as there is one */
+	return comp->avail_strm ? 0 : -ENOMEM;
+}
+
+int zram_comp_compress(struct zram_comp *comp, struct zram_comp_strm *strm,
+			const unsigned char *src, size_t *dst_len)
+{
+	int ret;
+	unsigned int len = 2 * PAGE_SIZE;
+
+	ret = crypto_comp_compress(strm->tfm, src, PAGE_SIZE,
+				strm->buffer, &len);
+	*dst_len = len;
+
+	return ret;
+}
+
+int zram_comp_decompress(struct zram_comp *comp, struct zram_comp_strm *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst)
+{
+	int ret;
+	unsigned int len = PAGE_SIZE;
+
+	ret = crypto_comp_decompress(strm->tfm, src, src_len, dst, &len);
+	if (!ret && len != PAGE_SIZE)
+		ret = -EIO;
+
+	return ret;
+}
+
+void zram_comp_destroy(struct zram_comp *comp)
+{
+	struct zram_comp_strm *strm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		strm = list_entry(comp->idle_strm.next,
+				struct zram_comp_strm, list);
+		list_del(&strm->list);
+		zram_comp_strm_free(strm);
+	}
+	kfree(comp);
+}
+
+struct zram_comp *zram_comp_create(const char *name, int max_strm)
+{
+	struct zram_comp *comp;
+
+	if (!zram_comp_available(name))
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	strlcpy(comp->name, name, sizeof(comp->name));
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+
+	if (zram_comp_set_max_streams(comp, max(max_strm, 1))) {
+		kfree(comp);
+		return NULL;
+	}
+
+	return comp;
+}
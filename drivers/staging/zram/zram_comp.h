@@ -0,0 +1,64 @@
+/*
+ * Compressed RAM block device - compression streams
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/* Compression algorithm used when none is selected through sysfs */
+#define ZRAM_DEFAULT_COMPRESSOR	"lzo"
+
+/*
+ * A compression stream: a crypto compression transform and the
+ * output buffer needed by one compressor invocation. Transforms keep
+ * per-call state (e.g. deflate), so a stream is used by at most one
+ * reader or writer at a time.
+ */
+struct zram_comp_strm {
+	struct crypto_comp *tfm;
+	void *buffer;	/* compressed output, 2 pages */
+	struct list_head list;
+};
+
+/* Pool of compression streams shared by all I/O to a device */
+struct zram_comp {
+	char name[CRYPTO_MAX_ALG_NAME];
+	spinlock_t strm_lock;	/* protects idle_strm and avail_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated (idle + busy) */
+	int max_strm;		/* upper bound on avail_strm */
+	u64 strm_waits;		/* no. of times I/O had to sleep */
+};
+
+int zram_comp_available(const char *name);
+ssize_t zram_comp_available_show(const char *cur, char *buf);
+
+struct zram_comp *zram_comp_create(const char *name, int max_strm);
+void zram_comp_destroy(struct zram_comp *comp);
+int zram_comp_set_max_streams(struct zram_comp *comp, int max_strm);
+
+struct zram_comp_strm *zram_comp_strm_find(struct zram_comp *comp);
+void zram_comp_strm_release(struct zram_comp *comp,
+			struct zram_comp_strm *strm);
+
+int zram_comp_compress(struct zram_comp *comp, struct zram_comp_strm *strm,
+			const unsigned char *src, size_t *dst_len);
+int zram_comp_decompress(struct zram_comp *comp, struct zram_comp_strm *strm,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Compressed RAM block device - same page deduplication
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/*
+ * Identical pages compress to identical data, so duplicates are found
+ * by hashing the compressor output: it is shorter than the page and,
+ * on a match, no decompression is needed to confirm it. One hash
+ * bucket is allocated for every 16 disk pages.
+ */
+#define ZRAM_DEDUP_PAGES_PER_BUCKET_SHIFT	4
+
+static struct kmem_cache *zram_entry_cache;
+
+static unsigned int zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return checksum & ((1U << zram->dedup.hash_bits) - 1);
+}
+
+static spinlock_t *zram_dedup_lock(struct zram *zram, unsigned int bucket)
+{
+	return &zram->dedup.lock[bucket & (ZRAM_DEDUP_LOCKS - 1)];
+}
+
+u32 zram_dedup_checksum(const void *mem, size_t len)
+{
+	return jhash(mem, len, 0);
+}
+
+/*
+ * Look for a stored object with the given contents. On success a
+ * reference is taken on the returned entry on behalf of the caller.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, const void *mem,
+				size_t len, u32 checksum)
+{
+	unsigned int bucket;
+	spinlock_t *lock;
+	struct hlist_node *pos;
+	struct zram_entry *entry, *found = NULL;
+
+	if (!zram->dedup.buckets)
+		return NULL;
+
+	bucket = zram_dedup_bucket(zram, checksum);
+	lock = zram_dedup_lock(zram, bucket);
+
+	spin_lock(lock);
+	hlist_for_each_entry(entry, pos, &zram->dedup.buckets[bucket], node) {
+		void *cmem;
+		int match;
+
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, mem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+
+		if (match) {
+			entry->refcount++;
+			found = entry;
+			break;
+		}
+	}
+	spin_unlock(lock);
+
+	return found;
+}
+
+/*
+ * Make a newly written entry visible to zram_dedup_find(). Two writers
+ * storing the same contents concurrently may both insert; that only
+ * costs the saving, lookups still return a valid entry.
+ */
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry)
+{
+	unsigned int bucket;
+	spinlock_t *lock;
+
+	if (!zram->dedup.buckets)
+		return;
+
+	bucket = zram_dedup_bucket(zram, entry->checksum);
+	lock = zram_dedup_lock(zram, bucket);
+
+	spin_lock(lock);
+	hlist_add_head(&entry->node, &zram->dedup.buckets[bucket]);
+	spin_unlock(lock);
+}
+
+struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len,
+				u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return NULL;
+	}
+
+	INIT_HLIST_NODE(&entry->node);
+	entry->refcount = 1;
+	entry->checksum = checksum;
+	entry->len = len;
+
+	return entry;
+}
+
+/*
+ * Drop a reference to an entry, freeing the object along with the
+ * last one. Returns 1 if the object was freed.
+ */
+int zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	spinlock_t *lock = NULL;
+	unsigned int refcount;
+
+	if (!hlist_unhashed(&entry->node)) {
+		lock = zram_dedup_lock(zram,
+				zram_dedup_bucket(zram, entry->checksum));
+		spin_lock(lock);
+	}
+
+	refcount = --entry->refcount;
+	if (!refcount && lock)
+		hlist_del(&entry->node);
+
+	if (lock)
+		spin_unlock(lock);
+
+	if (refcount)
+		return 0;
+
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+
+	return 1;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	int i;
+	size_t num_buckets;
+
+	if (!zram->use_dedup)
+		return 0;
+
+	num_buckets = max_t(size_t, 1,
+			num_pages >> ZRAM_DEDUP_PAGES_PER_BUCKET_SHIFT);
+	zram->dedup.hash_bits = ilog2(num_buckets);
+	num_buckets = 1UL << zram->dedup.hash_bits;
+
+	zram->dedup.buckets = vzalloc(num_buckets *
+				sizeof(*zram->dedup.buckets));
+	if (!zram->dedup.buckets)
+		return -ENOMEM;
+
+	for (i = 0; i < ZRAM_DEDUP_LOCKS; i++)
+		spin_lock_init(&zram->dedup.lock[i]);
+
+	pr_debug("Dedup hash: %zu buckets\n", num_buckets);
+	return 0;
+}
+
+/* All entries must have been put before the hash is torn down */
+void zram_dedup_destroy(struct zram *zram)
+{
+	vfree(zram->dedup.buckets);
+	zram->dedup.buckets = NULL;
+}
+
+int zram_entry_cache_create(void)
+{
+	zram_entry_cache = kmem_cache_create("zram_entry",
+				sizeof(struct zram_entry), 0, 0, NULL);
+
+	return zram_entry_cache ? 0 : -ENOMEM;
+}
+
+void zram_entry_cache_destroy(void)
+{
+	kmem_cache_destroy(zram_entry_cache);
+}
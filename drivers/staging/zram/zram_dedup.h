@@ -0,0 +1,63 @@
+/*
+ * Compressed RAM block device - same page deduplication
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * Bucket locks, shared by hashing the bucket number; like the table
+ * locks this keeps the lock array small whatever the disk size.
+ */
+#define ZRAM_DEDUP_LOCKS_SHIFT	6
+#define ZRAM_DEDUP_LOCKS	(1 << ZRAM_DEDUP_LOCKS_SHIFT)
+
+/*
+ * A compressed object in the zsmalloc pool. Table entries of pages
+ * whose compressed data is identical share one zram_entry; the
+ * object is freed when the last of them goes away.
+ */
+struct zram_entry {
+	struct hlist_node node;	/* dedup hash chain */
+	unsigned long handle;	/* zsmalloc handle */
+	unsigned int refcount;	/* protected by the bucket lock */
+	u32 checksum;
+	u16 len;		/* compressed size */
+};
+
+struct zram_dedup {
+	struct hlist_head *buckets;
+	unsigned int hash_bits;
+	spinlock_t lock[ZRAM_DEDUP_LOCKS];
+};
+
+struct zram;
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_destroy(struct zram *zram);
+
+u32 zram_dedup_checksum(const void *mem, size_t len);
+struct zram_entry *zram_dedup_find(struct zram *zram, const void *mem,
+				size_t len, u32 checksum);
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry);
+
+struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len,
+				u32 checksum);
+int zram_entry_put(struct zram *zram, struct zram_entry *entry);
+
+int zram_entry_cache_create(void);
+void zram_entry_cache_destroy(void);
+
+#endif
@@ -23,13 +23,13 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/cpumask.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -42,16 +42,6 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
-{
-	*v = *v + 1;
-}
-
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
-}
-
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
 {
 	spin_lock(&zram->stat64_lock);
@@ -71,6 +61,30 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static spinlock_t *zram_table_lock(struct zram *zram, u32 index)
+{
+	return &zram->table_lock[index & (ZRAM_TABLE_LOCKS - 1)];
+}
+
+/*
+ * Lock the table entry for the given page. Contention is counted so
+ * that the number of table locks can be tuned against real workloads.
+ */
+static void zram_lock_slot(struct zram *zram, u32 index)
+{
+	spinlock_t *lock = zram_table_lock(zram, index);
+
+	if (unlikely(!spin_trylock(lock))) {
+		zram_stat64_inc(zram, &zram->stats.lock_contended);
+		spin_lock(lock);
+	}
+}
+
+static void zram_unlock_slot(struct zram *zram, u32 index)
+{
+	spin_unlock(zram_table_lock(zram, index));
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -89,18 +103,28 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Check whether the page is a single word repeated, as left behind by
+ * memset() or by freshly initialized arrays. Such pages are recorded
+ * as the word alone instead of being compressed.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
+	unsigned long val;
 
 	page = (unsigned long *)ptr;
+	val = page[0];
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	/* Compare from both ends: mismatches tend to be at the tail */
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page) / 2; pos++) {
+		if (page[pos] != val ||
+		    page[PAGE_SIZE / sizeof(*page) - 1 - pos] != val)
 			return 0;
 	}
 
+	*element = val;
 	return 1;
 }
 
@@ -133,56 +157,79 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/*
+ * Release the memory backing a table entry. Must be called with the
+ * entry's table lock held.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	u16 size = zram->table[index].size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	/* Let a writeback in progress know the page is gone */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_wb_free_block(&zram->wb, zram->table[index].blk);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram->table[index].blk = 0;
+		atomic_dec(&zram->stats.pages_wb);
 		return;
 	}
 
+	/*
+	 * No memory is allocated for same filled pages.
+	 * Simply clear the flag and fill word.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		if (!zram->table[index].element)
+			atomic_dec(&zram->stats.pages_zero);
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = 0;
+		atomic_dec(&zram->stats.pages_same);
+		return;
+	}
+
+	if (unlikely(!zram->table[index].entry))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page(zram->table[index].page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		atomic_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size, size);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	if (zram_entry_put(zram, zram->table[index].entry)) {
+		zram_stat64_sub(zram, &zram->stats.compr_size, size);
+		if (size <= PAGE_SIZE / 2)
+			atomic_dec(&zram->stats.good_compress);
+	} else {
+		/* Other pages still share the object */
+		zram_stat64_sub(zram, &zram->stats.dup_size, size);
+		atomic_dec(&zram->stats.pages_dup);
+	}
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	atomic_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
+	zram->table[index].size = 0;
 }
 
-static void handle_zero_page(struct page *page)
+static void handle_same_page(struct page *page, unsigned long element)
 {
-	void *user_mem;
+	unsigned int pos;
+	unsigned long *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element) {
+		memset(user_mem, 0, PAGE_SIZE);
+	} else {
+		for (pos = 0; pos < PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
+	}
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -194,16 +241,102 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
 	kunmap_atomic(cmem, KM_USER1);
+	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
 }
 
+/*
+ * Must be called with the entry's table lock held. A compression
+ * stream is needed since decompression state lives in the transform.
+ */
+static int zram_read_page(struct zram *zram, struct zram_comp_strm *strm,
+			struct page *page, u32 index)
+{
+	int ret;
+	unsigned long handle;
+	unsigned char *user_mem, *cmem;
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		handle_same_page(page, zram->table[index].element);
+		return 0;
+	}
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].entry)) {
+		pr_debug("Read before write: index=%u\n", index);
+		handle_same_page(page, 0);
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	handle = zram->table[index].entry->handle;
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	ret = zram_comp_decompress(zram->comp, strm, cmem,
+			zram->table[index].size, user_mem);
+
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return ret;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+/*
+ * Read a single page, from memory or from the backing device. The
+ * latter sleeps, so it is done after dropping the table lock.
+ */
+static int zram_bvec_read(struct zram *zram, struct page *page, u32 index)
+{
+	int ret;
+	unsigned long blk;
+	struct zram_comp_strm *strm;
+
+	strm = zram_comp_strm_find(zram->comp);
+	zram_lock_slot(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (likely(!zram_test_flag(zram, index, ZRAM_WB))) {
+		ret = zram_read_page(zram, strm, page, index);
+		zram_unlock_slot(zram, index);
+		zram_comp_strm_release(zram->comp, strm);
+		return ret;
+	}
+
+	blk = zram->table[index].blk;
+	zram_unlock_slot(zram, index);
+	zram_comp_strm_release(zram->comp, strm);
+
+	ret = zram_wb_read_page(&zram->wb, page, blk);
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+			ret, index);
+		return ret;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	flush_dcache_page(page);
+	return 0;
+}
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
@@ -216,184 +349,335 @@ static void zram_read(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
 
-		page = bvec->bv_page;
-
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
+		ret = zram_bvec_read(zram, bvec->bv_page, index);
+		if (unlikely(ret)) {
+			zram_stat64_inc(zram, &zram->stats.failed_reads);
+			goto out;
 		}
+		index++;
+	}
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	set_bit(BIO_UPTODATE, &bio->bi_flags);
+	bio_endio(bio, 0);
+	return;
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
+out:
+	bio_io_error(bio);
+}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+/*
+ * Compress and store a single page. Compression and allocation of
+ * the backing object run without any table lock held; the table lock
+ * is only taken to swap the new object in, so concurrent writers to
+ * different pages only serialize on the compression stream pool.
+ *
+ * If dedup is enabled and another page already has the same compressed
+ * data, the new page takes a reference to that object instead.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret, dup = 0;
+	size_t clen;
+	u32 checksum = 0;
+	unsigned long element;
+	struct page *page_store = NULL;
+	struct zram_entry *entry = NULL;
+	struct zram_comp_strm *strm;
+	unsigned char *user_mem, *cmem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		zram_lock_slot(zram, index);
+		/*
+		 * System overwrites unused sectors. Free memory
+		 * associated with this sector now.
+		 */
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		zram_unlock_slot(zram, index);
+		atomic_inc(&zram->stats.pages_same);
+		if (!element)
+			atomic_inc(&zram->stats.pages_zero);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	strm = zram_comp_strm_find(zram->comp);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zram_comp_compress(zram->comp, strm, user_mem, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (unlikely(ret)) {
+		zram_comp_strm_release(zram->comp, strm);
+		pr_err("Compression failed! err=%d\n", ret);
+		return ret;
+	}
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		zram_comp_strm_release(zram->comp, strm);
+
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			return -ENOMEM;
+		}
+
+		user_mem = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, user_mem, PAGE_SIZE);
 		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
+		goto update;
+	}
+
+	if (zram->use_dedup) {
+		checksum = zram_dedup_checksum(strm->buffer, clen);
+		entry = zram_dedup_find(zram, strm->buffer, clen, checksum);
+		if (entry) {
+			zram_comp_strm_release(zram->comp, strm);
+			dup = 1;
+			goto update;
 		}
+	}
 
-		flush_dcache_page(page);
-		index++;
+	entry = zram_entry_alloc(zram, clen, checksum);
+	if (!entry) {
+		zram_comp_strm_release(zram->comp, strm);
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		return -ENOMEM;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+	memcpy(cmem, strm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
 
-out:
-	bio_io_error(bio);
+	zram_comp_strm_release(zram->comp, strm);
+
+	zram_dedup_insert(zram, entry);
+
+update:
+	zram_lock_slot(zram, index);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	zram->table[index].size = clen;
+	if (unlikely(page_store)) {
+		zram->table[index].page = page_store;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		atomic_inc(&zram->stats.pages_expand);
+	} else {
+		zram->table[index].entry = entry;
+	}
+	zram_unlock_slot(zram, index);
+
+	/* Update stats */
+	atomic_inc(&zram->stats.pages_stored);
+	if (dup) {
+		zram_stat64_add(zram, &zram->stats.dup_size, clen);
+		atomic_inc(&zram->stats.pages_dup);
+		return 0;
+	}
+
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (clen <= PAGE_SIZE / 2)
+		atomic_inc(&zram->stats.good_compress);
+
+	return 0;
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Mark all pages currently stored as idle. Any later access clears
+ * the mark, so a ZRAM_WB_IDLE writeback pass only picks up pages that
+ * were left alone since the last call.
+ */
+void zram_mark_idle(struct zram *zram)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	size_t index;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		zram_lock_slot(zram, index);
+		if (zram->table[index].entry &&
+		    !zram_test_flag(zram, index, ZRAM_SAME) &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_unlock_slot(zram, index);
+	}
+}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			enum zram_wb_mode mode)
+{
+	if (!zram->table[index].entry ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		return 0;
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
 
-		mutex_lock(&zram->lock);
+/*
+ * Complete a batch of pages written back to consecutive blocks from
+ * blk onwards: pages that were not freed or rewritten meanwhile now
+ * live on the backing device and their memory is released.
+ */
+static void zram_wb_finish(struct zram *zram, u32 *indices, int nr,
+			unsigned long blk, int err)
+{
+	int i;
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
+	for (i = 0; i < nr; i++, blk++) {
+		u32 index = indices[i];
+
+		zram_lock_slot(zram, index);
+		if (err || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_unlock_slot(zram, index);
+			zram_wb_free_block(&zram->wb, blk);
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].blk = blk;
+		zram_unlock_slot(zram, index);
+		atomic_inc(&zram->stats.pages_wb);
+	}
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (!err)
+		zram_stat64_add(zram, &zram->stats.bd_writes, nr);
+}
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+/*
+ * Move the pages selected by mode to the backing device. Pages are
+ * decompressed into a private buffer and written in batches of up to
+ * ZRAM_WB_BATCH contiguous blocks per bio; table locks are only held
+ * while copying a page out and while swapping it for its block, so
+ * foreground I/O keeps going during the pass.
+ *
+ * Called with init_lock held.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int i, ret = 0, nr = 0;
+	size_t index;
+	unsigned long blk, first_blk = 0;
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 indices[ZRAM_WB_BATCH];
+
+	if (!zram->wb.bdev)
+		return -ENODEV;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			while (i--)
+				__free_page(pages[i]);
+			return -ENOMEM;
 		}
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
-
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		struct zram_comp_strm *strm;
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+		strm = zram_comp_strm_find(zram->comp);
+		zram_lock_slot(zram, index);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			zram_unlock_slot(zram, index);
+			zram_comp_strm_release(zram->comp, strm);
+			continue;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		blk = 0;
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		ret = zram_read_page(zram, strm, pages[nr], index);
+		if (!ret)
+			blk = zram_wb_alloc_block(&zram->wb, first_blk + nr);
+		if (ret || !blk)
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_unlock_slot(zram, index);
+		zram_comp_strm_release(zram->comp, strm);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		if (ret)
+			break;
+		if (!blk) {
+			ret = -ENOSPC;
+			break;
+		}
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+		/* A bio covers contiguous blocks only */
+		if (nr && blk != first_blk + nr) {
+			ret = zram_wb_write_pages(&zram->wb, pages, nr,
+						first_blk);
+			zram_wb_finish(zram, indices, nr, first_blk, ret);
+			/* Page was read into pages[nr]: move it to the front */
+			swap(pages[0], pages[nr]);
+			nr = 0;
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+		if (!nr)
+			first_blk = blk;
+		indices[nr++] = index;
+		/* Still owned by this pass: released by the last batch */
+		if (ret)
+			break;
+
+		if (nr == ZRAM_WB_BATCH) {
+			ret = zram_wb_write_pages(&zram->wb, pages, nr,
+						first_blk);
+			zram_wb_finish(zram, indices, nr, first_blk, ret);
+			nr = 0;
+			if (ret)
+				break;
+		}
+	}
+
+	if (nr) {
+		i = zram_wb_write_pages(&zram->wb, pages, nr, first_blk);
+		zram_wb_finish(zram, indices, nr, first_blk, i);
+		if (!ret)
+			ret = i;
+	}
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		__free_page(pages[i]);
+
+	return ret;
+}
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
 
-		mutex_unlock(&zram->lock);
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (unlikely(zram_write_page(zram, bvec->bv_page, index))) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
 		index++;
 	}
 
@@ -461,33 +745,31 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	if (zram->comp)
+		zram_comp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (zram_test_flag(zram, index, ZRAM_SAME) ||
+		    zram_test_flag(zram, index, ZRAM_WB) ||
+		    !zram->table[index].entry)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
+			__free_page(zram->table[index].page);
 		else
-			xv_free(zram->mem_pool, page, offset);
+			zram_entry_put(zram, zram->table[index].entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_destroy(zram);
+	zram_wb_close(&zram->wb);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,16 +793,11 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zram_comp_create(zram->compressor,
+				zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error initializing %s compression streams\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -540,13 +817,19 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating dedup hash table\n");
+		goto fail;
+	}
+
 	zram->init_done = 1;
 	mutex_unlock(&zram->init_lock);
 
@@ -566,7 +849,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_lock_slot(zram, index);
 	zram_free_page(zram, index);
+	zram_unlock_slot(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -577,11 +862,16 @@ static const struct block_device_operations zram_devops = {
 
 static int create_device(struct zram *zram, int device_id)
 {
-	int ret = 0;
+	int i, ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	for (i = 0; i < ZRAM_TABLE_LOCKS; i++)
+		spin_lock_init(&zram->table_lock[i]);
+	zram->max_comp_streams = num_online_cpus();
+	zram->use_dedup = 1;
+	strlcpy(zram->compressor, ZRAM_DEFAULT_COMPRESSOR,
+		sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -664,11 +954,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_entry_cache_create();
+	if (ret) {
+		pr_warning("Unable to create entry cache\n");
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -698,6 +994,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	zram_entry_cache_destroy();
 out:
 	return ret;
 }
@@ -713,9 +1011,12 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		/* A backing device may be set on an unused disk */
+		zram_wb_close(&zram->wb);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	zram_entry_cache_destroy();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
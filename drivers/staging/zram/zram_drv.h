@@ -16,9 +16,13 @@
 #define _ZRAM_DRV_H_
 
 #include <linux/spinlock.h>
+#include <linux/atomic.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zram_comp.h"
+#include "zram_dedup.h"
+#include "zram_wb.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +30,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -51,8 +43,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -63,13 +55,33 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
+/*
+ * Table entries are protected by an array of spinlocks hashed on the
+ * page index, so that I/O to different pages proceeds in parallel
+ * without paying for a lock per entry.
+ */
+#define ZRAM_TABLE_LOCKS_SHIFT	6
+#define ZRAM_TABLE_LOCKS	(1 << ZRAM_TABLE_LOCKS_SHIFT)
+
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
 	/* Page is stored uncompressed */
 	ZRAM_UNCOMPRESSED,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/*
+	 * Page consists of a single repeated word (table[page_no].element),
+	 * zero being the most common; nothing is allocated for it.
+	 */
+	ZRAM_SAME,
+
+	/* Page was written back to the backing device (table[page_no].blk) */
+	ZRAM_WB,
+
+	/* Page was not accessed since it was marked idle */
+	ZRAM_IDLE,
+
+	/* Page is being written back; cleared if it is freed meanwhile */
+	ZRAM_UNDER_WB,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -78,8 +90,13 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		struct zram_entry *entry;	/* compressed object */
+		struct page *page;		/* ZRAM_UNCOMPRESSED */
+		unsigned long element;		/* ZRAM_SAME fill word */
+		unsigned long blk;		/* ZRAM_WB backing block */
+	};
+	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -92,20 +109,25 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 lock_contended;	/* no. of times a table lock was busy */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
+	u64 dup_size;		/* compressed bytes saved by dedup */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_same;	/* no. of same filled pages, incl. zero */
+	atomic_t pages_dup;	/* no. of pages sharing another's object */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+	atomic_t pages_wb;	/* no. of pages on the backing device */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp *comp;
 	struct table *table;
+	spinlock_t table_lock[ZRAM_TABLE_LOCKS];
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +138,15 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Upper bound on concurrently used compression streams */
+	int max_comp_streams;
+	/* Crypto API name of the compression algorithm */
+	char compressor[CRYPTO_MAX_ALG_NAME];
+	/* Share the object of pages with identical compressed data */
+	int use_dedup;
+	struct zram_dedup dedup;
+	/* Optional block device taking idle or incompressible pages */
+	struct zram_wb wb;
 
 	struct zram_stats stats;
 };
@@ -128,5 +159,7 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
 
 #endif
@@ -0,0 +1,229 @@
+/*
+ * Compressed RAM block device - backing device writeback
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "zram_drv.h"
+
+#define ZRAM_WB_SECTORS_PER_BLOCK	(PAGE_SIZE >> SECTOR_SHIFT)
+
+int zram_wb_open(struct zram_wb *wb, const char *path, void *holder)
+{
+	int ret;
+	struct block_device *bdev;
+	unsigned long nr_blocks;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				holder);
+	if (IS_ERR(bdev)) {
+		pr_err("Cannot open backing device %s\n", path);
+		return PTR_ERR(bdev);
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	wb->bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	wb->name = kstrdup(path, GFP_KERNEL);
+	if (!wb->bitmap || !wb->name) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	/* Block 0 means "none" */
+	set_bit(0, wb->bitmap);
+
+	wb->bdev = bdev;
+	wb->nr_blocks = nr_blocks;
+
+	pr_info("Using %s as backing device (%lu pages)\n", path, nr_blocks);
+	return 0;
+
+fail:
+	vfree(wb->bitmap);
+	wb->bitmap = NULL;
+	kfree(wb->name);
+	wb->name = NULL;
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+
+void zram_wb_close(struct zram_wb *wb)
+{
+	if (!wb->bdev)
+		return;
+
+	blkdev_put(wb->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	vfree(wb->bitmap);
+	kfree(wb->name);
+	memset(wb, 0, sizeof(*wb));
+}
+
+/*
+ * Allocate a block, starting the search at hint so that consecutive
+ * allocations are contiguous and can share a bio. Returns 0 if the
+ * device is full.
+ */
+unsigned long zram_wb_alloc_block(struct zram_wb *wb, unsigned long hint)
+{
+	unsigned long blk;
+
+	if (!hint || hint >= wb->nr_blocks)
+		hint = 1;
+
+	for (;;) {
+		blk = find_next_zero_bit(wb->bitmap, wb->nr_blocks, hint);
+		if (blk >= wb->nr_blocks) {
+			if (hint == 1)
+				return 0;
+			/* Wrap around */
+			hint = 1;
+			continue;
+		}
+
+		if (!test_and_set_bit(blk, wb->bitmap))
+			return blk;
+		hint = blk;
+	}
+}
+
+void zram_wb_free_block(struct zram_wb *wb, unsigned long blk)
+{
+	WARN_ON_ONCE(!test_and_clear_bit(blk, wb->bitmap));
+}
+
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Submit a bio and wait for it; must not be called from make_request */
+static int zram_wb_submit_wait(struct bio *bio, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio->bi_private = &done;
+	bio->bi_end_io = zram_wb_end_io;
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	return test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+}
+
+/* Write nr_pages pages to the contiguous blocks starting at blk */
+int zram_wb_write_pages(struct zram_wb *wb, struct page **pages,
+			int nr_pages, unsigned long blk)
+{
+	int i, ret;
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_KERNEL, nr_pages);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = wb->bdev;
+	bio->bi_sector = blk * ZRAM_WB_SECTORS_PER_BLOCK;
+	for (i = 0; i < nr_pages; i++) {
+		if (!bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			bio_put(bio);
+			return -EIO;
+		}
+	}
+
+	ret = zram_wb_submit_wait(bio, WRITE);
+	bio_put(bio);
+
+	return ret;
+}
+
+static int __zram_wb_read_page(struct zram_wb *wb, struct page *page,
+			unsigned long blk)
+{
+	int ret;
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = wb->bdev;
+	bio->bi_sector = blk * ZRAM_WB_SECTORS_PER_BLOCK;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	ret = zram_wb_submit_wait(bio, READ);
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_wb_read_work {
+	struct work_struct work;
+	struct zram_wb *wb;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_wb_read_fn(struct work_struct *work)
+{
+	struct zram_wb_read_work *rw;
+
+	rw = container_of(work, struct zram_wb_read_work, work);
+	rw->ret = __zram_wb_read_page(rw->wb, rw->page, rw->blk);
+}
+
+/*
+ * Read a page back from the backing device. Inside make_request,
+ * generic_make_request() only queues the bios we submit until we
+ * return, so waiting for one there would deadlock: hand the read to
+ * a worker instead.
+ */
+int zram_wb_read_page(struct zram_wb *wb, struct page *page,
+			unsigned long blk)
+{
+	struct zram_wb_read_work rw;
+
+	if (!current->bio_list)
+		return __zram_wb_read_page(wb, page, blk);
+
+	rw.wb = wb;
+	rw.page = page;
+	rw.blk = blk;
+	INIT_WORK_ONSTACK(&rw.work, zram_wb_read_fn);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	return rw.ret;
+}
@@ -0,0 +1,51 @@
+/*
+ * Compressed RAM block device - backing device writeback
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_WB_H_
+#define _ZRAM_WB_H_
+
+#include <linux/blkdev.h>
+#include <linux/mm_types.h>
+
+/* Max no. of pages written back with a single bio */
+#define ZRAM_WB_BATCH		32
+
+/* Slots selected by a writeback pass */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,		/* marked idle and not accessed since */
+	ZRAM_WB_HUGE,		/* stored uncompressed */
+};
+
+/*
+ * Block device that takes pages evicted from RAM, allocated in units
+ * of PAGE_SIZE. Block 0 is never handed out so that it can stand for
+ * "no block".
+ */
+struct zram_wb {
+	struct block_device *bdev;
+	char *name;			/* path given through sysfs */
+	unsigned long nr_blocks;
+	unsigned long *bitmap;		/* allocated blocks */
+};
+
+int zram_wb_open(struct zram_wb *wb, const char *path, void *holder);
+void zram_wb_close(struct zram_wb *wb);
+
+unsigned long zram_wb_alloc_block(struct zram_wb *wb, unsigned long hint);
+void zram_wb_free_block(struct zram_wb *wb, unsigned long blk);
+
+int zram_wb_write_pages(struct zram_wb *wb, struct page **pages,
+			int nr_pages, unsigned long blk);
+int zram_wb_read_page(struct zram_wb *wb, struct page *page,
+			unsigned long blk);
+
+#endif
@@ -0,0 +1,779 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped into size classes, ZS_SIZE_CLASS_DELTA bytes
+ * apart. Each class stores its objects in "zspages": groups of 1 to
+ * ZS_MAX_PAGES_PER_ZSPAGE discontiguous 0-order pages, sized so that
+ * the tail of the zspage wastes as little as possible. Objects may
+ * span two pages; such objects are mapped through a per-cpu buffer.
+ *
+ * Users get an opaque handle for each object. Handles point to a small
+ * descriptor holding the object location, so that compaction can move
+ * objects out of sparsely used zspages and release them.
+ */
+
+#define KMSG_COMPONENT "zsmalloc"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* per-cpu buffer used to map objects that span two pages */
+struct mapping_area {
+	char *vm_buf;		/* copy of the object */
+	char *vm_addr;		/* address of kmap_atomic()'ed page */
+	enum zs_mapmode vm_mm;	/* mapping mode */
+	struct zspage *zspage;
+	unsigned long idx;
+	int huge;		/* object spans pages, vm_buf is used */
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+static struct kmem_cache *zs_zspage_cachep;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * To reduce memory wastage at the end of a zspage, choose the number
+ * of pages that gives the best utilization for the given object size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	/* zspage order which gives maximum used size per KB */
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static void obj_location(struct size_class *class, unsigned long idx,
+			struct page **pages, struct page **page,
+			unsigned long *offset)
+{
+	unsigned long off = idx * class->size;
+
+	*page = pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+/* Headers never straddle pages, see ZS_SIZE_CLASS_DELTA */
+static unsigned long obj_read_header(struct zspage *zspage,
+				unsigned long idx)
+{
+	struct page *page;
+	unsigned long offset, hdr;
+	void *addr;
+
+	obj_location(zspage->class, idx, zspage->pages, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	hdr = *(unsigned long *)(addr + offset);
+	kunmap_atomic(addr, KM_USER0);
+
+	return hdr;
+}
+
+static void obj_write_header(struct zspage *zspage, unsigned long idx,
+			unsigned long hdr)
+{
+	struct page *page;
+	unsigned long offset;
+	void *addr;
+
+	obj_location(zspage->class, idx, zspage->pages, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(addr + offset) = hdr;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+static enum fullness_group get_fullness_group(struct zspage *zspage)
+{
+	int inuse, max_objects;
+
+	inuse = zspage->inuse;
+	max_objects = zspage->class->objs_per_zspage;
+
+	if (inuse == 0)
+		return ZS_EMPTY;
+	if (inuse == max_objects)
+		return ZS_FULL;
+	if (inuse <= max_objects / fullness_threshold_frac)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move the zspage to the list matching its current usage. Must be
+ * called with the class lock held; returns the new fullness group.
+ */
+static enum fullness_group fix_fullness_group(struct zspage *zspage)
+{
+	struct size_class *class = zspage->class;
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+	if (newfg < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+/* Pick a zspage with a free object, preferring the fullest ones */
+static struct zspage *find_get_zspage(struct size_class *class,
+				struct zspage *exclude)
+{
+	int i;
+	struct zspage *zspage;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		list_for_each_entry(zspage, &class->fullness_list[i], list) {
+			if (zspage != exclude)
+				return zspage;
+		}
+	}
+
+	return NULL;
+}
+
+static void free_zspage(struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < zspage->class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(zs_zspage_cachep, zspage);
+}
+
+/*
+ * Allocate a zspage for the given class and link all its objects
+ * into the zspage free list.
+ */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	int i;
+	unsigned long idx;
+	struct zspage *zspage;
+
+	zspage = kmem_cache_zalloc(zs_zspage_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	zspage->class = class;
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (unlikely(!zspage->pages[i]))
+			goto cleanup;
+	}
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		unsigned long next = idx + 1;
+
+		if (next == class->objs_per_zspage)
+			next = OBJ_FREE_END;
+		obj_write_header(zspage, idx, next << OBJ_FREE_SHIFT);
+	}
+	zspage->free_idx = 0;
+
+	return zspage;
+
+cleanup:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(zs_zspage_cachep, zspage);
+	return NULL;
+}
+
+/* Take the first free object of the zspage for the given handle */
+static void obj_alloc(struct zspage *zspage, struct zs_handle *handle)
+{
+	unsigned long idx = zspage->free_idx;
+
+	zspage->free_idx = obj_read_header(zspage, idx) >> OBJ_FREE_SHIFT;
+	obj_write_header(zspage, idx,
+			(unsigned long)handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+
+	handle->zspage = zspage;
+	handle->idx = idx;
+}
+
+static void obj_free(struct zspage *zspage, unsigned long idx)
+{
+	obj_write_header(zspage, idx, zspage->free_idx << OBJ_FREE_SHIFT);
+	zspage->free_idx = idx;
+	zspage->inuse--;
+}
+
+static void pin_handle(struct zs_handle *handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, &handle->flags);
+}
+
+static void unpin_handle(struct zs_handle *handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, &handle->flags);
+}
+
+/* Copy object data between two zspages of the same class */
+static void obj_copy(struct zspage *dst, unsigned long didx,
+		struct zspage *src, unsigned long sidx)
+{
+	struct size_class *class = src->class;
+	unsigned long d_off = didx * class->size;
+	unsigned long s_off = sidx * class->size;
+	unsigned long remaining = class->size;
+
+	while (remaining) {
+		unsigned long d_pos = d_off & ~PAGE_MASK;
+		unsigned long s_pos = s_off & ~PAGE_MASK;
+		unsigned long len;
+		void *d_addr, *s_addr;
+
+		len = min3(remaining, PAGE_SIZE - d_pos, PAGE_SIZE - s_pos);
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT], KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT], KM_USER1);
+		memcpy(d_addr + d_pos, s_addr + s_pos, len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		d_off += len;
+		s_off += len;
+		remaining -= len;
+	}
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int size, j;
+		struct size_class *class;
+
+		size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		if (size > ZS_MAX_ALLOC_SIZE)
+			size = ZS_MAX_ALLOC_SIZE;
+
+		class = &pool->size_class[i];
+		class->size = size;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / size;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg]))
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cachep,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+	handle->flags = 0;
+
+	class = &pool->size_class[get_size_class_index(size +
+							ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class, NULL);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, handle);
+			return 0;
+		}
+
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->pages_allocated += class->pages_per_zspage;
+		class->zspages++;
+	}
+
+	obj_alloc(zspage, handle);
+	class->obj_used++;
+	fix_fullness_group(zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	/* Keep compaction from moving the object under us */
+	pin_handle(handle);
+	zspage = handle->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(zspage, handle->idx);
+	class->obj_used--;
+	fullness = fix_fullness_group(zspage);
+	if (fullness == ZS_EMPTY) {
+		class->pages_allocated -= class->pages_per_zspage;
+		class->zspages--;
+	}
+	spin_unlock(&class->lock);
+	unpin_handle(handle);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(zspage);
+	}
+
+	kmem_cache_free(zs_handle_cachep, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. There is no
+ * protection against nested mappings.
+ *
+ * This function returns with preemption and page faults disabled.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct mapping_area *area;
+	struct size_class *class;
+	struct page *page;
+	unsigned long offset;
+	unsigned long first;
+	char *addr;
+
+	BUG_ON(!handle);
+
+	pin_handle(handle);
+	class = handle->zspage->class;
+	obj_location(class, handle->idx, handle->zspage->pages,
+			&page, &offset);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	area->zspage = handle->zspage;
+	area->idx = handle->idx;
+
+	if (offset + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->huge = 0;
+		area->vm_addr = kmap_atomic(page, KM_USER1);
+		return area->vm_addr + offset + ZS_HANDLE_SIZE;
+	}
+
+	/* this object spans two pages */
+	area->huge = 1;
+	if (mm != ZS_MM_WO) {
+		first = PAGE_SIZE - offset;
+		addr = kmap_atomic(page, KM_USER1);
+		memcpy(area->vm_buf, addr + offset, first);
+		kunmap_atomic(addr, KM_USER1);
+
+		page = handle->zspage->pages[((handle->idx * class->size) >>
+						PAGE_SHIFT) + 1];
+		addr = kmap_atomic(page, KM_USER1);
+		memcpy(area->vm_buf + first, addr, class->size - first);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct mapping_area *area;
+	struct size_class *class;
+	struct page *page;
+	unsigned long offset;
+	unsigned long first;
+	char *addr;
+
+	BUG_ON(!handle);
+
+	area = &__get_cpu_var(zs_map_area);
+	if (!area->huge) {
+		kunmap_atomic(area->vm_addr, KM_USER1);
+		goto out;
+	}
+
+	if (area->vm_mm == ZS_MM_RO)
+		goto out;
+
+	/* Write back the object, skipping its header */
+	class = area->zspage->class;
+	obj_location(class, area->idx, area->zspage->pages, &page, &offset);
+	first = PAGE_SIZE - offset;
+	if (first > ZS_HANDLE_SIZE) {
+		addr = kmap_atomic(page, KM_USER1);
+		memcpy(addr + offset + ZS_HANDLE_SIZE,
+			area->vm_buf + ZS_HANDLE_SIZE,
+			first - ZS_HANDLE_SIZE);
+		kunmap_atomic(addr, KM_USER1);
+	}
+
+	page = area->zspage->pages[((area->idx * class->size) >>
+					PAGE_SHIFT) + 1];
+	addr = kmap_atomic(page, KM_USER1);
+	memcpy(addr, area->vm_buf + first, class->size - first);
+	kunmap_atomic(addr, KM_USER1);
+
+out:
+	put_cpu_var(zs_map_area);
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Move all objects of src into other zspages of the same class.
+ * Gives up, leaving src partially drained, if an object is pinned or
+ * no other zspage has room. Called with the class lock held.
+ */
+static int migrate_zspage(struct zspage *src)
+{
+	unsigned long idx;
+	struct size_class *class = src->class;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		struct zs_handle *handle;
+		struct zspage *dst;
+		unsigned long hdr;
+
+		hdr = obj_read_header(src, idx);
+		if (!(hdr & OBJ_ALLOCATED_TAG))
+			continue;
+
+		dst = find_get_zspage(class, src);
+		if (!dst)
+			return 0;
+
+		handle = (struct zs_handle *)(hdr & ~OBJ_ALLOCATED_TAG);
+		if (!bit_spin_trylock(HANDLE_PIN_BIT, &handle->flags))
+			return 0;
+
+		obj_alloc(dst, handle);
+		obj_copy(dst, handle->idx, src, idx);
+		obj_free(src, idx);
+		unpin_handle(handle);
+
+		fix_fullness_group(dst);
+		fix_fullness_group(src);
+	}
+
+	return !src->inuse;
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src, *tmp;
+	LIST_HEAD(free_list);
+
+	spin_lock(&class->lock);
+	/* Only worth it while a whole zspage worth of objects is unused */
+	while (class->zspages * class->objs_per_zspage - class->obj_used >=
+			class->objs_per_zspage) {
+		if (!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY]))
+			src = list_entry(
+				class->fullness_list[ZS_ALMOST_EMPTY].prev,
+				struct zspage, list);
+		else if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+			src = list_entry(
+				class->fullness_list[ZS_ALMOST_FULL].prev,
+				struct zspage, list);
+		else
+			break;
+
+		if (!migrate_zspage(src))
+			break;
+
+		/* src is now ZS_EMPTY and off the fullness lists */
+		class->pages_allocated -= class->pages_per_zspage;
+		class->zspages--;
+		class->compacted++;
+		list_add(&src->list, &free_list);
+	}
+	spin_unlock(&class->lock);
+
+	list_for_each_entry_safe(src, tmp, &free_list, list) {
+		list_del(&src->list);
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(src);
+		freed += class->pages_per_zspage;
+	}
+
+	return freed;
+}
+
+/**
+ * zs_compact - Release sparsely used zspages.
+ * @pool: pool to compact
+ *
+ * Objects of each class are moved out of the least used zspages into
+ * the free slots of other zspages, and emptied zspages are freed.
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/**
+ * zs_pool_stats_show - Format per size class statistics.
+ * @pool: pool to report on
+ * @buf: output buffer
+ * @len: size of the output buffer
+ *
+ * One line is emitted per size class that has zspages allocated:
+ * object size, pages per zspage, objects in use, object slots
+ * allocated and zspages released by compaction. The difference
+ * between the two object columns is the fragmentation overhead.
+ * Lines are kept short so that all classes fit in a sysfs page.
+ */
+ssize_t zs_pool_stats_show(struct zs_pool *pool, char *buf, size_t len)
+{
+	int i;
+	ssize_t sz;
+
+	sz = scnprintf(buf, len, "%4s %s %7s %7s %5s\n", "size", "p",
+			"used", "alloc", "cmpct");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long used, allocated;
+		u64 compacted;
+
+		spin_lock(&class->lock);
+		used = class->obj_used;
+		allocated = class->zspages * class->objs_per_zspage;
+		compacted = class->compacted;
+		spin_unlock(&class->lock);
+
+		if (!allocated)
+			continue;
+
+		sz += scnprintf(buf + sz, len - sz,
+				"%4d %d %7lu %7lu %5llu\n", class->size,
+				class->pages_per_zspage, used, allocated,
+				compacted);
+	}
+
+	return sz;
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats_show);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static void zs_destroy_caches(void)
+{
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	if (zs_zspage_cachep)
+		kmem_cache_destroy(zs_zspage_cachep);
+	zs_free_map_areas();
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cachep = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	zs_zspage_cachep = kmem_cache_create("zspage",
+				sizeof(struct zspage), 0, 0, NULL);
+	if (!zs_handle_cachep || !zs_zspage_cachep)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	zs_destroy_caches();
+	return -ENOMEM;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_destroy_caches();
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
@@ -0,0 +1,128 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the license that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * A single 'zspage' is composed of up to 2^N discontiguous 0-order
+ * (single) pages. This is the upper bound on N.
+ */
+#define ZS_MAX_ZSPAGE_ORDER 2
+#define ZS_MAX_PAGES_PER_ZSPAGE (_AC(1, UL) << ZS_MAX_ZSPAGE_ORDER)
+
+/*
+ * Every object starts with a header word: for allocated objects it
+ * holds the owning handle (tagged with OBJ_ALLOCATED_TAG) so that the
+ * object can be moved during compaction; for free objects it holds the
+ * index of the next free object in the zspage.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_FREE_SHIFT		1
+#define OBJ_FREE_END		(~0UL >> OBJ_FREE_SHIFT)
+
+/*
+ * Size classes are spaced ZS_SIZE_CLASS_DELTA bytes apart. The delta
+ * keeps every object (and so every header) aligned such that a header
+ * never straddles a page boundary.
+ */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 7)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * zspages of a class are kept on one of these lists depending on how
+ * many of their objects are in use. Allocation prefers almost full
+ * zspages; compaction drains almost empty ones.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+	ZS_FULL
+};
+
+/*
+ * We assign a zspage to ZS_ALMOST_EMPTY fullness group when:
+ *	n <= N / f, where
+ * n = number of allocated objects
+ * N = total number of objects zspage can store
+ * f = 1/fullness_threshold_frac
+ */
+static const int fullness_threshold_frac = 4;
+
+struct size_class;
+
+/* Descriptor for one zspage, kept outside of the (highmem) pages */
+struct zspage {
+	struct size_class *class;
+	struct list_head list;		/* fullness group list */
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned long free_idx;		/* first free object or OBJ_FREE_END */
+	u8 fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+/*
+ * Handles returned to users point to one of these, so an object can
+ * be relocated by updating its handle. The pin bit keeps an object in
+ * place while it is mapped or being freed.
+ */
+#define HANDLE_PIN_BIT	0
+
+struct zs_handle {
+	unsigned long flags;
+	struct zspage *zspage;
+	unsigned long idx;
+};
+
+struct size_class {
+	/*
+	 * Size of objects stored in this class. Must be multiple
+	 * of ZS_SIZE_CLASS_DELTA.
+	 */
+	int size;
+	unsigned int index;
+
+	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	spinlock_t lock;
+
+	/* stats */
+	u64 pages_allocated;
+	unsigned long obj_used;
+	unsigned long zspages;
+	u64 compacted;		/* no. of zspages freed by compaction */
+
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	gfp_t flags;	/* allocation flags used when growing pool */
+	const char *name;
+	atomic_long_t pages_allocated;
+};
+
+#endif
@@ -965,6 +965,7 @@ static int de_thread(struct task_struct *tsk)
 		leader->exit_state = EXIT_DEAD;
 		write_unlock_irq(&tasklist_lock);
 
+		lowmem_adj_index_add(tsk);
 		release_task(leader);
 	}
 
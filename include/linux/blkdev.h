@@ -126,6 +126,10 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_LATENCY_HIST
+	ktime_t lat_queue_time;		/* allocated */
+	ktime_t lat_dispatch_time;	/* passed to the driver */
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -260,6 +264,18 @@ struct queue_limits {
 	unsigned char		discard_zeroes_data;
 };
 
+#ifdef CONFIG_BLK_LATENCY_HIST
+#define BLK_LAT_HIST_BUCKETS	20
+
+/*
+ * Request latencies in power of two buckets of usecs: bucket i counts
+ * latencies below 2^(i+1) usecs, the last one everything above.
+ */
+struct blk_lat_hist {
+	unsigned long		count[2][2][BLK_LAT_HIST_BUCKETS]; /* [rw][sync] */
+};
+#endif
+
 struct request_queue
 {
 	/*
@@ -386,6 +402,11 @@ struct request_queue
 	/* Throttle data */
 	struct throtl_data *td;
 #endif
+
+#ifdef CONFIG_BLK_LATENCY_HIST
+	struct blk_lat_hist	dispatch_lat;	/* allocated to dispatched */
+	struct blk_lat_hist	completion_lat;	/* dispatched to completed */
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -0,0 +1,54 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *  Compressor and decompressor for the LZ4 block format
+ *
+ *  The LZ4 format and reference implementation are by Yann Collet:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+/*
+ * lz4_compressbound()
+ * Provides the maximum size that LZ4 may output in a "worst case" scenario
+ * (input data not compressible)
+ */
+#define lz4_compressbound(isize) ((isize) + ((isize) / 255) + 16)
+
+/*
+ * lz4_compress()
+ *	src     : source address of the original data
+ *	src_len : size of the original data
+ *	dst     : output buffer address of the compressed data.
+ *		  This requires 'dst' of size lz4_compressbound(src_len).
+ *	dst_len : is the output size, which is returned after compress done
+ *	workmem : address of the working memory.
+ *		  This requires 'workmem' of size LZ4_MEM_COMPRESS.
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * lz4_decompress_safe()
+ *	src     : source address of the compressed data
+ *	src_len : is the input size, the exact size of the compressed data
+ *	dst     : output buffer address of the decompressed data
+ *	dst_len : is the size of the destination buffer on input, and the
+ *		  size of the decompressed data on return
+ *	return  : Success if return 0
+ *		  Error if return (< 0)
+ *	note    : Malformed input never reads or writes outside the buffers.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len);
+
+#endif
@@ -157,6 +157,8 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 u64 mem_cgroup_get_limit(struct mem_cgroup *mem);
 
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx);
+void mem_cgroup_uksm_account(struct mm_struct *mm, unsigned long merged,
+			     unsigned long cowed, unsigned long scan_ms);
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 void mem_cgroup_split_huge_fixup(struct page *head, struct page *tail);
 #endif
@@ -374,6 +376,12 @@ static inline
 void mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 }
+
+static inline
+void mem_cgroup_uksm_account(struct mm_struct *mm, unsigned long merged,
+			     unsigned long cowed, unsigned long scan_ms)
+{
+}
 static inline void mem_cgroup_replace_page_cache(struct page *oldpage,
 				struct page *newpage)
 {
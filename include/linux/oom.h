@@ -71,6 +71,19 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/* Keep the lowmemorykiller's index of processes by oom_adj up to date */
+extern void lowmem_adj_index_fork(struct task_struct *p);
+extern void lowmem_adj_index_add(struct task_struct *p);
+extern void lowmem_adj_index_del(struct task_struct *p);
+extern void lowmem_adj_index_update(struct task_struct *p);
+#else
+static inline void lowmem_adj_index_fork(struct task_struct *p) {}
+static inline void lowmem_adj_index_add(struct task_struct *p) {}
+static inline void lowmem_adj_index_del(struct task_struct *p) {}
+static inline void lowmem_adj_index_update(struct task_struct *p) {}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
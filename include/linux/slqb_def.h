@@ -18,9 +18,11 @@
 
 enum stat_item {
 	ALLOC,			/* Allocation count */
+	ALLOC_HIT,		/* Allocation served by the CPU freelist */
 	ALLOC_SLAB_FILL,	/* Fill freelist from page list */
 	ALLOC_SLAB_NEW,		/* New slab acquired from page allocator */
 	FREE,			/* Free count */
+	FREE_HIT,		/* Free absorbed by the CPU freelist */
 	FREE_REMOTE,		/* NUMA: freeing to remote list */
 	FLUSH_FREE_LIST,	/* Freelist flushed */
 	FLUSH_FREE_LIST_OBJECTS, /* Objects flushed from freelist */
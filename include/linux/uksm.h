@@ -11,6 +11,7 @@
 #ifdef CONFIG_UKSM
 
 #include <linux/bitops.h>
+#include <linux/memcontrol.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
@@ -55,6 +56,12 @@ struct vma_slot {
 
 	/* when it has page merged in this eval round */
 	struct list_head dedup_list;
+
+	/* since the slot was created, for the debugfs report */
+	unsigned long total_scanned;
+	unsigned long total_merged;
+	unsigned long total_cowed;
+	u64 scan_ns;
 };
 
 static inline void uksm_unmap_zero_page(pte_t pte)
@@ -71,14 +78,20 @@ static inline void uksm_map_zero_page(pte_t pte)
 
 static inline void uksm_cow_page(struct vm_area_struct *vma, struct page *page)
 {
-	if (vma->uksm_vma_slot && PageKsm(page))
+	if (vma->uksm_vma_slot && PageKsm(page)) {
 		vma->uksm_vma_slot->pages_cowed++;
+		vma->uksm_vma_slot->total_cowed++;
+		mem_cgroup_uksm_account(vma->vm_mm, 0, 1, 0);
+	}
 }
 
 static inline void uksm_cow_pte(struct vm_area_struct *vma, pte_t pte)
 {
-	if (vma->uksm_vma_slot && pte_pfn(pte) == uksm_zero_pfn)
+	if (vma->uksm_vma_slot && pte_pfn(pte) == uksm_zero_pfn) {
 		vma->uksm_vma_slot->pages_cowed++;
+		vma->uksm_vma_slot->total_cowed++;
+		mem_cgroup_uksm_account(vma->vm_mm, 0, 1, 0);
+	}
 }
 
 static inline int uksm_flags_can_scan(unsigned long vm_flags)
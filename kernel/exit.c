@@ -176,6 +176,7 @@ repeat:
 	atomic_dec(&__task_cred(p)->user->processes);
 	rcu_read_unlock();
 
+	lowmem_adj_index_del(p);
 	proc_flush_task(p);
 
 	write_lock_irq(&tasklist_lock);
@@ -314,6 +314,10 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	tsk->btrace_seq = 0;
 #endif
 	tsk->splice_pipe = NULL;
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* Not indexed until lowmem_adj_index_fork(), whatever the parent is */
+	RB_CLEAR_NODE(&tsk->lmk_node);
+#endif
 
 	account_kernel_stack(ti, 1);
 
@@ -1388,6 +1392,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	total_forks++;
 	spin_unlock(&current->sighand->siglock);
 	write_unlock_irq(&tasklist_lock);
+	lowmem_adj_index_fork(p);
 	proc_fork_connector(p);
 	cgroup_post_fork(p);
 	if (clone_flags & CLONE_THREAD)
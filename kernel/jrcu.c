@@ -72,6 +72,8 @@
 #include <linux/compiler.h>
 #include <linux/irqflags.h>
 #include <linux/rcupdate.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
 
 #include <asm/system.h>
 
@@ -135,6 +137,8 @@ struct rcu_data {
        u8 wait;                /* goes false when this cpu consents to
                                 * the retirement of the current batch */
        struct rcu_list cblist[2]; /* current & previous callback lists */
+       u64 first_queued[2];    /* local_clock() when the first callback
+                                * went on each list (stats-n-debug) */
        s64 nqueued;            /* #callbacks queued (stats-n-debug) */
 } ____cacheline_aligned_in_smp;
 
@@ -150,8 +154,20 @@ static struct rcu_stats {
        atomic_t nsyncs;        /* #rcu syncs processed */
        s64 ninvoked;           /* #invoked (ie, finished) callbacks */
        unsigned nforced;       /* #forced eobs (should be zero) */
+       unsigned nidle;         /* #times passes stopped, nothing queued */
+       atomic_t nkicks;        /* #times call_rcu() restarted them */
 } rcu_stats;
 
+/*
+ * Histograms, in power of two buckets, of the time from call_rcu() of
+ * the oldest callback of a batch to the invocation of the batch (usecs),
+ * and of the number of callbacks invoked per batch.
+ */
+#define RCU_HIST_BUCKETS       (24)
+
+static unsigned rcu_gp_hist[RCU_HIST_BUCKETS];
+static unsigned rcu_batch_hist[RCU_HIST_BUCKETS];
+
 #define RCU_HZ                 (20)
 #define RCU_HZ_PERIOD_US       (USEC_PER_SEC / RCU_HZ)
 #define RCU_HZ_DELTA_US                (USEC_PER_SEC / HZ)
@@ -161,6 +177,25 @@ static int rcu_hz_delta_us = RCU_HZ_DELTA_US;
 
 static int rcu_hz_precise;
 
+/*
+ * The period between passes adapts to the number of callbacks queued:
+ * it is 1/RCU_HZ while there are at most rcu_qlow of them, then shrinks
+ * with the backlog down to 1/rcu_hz_max.  With nothing queued there are
+ * no passes at all until call_rcu() queues a callback.
+ */
+#define RCU_HZ_MAX             (1000)
+#define RCU_QLOW               (100)
+
+static int rcu_hz_max = RCU_HZ_MAX;
+static int rcu_hz_min_period_us = USEC_PER_SEC / RCU_HZ_MAX;
+static int rcu_qlow = RCU_QLOW;
+static int rcu_cur_period_us = RCU_HZ_PERIOD_US;
+
+/* Set when passes stopped for lack of callbacks */
+static int rcu_timer_idle;
+
+static void rcu_timer_kick(void);
+
 int rcu_scheduler_active __read_mostly;
 int rcu_nmi_seen __read_mostly;
 
@@ -284,9 +319,15 @@ void call_rcu_sched(struct rcu_head *cb, void (*func)(struct rcu_head *rcu))
 
        /* The following is not NMI-safe, therefore call_rcu()
         * cannot be invoked under NMI. */
+       if (!cblist->head)
+               rd->first_queued[which] = local_clock();
        rcu_list_add(cblist, cb);
        rd->nqueued++;
        smp_mb();
+
+       /* Whoever clears rcu_timer_idle restarts the passes */
+       if (unlikely(ACCESS_ONCE(rcu_timer_idle)) && xchg(&rcu_timer_idle, 0))
+               rcu_timer_kick();
        raw_local_irq_restore(flags);
 }
 EXPORT_SYMBOL_GPL(call_rcu_sched);
@@ -310,6 +351,53 @@ static void rcu_invoke_callbacks(struct rcu_list *pending)
        }
 }
 
+static void rcu_hist_add(unsigned *hist, u64 val)
+{
+       int bucket = 0;
+
+       if (val > 1)
+               bucket = min_t(int, ilog2(val), RCU_HIST_BUCKETS - 1);
+       hist[bucket]++;
+}
+
+/*
+ * Return the period, in usecs, until the next pass, or zero if no
+ * callbacks are queued.  A backlog of n callbacks divides the period by
+ * 1 + n / rcu_qlow, so that the memory held by callbacks waiting for
+ * their grace period stays bounded.
+ */
+static int rcu_next_period_us(void)
+{
+       int cpu, queued = 0, us;
+
+       for_each_present_cpu(cpu) {
+               struct rcu_data *rd = &rcu_data[cpu];
+               queued += rd->cblist[0].count + rd->cblist[1].count;
+       }
+       if (!queued)
+               return 0;
+
+       us = rcu_hz_period_us / (1 + queued / rcu_qlow);
+       rcu_cur_period_us = max(us, rcu_hz_min_period_us);
+       return rcu_cur_period_us;
+}
+
+/*
+ * Called with nothing queued.  Return true if the passes may stop: the
+ * next call_rcu() will restart them.  Return false if a callback was
+ * queued meanwhile and it is up to the caller to go on.
+ */
+static int rcu_go_idle(void)
+{
+       rcu_timer_idle = 1;
+       smp_mb();
+       if (!rcu_next_period_us()) {
+               rcu_stats.nidle++;
+               return 1;
+       }
+       return !xchg(&rcu_timer_idle, 0);
+}
+
 /*
  * Check if the conditions for ending the current batch are true. If
  * so then end it.
@@ -322,7 +410,7 @@ static void rcu_invoke_callbacks(struct rcu_list *pending)
  * "Quiescent" means the owning cpu is no longer appending callbacks
  * and has completed execution of a trailing write-memory-barrier insn.
  */
-static void __rcu_delimit_batches(struct rcu_list *pending)
+static void __rcu_delimit_batches(struct rcu_list *pending, u64 *oldest)
 {
        struct rcu_data *rd;
        struct rcu_list *plist;
@@ -371,7 +459,7 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
                                        force_cpu_resched(cpu);
                        }
                }
-               rcu_wdog_ctr += rcu_hz_period_us;
+               rcu_wdog_ctr += rcu_cur_period_us;
                return;
        }
 
@@ -394,6 +482,8 @@ static void __rcu_delimit_batches(struct rcu_list *pending)
                plist = &rd->cblist[prev];
                /* Chain previous batch of callbacks, if any, to the pending list */
                if (plist->head) {
+                       if (rd->first_queued[prev] < *oldest)
+                               *oldest = rd->first_queued[prev];
                        rcu_list_join(pending, plist);
                        rcu_list_init(plist);
                }
@@ -422,18 +512,27 @@ static void rcu_delimit_batches(void)
 {
        unsigned long flags;
        struct rcu_list pending;
+       u64 oldest = ULLONG_MAX;
+       u64 now;
 
        rcu_list_init(&pending);
        rcu_stats.npasses++;
 
        raw_local_irq_save(flags);
        smp_mb();
-       __rcu_delimit_batches(&pending);
+       __rcu_delimit_batches(&pending, &oldest);
        smp_mb();
        raw_local_irq_restore(flags);
 
-       if (pending.head)
+       if (pending.head) {
                rcu_invoke_callbacks(&pending);
+
+               /* the cpu clocks may be a little apart */
+               now = local_clock();
+               rcu_hist_add(rcu_gp_hist, now > oldest ?
+                       div_u64(now - oldest, NSEC_PER_USEC) : 0);
+               rcu_hist_add(rcu_batch_hist, pending.count);
+       }
 }
 
 /* ------------------ interrupt driver section ------------------ */
@@ -453,21 +552,62 @@ static void rcu_delimit_batches(void)
 
 static struct hrtimer rcu_timer;
 
+#ifdef CONFIG_JRCU_DAEMON
+static struct task_struct *rcu_daemon;
+#endif
+
+/*
+ * Arm the timer for the next pass, unless nothing is queued.  The timer
+ * is re-armed from the softirq rather than from its own handler so that
+ * the period can follow what the pass left queued.
+ */
+static void rcu_timer_rearm(void)
+{
+       int us;
+
+#ifdef CONFIG_JRCU_DAEMON
+       if (rcu_daemon)
+               return;
+#endif
+       us = rcu_next_period_us();
+       if (!us) {
+               if (rcu_go_idle())
+                       return;
+               us = rcu_cur_period_us;
+       }
+       hrtimer_start_range_ns(&rcu_timer, ns_to_ktime((u64)us * NSEC_PER_USEC),
+               rcu_hz_precise ? 0 : rcu_hz_delta_ns, HRTIMER_MODE_REL);
+}
+
 static void rcu_softirq_func(struct softirq_action *h)
 {
        rcu_delimit_batches();
+       rcu_timer_rearm();
 }
 
 static enum hrtimer_restart rcu_timer_func(struct hrtimer *t)
 {
-       ktime_t next;
-
+#ifdef CONFIG_JRCU_DAEMON
+       /* the daemon went idle, the timer only wakes it up */
+       if (rcu_daemon) {
+               wake_up_process(rcu_daemon);
+               return HRTIMER_NORESTART;
+       }
+#endif
        raise_softirq(RCU_SOFTIRQ);
+       return HRTIMER_NORESTART;
+}
 
-       next = ktime_add_ns(ktime_get(), rcu_hz_period_ns);
-       hrtimer_set_expires_range_ns(&rcu_timer, next,
-               rcu_hz_precise ? 0 : rcu_hz_delta_ns);
-       return HRTIMER_RESTART;
+/*
+ * Restart the passes after they stopped for lack of callbacks.  Called
+ * by call_rcu() with interrupts off, from any context, so it must not
+ * wake anything up itself: the timer does that when it fires.
+ */
+static void rcu_timer_kick(void)
+{
+       __hrtimer_start_range_ns(&rcu_timer, ns_to_ktime(rcu_hz_period_ns),
+               rcu_hz_delta_ns, HRTIMER_MODE_REL, 0);
+       atomic_inc(&rcu_stats.nkicks);
 }
 
 static void rcu_timer_start(void)
@@ -498,7 +638,7 @@ void __init rcu_scheduler_starting(void)
 
 #ifndef CONFIG_JRCU_DAEMON
 
-void __init int rcu_start_callback_processing(void)
+static __init int rcu_start_callback_processing(void)
 {
        rcu_timer_start();
        rcu_scheduler_active = 1;
@@ -521,7 +661,6 @@ void __init int rcu_start_callback_processing(void)
 #include <linux/kthread.h>
 
 static int rcu_priority;
-static struct task_struct *rcu_daemon;
 
 static int jrcu_set_priority(int priority)
 {
@@ -545,17 +684,24 @@ static int jrcud_func(void *arg)
 {
        current->flags |= PF_NOFREEZE;
        rcu_priority = jrcu_set_priority(CONFIG_JRCU_DAEMON_PRIO);
+       rcu_daemon = current;
        rcu_timer_stop();
 
        pr_info("JRCU: callback processing via daemon started.\n");
 
        while (!kthread_should_stop()) {
-               if (rcu_hz_precise) {
-                       usleep_range(rcu_hz_period_us,
-                               rcu_hz_period_us);
+               int us = rcu_next_period_us();
+
+               if (!us) {
+                       /* Nothing queued, sleep until call_rcu() kicks us */
+                       set_current_state(TASK_INTERRUPTIBLE);
+                       if (rcu_go_idle() && !kthread_should_stop())
+                               schedule();
+                       __set_current_state(TASK_RUNNING);
+               } else if (rcu_hz_precise) {
+                       usleep_range(us, us);
                } else {
-                       usleep_range(rcu_hz_period_us,
-                               rcu_hz_period_us + rcu_hz_delta_us);
+                       usleep_range(us, us + rcu_hz_delta_us);
                }
                rcu_delimit_batches();
        }
@@ -563,6 +709,7 @@ static int jrcud_func(void *arg)
        pr_info("JRCU: replaced callback daemon with a timer.\n");
 
        rcu_daemon = NULL;
+       rcu_timer_idle = 0;
        rcu_timer_start();
        return 0;
 }
@@ -608,6 +755,10 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
        seq_printf(m, "%14u: hz, %s\n",
                rcu_hz,
                rcu_hz_precise ? "precise" : "sloppy");
+       seq_printf(m, "%14u: hzmax\n", rcu_hz_max);
+       seq_printf(m, "%14u: qlow (#callbacks before speeding up)\n", rcu_qlow);
+       seq_printf(m, "%14u: current period (usecs)%s\n", rcu_cur_period_us,
+               ACCESS_ONCE(rcu_timer_idle) ? ", stopped" : "");
 
        seq_printf(m, "%14u: watchdog (secs)\n", rcu_wdog_lim / (int)USEC_PER_SEC);
        seq_printf(m, "%14d: #secs left on watchdog\n",
@@ -633,6 +784,10 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
                rcu_stats.nlast);
        seq_printf(m, "%14u: #passes forced (0 is best)\n",
                rcu_stats.nforced);
+       seq_printf(m, "%14u: #times passes stopped, nothing queued\n",
+               rcu_stats.nidle);
+       seq_printf(m, "%14u: #times call_rcu restarted them\n",
+               atomic_read(&rcu_stats.nkicks));
 
        seq_printf(m, "\n");
        seq_printf(m, "%14u: #barriers\n",
@@ -670,6 +825,19 @@ static int rcu_debugfs_show(struct seq_file *m, void *unused)
        seq_printf(m, "  I - cpu idle, W - cpu waiting for end-of-batch,\n");
        seq_printf(m, "  * - the current Q, other is the previous Q.\n");
 
+       seq_printf(m, "\n%10s %14s %10s %10s\n",
+               "usecs", "grace periods", "callbacks", "batches");
+       for (q = 0; q < RCU_HIST_BUCKETS; q++) {
+               char label[16];
+
+               if (q < RCU_HIST_BUCKETS - 1)
+                       snprintf(label, sizeof(label), "< %lu", 2UL << q);
+               else
+                       snprintf(label, sizeof(label), ">= %lu", 1UL << q);
+               seq_printf(m, "%10s %14u %10s %10u\n",
+                       label, rcu_gp_hist[q], label, rcu_batch_hist[q]);
+       }
+
        return 0;
 }
 
@@ -715,10 +883,26 @@ next:
        if (!strncmp(token, "hz=", 3)) {
                int rcu_hz_wanted = -1;
                sscanf(&token[3], "%d", &rcu_hz_wanted);
-               if (rcu_hz_wanted < 2 || rcu_hz_wanted > 1000)
+               if (rcu_hz_wanted < 2 || rcu_hz_wanted > rcu_hz_max)
                        return -EINVAL;
                rcu_hz = rcu_hz_wanted;
                rcu_hz_period_us = USEC_PER_SEC / rcu_hz;
+       } else if (!strncmp(token, "hzmax=", 6)) {
+               int hz = -1;
+               sscanf(&token[6], "%d", &hz);
+               if (hz < rcu_hz || hz > 10000)
+                       return -EINVAL;
+               rcu_hz_max = hz;
+               rcu_hz_min_period_us = USEC_PER_SEC / rcu_hz_max;
+       } else if (!strncmp(token, "qlow=", 5)) {
+               int qlow = -1;
+               sscanf(&token[5], "%d", &qlow);
+               if (qlow < 1)
+                       return -EINVAL;
+               rcu_qlow = qlow;
+       } else if (!strcmp(token, "reset")) {
+               memset(rcu_gp_hist, 0, sizeof(rcu_gp_hist));
+               memset(rcu_batch_hist, 0, sizeof(rcu_batch_hist));
        } else if (!strncmp(token, "precise=", 8)) {
                sscanf(&token[8], "%d", &rcu_hz_precise);
        } else if (!strncmp(token, "wdog=", 5)) {
@@ -0,0 +1,135 @@
+/*
+ * LZ4 Compressor
+ *
+ * The LZ4 format and reference implementation are by Yann Collet:
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * LZ4_HASH_MUL) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+/* Emit the literal run [anchor, anchor + run) preceded by its token */
+static inline unsigned char *lz4_put_literals(unsigned char *op,
+		unsigned char **token, const unsigned char *anchor, size_t run)
+{
+	*token = op++;
+	if (run >= RUN_MASK) {
+		**token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, run - RUN_MASK);
+	} else {
+		**token = run << ML_BITS;
+	}
+
+	memcpy(op, anchor, run);
+	return op + run;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char *token;
+
+	if (unlikely(src_len < MFLIMIT + 1))
+		goto last_literals;
+
+	/*
+	 * Positions are stored relative to src; stale or empty slots
+	 * are harmless since every candidate is verified below.
+	 */
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	while (ip <= mflimit) {
+		const unsigned char *ref, *mstart;
+		size_t match_len;
+		u32 seq, h;
+		u16 offset;
+
+		seq = get_unaligned((const u32 *)ip);
+		h = lz4_hash(seq);
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+				get_unaligned((const u32 *)ref) != seq) {
+			/* Step faster the longer we go without a match */
+			ip += 1 + ((ip - anchor) >> LZ4_SKIP_TRIGGER);
+			continue;
+		}
+
+		/* Catch up with preceding literals that also match */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		offset = ip - ref;
+		mstart = ip;
+		ip += MINMATCH;
+		ref += MINMATCH;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+		match_len = ip - mstart - MINMATCH;
+
+		op = lz4_put_literals(op, &token, anchor, mstart - anchor);
+		put_unaligned_le16(offset, op);
+		op += 2;
+
+		if (match_len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, match_len - ML_MASK);
+		} else {
+			*token |= match_len;
+		}
+
+		anchor = ip;
+
+		/* Index a position inside the match to improve ratio */
+		if (ip <= mflimit)
+			hash_table[lz4_hash(get_unaligned((const u32 *)
+				(ip - 2)))] = ip - 2 - src;
+	}
+
+last_literals:
+	op = lz4_put_literals(op, &token, anchor, iend - anchor);
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
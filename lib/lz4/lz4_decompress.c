@@ -0,0 +1,108 @@
+/*
+ * LZ4 Decompressor
+ *
+ * The LZ4 format and reference implementation are by Yann Collet:
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/*
+ * Read a length extension: a run of 255 bytes terminated by a byte
+ * below 255. Returns -1 if the input ends first.
+ */
+static inline int lz4_get_length(const unsigned char **ip,
+		const unsigned char *iend, size_t *len)
+{
+	unsigned char s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return -1;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+
+	for (;;) {
+		const unsigned char *ref;
+		unsigned int token;
+		size_t length, offset;
+
+		if (unlikely(ip >= iend))
+			goto malformed;
+		token = *ip++;
+
+		/* Literal run */
+		length = token >> ML_BITS;
+		if (length == RUN_MASK && lz4_get_length(&ip, iend, &length))
+			goto malformed;
+
+		if (unlikely(length > (size_t)(iend - ip) ||
+				length > (size_t)(oend - op)))
+			goto malformed;
+
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* The last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (unlikely(iend - ip < 2))
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto malformed;
+		ref = op - offset;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK && lz4_get_length(&ip, iend, &length))
+			goto malformed;
+		length += MINMATCH;
+
+		if (unlikely(length > (size_t)(oend - op)))
+			goto malformed;
+
+		if (offset >= length) {
+			memcpy(op, ref, length);
+			op += length;
+		} else {
+			/* Overlapping match replicates the last offset bytes */
+			while (length--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+
+malformed:
+	return -1;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,39 @@
+/*
+ * lz4defs.h -- LZ4 block format constants
+ *
+ * The LZ4 format and reference implementation are by Yann Collet:
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * A sequence is a token byte (literal run length in the high nibble,
+ * match length - MINMATCH in the low nibble), optional run length
+ * extension bytes, the literals, a 16 bit little endian match offset
+ * and optional match length extension bytes.
+ */
+#define MINMATCH	4
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/*
+ * The last match must start at least MFLIMIT bytes before the end of
+ * the block, and the last LASTLITERALS bytes are always literals.
+ */
+#define LASTLITERALS	5
+#define MFLIMIT		(8 + MINMATCH)
+
+/* Hash multiplier, golden ratio prime (2654435761) */
+#define LZ4_HASH_MUL	0x9E3779B1U
+#define LZ4_HASH_SIZE	(1U << LZ4_HASH_LOG)
+
+/* Faster skipping over incompressible data */
+#define LZ4_SKIP_TRIGGER	6
@@ -97,6 +97,11 @@ enum mem_cgroup_events_index {
 	MEM_CGROUP_EVENTS_COUNT,	/* # of pages paged in/out */
 	MEM_CGROUP_EVENTS_PGFAULT,	/* # of page-faults */
 	MEM_CGROUP_EVENTS_PGMAJFAULT,	/* # of major page-faults */
+#ifdef CONFIG_UKSM
+	MEM_CGROUP_EVENTS_UKSM_MERGED,	/* # of pages merged by uksmd */
+	MEM_CGROUP_EVENTS_UKSM_COWED,	/* # of merged pages broken by COW */
+	MEM_CGROUP_EVENTS_UKSM_SCAN_MS,	/* uksmd cpu time spent scanning */
+#endif
 	MEM_CGROUP_EVENTS_NSTATS,
 };
 /*
@@ -872,6 +877,40 @@ out:
 }
 EXPORT_SYMBOL(mem_cgroup_count_vm_event);
 
+#ifdef CONFIG_UKSM
+static void mem_cgroup_uksm_event(struct mem_cgroup *mem,
+				  enum mem_cgroup_events_index idx,
+				  unsigned long val)
+{
+	if (val)
+		this_cpu_add(mem->stat->events[idx], val);
+}
+
+/*
+ * Charge what uksmd did on behalf of @mm to the owner's memcg, so that the
+ * savings of merging and the cpu time it costs can be told apart per group.
+ */
+void mem_cgroup_uksm_account(struct mm_struct *mm, unsigned long merged,
+			     unsigned long cowed, unsigned long scan_ms)
+{
+	struct mem_cgroup *mem;
+
+	if (!mm)
+		return;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (likely(mem)) {
+		mem_cgroup_uksm_event(mem, MEM_CGROUP_EVENTS_UKSM_MERGED,
+				      merged);
+		mem_cgroup_uksm_event(mem, MEM_CGROUP_EVENTS_UKSM_COWED, cowed);
+		mem_cgroup_uksm_event(mem, MEM_CGROUP_EVENTS_UKSM_SCAN_MS,
+				      scan_ms);
+	}
+	rcu_read_unlock();
+}
+#endif
+
 /*
  * Following LRU functions are allowed to be used without PCG_LOCK.
  * Operations are called by routine of global LRU independently from memcg.
@@ -4144,6 +4183,11 @@ enum {
 	MCS_INACTIVE_FILE,
 	MCS_ACTIVE_FILE,
 	MCS_UNEVICTABLE,
+#ifdef CONFIG_UKSM
+	MCS_UKSM_MERGED,
+	MCS_UKSM_COWED,
+	MCS_UKSM_SCAN_MS,
+#endif
 	NR_MCS_STAT,
 };
 
@@ -4167,7 +4211,12 @@ struct {
 	{"active_anon", "total_active_anon"},
 	{"inactive_file", "total_inactive_file"},
 	{"active_file", "total_active_file"},
-	{"unevictable", "total_unevictable"}
+	{"unevictable", "total_unevictable"},
+#ifdef CONFIG_UKSM
+	{"uksm_merged", "total_uksm_merged"},
+	{"uksm_cowed", "total_uksm_cowed"},
+	{"uksm_scan_ms", "total_uksm_scan_ms"},
+#endif
 };
 
 
@@ -4207,6 +4256,15 @@ mem_cgroup_get_local_stat(struct mem_cgroup *mem, struct mcs_total_stat *s)
 	s->stat[MCS_ACTIVE_FILE] += val * PAGE_SIZE;
 	val = mem_cgroup_get_local_zonestat(mem, LRU_UNEVICTABLE);
 	s->stat[MCS_UNEVICTABLE] += val * PAGE_SIZE;
+
+#ifdef CONFIG_UKSM
+	val = mem_cgroup_read_events(mem, MEM_CGROUP_EVENTS_UKSM_MERGED);
+	s->stat[MCS_UKSM_MERGED] += val;
+	val = mem_cgroup_read_events(mem, MEM_CGROUP_EVENTS_UKSM_COWED);
+	s->stat[MCS_UKSM_COWED] += val;
+	val = mem_cgroup_read_events(mem, MEM_CGROUP_EVENTS_UKSM_SCAN_MS);
+	s->stat[MCS_UKSM_SCAN_MS] += val;
+#endif
 }
 
 static void
@@ -3561,6 +3561,13 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* do counter updates before entering really critical section. */
 	check_sync_rss_stat(current);
 
+	/*
+	 * The pages of a killed task are being torn down under it: fail
+	 * instead of handing it zero pages that it could still copy out.
+	 */
+	if (unlikely(test_bit(MMF_LMK_REAPED, &mm->flags)))
+		return VM_FAULT_SIGBUS;
+
 	if (unlikely(is_vm_hugetlb_page(vma)))
 		return hugetlb_fault(mm, vma, address, flags);
 
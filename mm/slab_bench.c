@@ -0,0 +1,321 @@
+/*
+ *  linux/mm/slab_bench.c
+ *
+ *  Throughput and footprint of the slab allocator under kmalloc storms
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#define pr_fmt(fmt) "slab_bench: " fmt
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+/*
+ * Loading this module runs the same kmalloc workloads whichever slab
+ * allocator the kernel was built with, so that SLAB, SLUB and SLQB can be
+ * compared on one device:
+ *
+ *  - storms: nr_objs objects of a size allocated, then all freed, on one
+ *    CPU; plus alloc/free pairs, the hot path. The slab pages the storm
+ *    took and those still held once it was freed come from the global
+ *    NR_SLAB_* counters, so they are only as exact as vmstat and a quiet
+ *    system allow.
+ *  - cross-CPU frees: objects allocated on one CPU and freed on another,
+ *    then allocated again on the first.
+ *  - interrupts: irq_objs GFP_ATOMIC objects allocated and freed from an
+ *    IPI handler.
+ *
+ * Each figure is the average over loops runs. The module never stays
+ * loaded.
+ */
+
+static unsigned int nr_objs = 4096;
+module_param(nr_objs, uint, 0);
+MODULE_PARM_DESC(nr_objs, "Objects per storm (default 4096)");
+
+static unsigned int loops = 16;
+module_param(loops, uint, 0);
+MODULE_PARM_DESC(loops, "Runs averaged per figure (default 16)");
+
+static unsigned int irq_objs = 64;
+module_param(irq_objs, uint, 0);
+MODULE_PARM_DESC(irq_objs, "Objects per interrupt (default 64)");
+
+#define BENCH_OBJS_MAX		(1024 * 1024)
+
+static const unsigned int bench_sizes[] = {
+	8, 16, 32, 64, 96, 128, 192, 256, 512, 1024, 2048, 4096, 8192,
+};
+
+struct bench_run {
+	void **objs;
+	unsigned int nr;
+	unsigned int size;
+	gfp_t gfp;
+	s64 alloc_ns;
+	s64 free_ns;
+	unsigned int failed;
+};
+
+static void bench_alloc(struct bench_run *r)
+{
+	ktime_t t0;
+	int i;
+
+	t0 = ktime_get();
+	for (i = 0; i < r->nr; i++)
+		r->objs[i] = kmalloc(r->size, r->gfp);
+	r->alloc_ns += ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	for (i = 0; i < r->nr; i++)
+		if (!r->objs[i])
+			r->failed++;
+}
+
+static void bench_free(struct bench_run *r)
+{
+	ktime_t t0;
+	int i;
+
+	t0 = ktime_get();
+	for (i = 0; i < r->nr; i++)
+		kfree(r->objs[i]);
+	r->free_ns += ktime_to_ns(ktime_sub(ktime_get(), t0));
+}
+
+static long bench_alloc_fn(void *arg)
+{
+	bench_alloc(arg);
+	return 0;
+}
+
+static long bench_free_fn(void *arg)
+{
+	bench_free(arg);
+	return 0;
+}
+
+/* Allocate and free right away, the pattern the fast paths are built for */
+static long bench_pair_fn(void *arg)
+{
+	struct bench_run *r = arg;
+	ktime_t t0;
+	void *p;
+	int i;
+
+	t0 = ktime_get();
+	for (i = 0; i < r->nr; i++) {
+		p = kmalloc(r->size, r->gfp);
+		if (!p)
+			r->failed++;
+		kfree(p);
+	}
+	r->alloc_ns += ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+	return 0;
+}
+
+static void bench_irq_fn(void *arg)
+{
+	bench_alloc(arg);
+	bench_free(arg);
+}
+
+static unsigned long bench_slab_pages(void)
+{
+	return global_page_state(NR_SLAB_RECLAIMABLE) +
+		global_page_state(NR_SLAB_UNRECLAIMABLE);
+}
+
+static unsigned int bench_per_op(s64 ns, unsigned int nr)
+{
+	u64 ops = (u64)nr * loops;
+
+	return ops ? div64_s64(ns, ops) : 0;
+}
+
+static void bench_init_run(struct bench_run *r, void **objs,
+			   unsigned int nr, unsigned int size, gfp_t gfp)
+{
+	memset(r, 0, sizeof(*r));
+	r->objs = objs;
+	r->nr = nr;
+	r->size = size;
+	r->gfp = gfp;
+}
+
+static unsigned int bench_storms(void **objs, int cpu)
+{
+	struct bench_run r, pair;
+	unsigned long base, used, held;
+	unsigned int failed = 0;
+	int i, j;
+
+	pr_info("kmalloc storms of %u objects on CPU%d, ns per operation\n",
+		nr_objs, cpu);
+	pr_info("%8s %7s %7s %7s %7s %9s %8s\n", "size", "alloc", "free",
+		"pair", "pages", "overhead%", "retained");
+
+	for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+		unsigned int size = bench_sizes[i];
+
+		bench_init_run(&r, objs, nr_objs, size, GFP_KERNEL);
+		bench_init_run(&pair, NULL, nr_objs, size, GFP_KERNEL);
+
+		base = bench_slab_pages();
+		used = 0;
+		for (j = 0; j < loops; j++) {
+			work_on_cpu(cpu, bench_alloc_fn, &r);
+			if (!j)
+				used = bench_slab_pages() - base;
+			work_on_cpu(cpu, bench_free_fn, &r);
+			cond_resched();
+		}
+		held = bench_slab_pages() - base;
+		/* The counters are approximate, don't report noise below 0 */
+		if ((long)used < 0)
+			used = 0;
+		if ((long)held < 0)
+			held = 0;
+
+		for (j = 0; j < loops; j++) {
+			work_on_cpu(cpu, bench_pair_fn, &pair);
+			cond_resched();
+		}
+
+		pr_info("%8u %7u %7u %7u %7lu %9llu %8lu\n", size,
+			bench_per_op(r.alloc_ns, nr_objs),
+			bench_per_op(r.free_ns, nr_objs),
+			bench_per_op(pair.alloc_ns, nr_objs), used,
+			div64_u64((u64)used * PAGE_SIZE * 100,
+				  (u64)nr_objs * size),
+			held);
+		failed += r.failed + pair.failed;
+	}
+
+	return failed;
+}
+
+static unsigned int bench_cross(void **objs, int cpu, int other)
+{
+	struct bench_run r, again;
+	unsigned int failed = 0;
+	int i, j;
+
+	pr_info("cross-CPU frees, allocated on CPU%d and freed on CPU%d, "
+		"ns per operation\n", cpu, other);
+	pr_info("%8s %7s %7s %7s\n", "size", "alloc", "rfree", "realloc");
+
+	for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+		unsigned int size = bench_sizes[i];
+
+		bench_init_run(&r, objs, nr_objs, size, GFP_KERNEL);
+		bench_init_run(&again, objs, nr_objs, size, GFP_KERNEL);
+
+		for (j = 0; j < loops; j++) {
+			work_on_cpu(cpu, bench_alloc_fn, &r);
+			work_on_cpu(other, bench_free_fn, &r);
+			/* What the remote frees left for the first CPU */
+			work_on_cpu(cpu, bench_alloc_fn, &again);
+			work_on_cpu(cpu, bench_free_fn, &again);
+			cond_resched();
+		}
+
+		pr_info("%8u %7u %7u %7u\n", size,
+			bench_per_op(r.alloc_ns, nr_objs),
+			bench_per_op(r.free_ns, nr_objs),
+			bench_per_op(again.alloc_ns, nr_objs));
+		failed += r.failed + again.failed;
+	}
+
+	return failed;
+}
+
+static unsigned int bench_irq(void **objs)
+{
+	struct bench_run r;
+	unsigned int failed = 0;
+	int i, j, cpu, target;
+
+	cpu = get_cpu();
+	target = cpumask_any_but(cpu_online_mask, cpu);
+	if (target >= nr_cpu_ids)
+		target = cpu;
+	put_cpu();
+
+	pr_info("kmalloc(GFP_ATOMIC) from IPIs on CPU%d, %u objects each, "
+		"ns per operation\n", target, irq_objs);
+	pr_info("%8s %7s %7s\n", "size", "alloc", "free");
+
+	for (i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+		unsigned int size = bench_sizes[i];
+
+		bench_init_run(&r, objs, irq_objs, size, GFP_ATOMIC);
+
+		for (j = 0; j < loops; j++) {
+			smp_call_function_single(target, bench_irq_fn, &r, 1);
+			cond_resched();
+		}
+
+		pr_info("%8u %7u %7u\n", size,
+			bench_per_op(r.alloc_ns, irq_objs),
+			bench_per_op(r.free_ns, irq_objs));
+		failed += r.failed;
+	}
+
+	return failed;
+}
+
+static int __init slab_bench_init(void)
+{
+	unsigned int failed;
+	void **objs;
+	int cpu, other;
+
+	if (!nr_objs || nr_objs > BENCH_OBJS_MAX || !loops ||
+	    !irq_objs || irq_objs > nr_objs)
+		return -EINVAL;
+
+	objs = vmalloc(nr_objs * sizeof(void *));
+	if (!objs)
+		return -ENOMEM;
+
+	get_online_cpus();
+	cpu = cpumask_first(cpu_online_mask);
+	other = cpumask_next(cpu, cpu_online_mask);
+
+	failed = bench_storms(objs, cpu);
+	if (other < nr_cpu_ids)
+		failed += bench_cross(objs, cpu, other);
+	else
+		pr_info("one CPU online, no cross-CPU frees\n");
+	put_online_cpus();
+
+	failed += bench_irq(objs);
+	if (failed)
+		pr_warning("%u allocations failed, results are not valid\n",
+			   failed);
+
+	vfree(objs);
+
+	/* Nothing to keep around, refuse to stay loaded */
+	return -EAGAIN;
+}
+
+module_init(slab_bench_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab allocator benchmark");
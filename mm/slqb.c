@@ -1515,7 +1515,9 @@ try_remote:
 	VM_BUG_ON(!c);
 	l = &c->list;
 	object = __cache_list_get_object(s, l);
-	if (unlikely(!object)) {
+	if (likely(object)) {
+		slqb_stat_inc(l, ALLOC_HIT);
+	} else {
 #ifdef CONFIG_NUMA
 		int thisnode = numa_node_id();
 
@@ -1767,6 +1769,8 @@ static __always_inline void __slab_free(struct kmem_cache *s,
 
 		if (unlikely(l->freelist.nr > slab_hiwater(s)))
 			flush_free_list(s, l);
+		else
+			slqb_stat_inc(l, FREE_HIT);
 
 	} else {
 #ifdef CONFIG_SMP
@@ -3313,11 +3317,20 @@ ssize_t slabinfo_write(struct file *file, const char __user * buffer,
 
 static void print_slabinfo_header(struct seq_file *m)
 {
+#ifdef CONFIG_SLQB_STATS
+	seq_puts(m, "slabinfo - version: 2.1 (statistics)\n");
+#else
 	seq_puts(m, "slabinfo - version: 2.1\n");
+#endif
 	seq_puts(m, "# name	    <active_objs> <num_objs> <objsize> "
 		 "<objperslab> <pagesperslab>");
 	seq_puts(m, " : tunables <limit> <batchcount> <sharedfactor>");
 	seq_puts(m, " : slabdata <active_slabs> <num_slabs> <sharedavail>");
+#ifdef CONFIG_SLQB_STATS
+	seq_puts(m, " : cpustat <allochit> <allocmiss> <freehit> <freemiss>");
+	seq_puts(m, " : remotestat <remotefrees> <rfreeflushes> "
+		 "<claims> <claimedobjs> <newslabs> <freedslabs>");
+#endif
 	seq_putc(m, '\n');
 }
 
@@ -3357,6 +3370,25 @@ static int s_show(struct seq_file *m, void *p)
 			slab_freebatch(s), 0);
 	seq_printf(m, " : slabdata %6lu %6lu %6lu", stats.nr_slabs,
 			stats.nr_slabs, 0UL);
+#ifdef CONFIG_SLQB_STATS
+	/*
+	 * Like SLAB's cpustat: a miss is an allocation that had to go to the
+	 * slab pages, or a free that overflowed the freelist and flushed it.
+	 */
+	seq_printf(m, " : cpustat %6lu %6lu %6lu %6lu",
+			stats.stats[ALLOC_HIT],
+			stats.stats[ALLOC] - stats.stats[ALLOC_HIT],
+			stats.stats[FREE_HIT],
+			stats.stats[FREE] - stats.stats[FREE_REMOTE] -
+			stats.stats[FREE_HIT]);
+	seq_printf(m, " : remotestat %6lu %6lu %6lu %6lu %4lu %4lu",
+			stats.stats[FREE_REMOTE],
+			stats.stats[FLUSH_RFREE_LIST],
+			stats.stats[CLAIM_REMOTE_LIST],
+			stats.stats[CLAIM_REMOTE_LIST_OBJECTS],
+			stats.stats[ALLOC_SLAB_NEW],
+			stats.stats[FLUSH_SLAB_FREE]);
+#endif
 	seq_putc(m, '\n');
 	return 0;
 }
@@ -3622,9 +3654,11 @@ static ssize_t text##_show(struct kmem_cache *s, char *buf)	\
 SLAB_ATTR_RO(text);						\
 
 STAT_ATTR(ALLOC, alloc);
+STAT_ATTR(ALLOC_HIT, alloc_hit);
 STAT_ATTR(ALLOC_SLAB_FILL, alloc_slab_fill);
 STAT_ATTR(ALLOC_SLAB_NEW, alloc_slab_new);
 STAT_ATTR(FREE, free);
+STAT_ATTR(FREE_HIT, free_hit);
 STAT_ATTR(FREE_REMOTE, free_remote);
 STAT_ATTR(FLUSH_FREE_LIST, flush_free_list);
 STAT_ATTR(FLUSH_FREE_LIST_OBJECTS, flush_free_list_objects);
@@ -3660,9 +3694,11 @@ static struct attribute *slab_attrs[] = {
 #endif
 #ifdef CONFIG_SLQB_STATS
 	&alloc_attr.attr,
+	&alloc_hit_attr.attr,
 	&alloc_slab_fill_attr.attr,
 	&alloc_slab_new_attr.attr,
 	&free_attr.attr,
+	&free_hit_attr.attr,
 	&free_remote_attr.attr,
 	&flush_free_list_attr.attr,
 	&flush_free_list_objects_attr.attr,
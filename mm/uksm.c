@@ -68,6 +68,14 @@
 #include <linux/math64.h>
 #include <linux/gcd.h>
 #include <linux/freezer.h>
+#include <linux/prefetch.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/pid_namespace.h>
+#include <linux/memcontrol.h>
+#ifdef CONFIG_HAS_EARLYSUSPEND
+#include <linux/earlysuspend.h>
+#endif
 #include <linux/sradix-tree.h>
 
 #include <asm/tlbflush.h>
@@ -519,7 +527,21 @@ static unsigned int uksm_max_cpu_percentage;
 
 static int uksm_cpu_governor;
 
-static char *uksm_cpu_governor_str[4] = { "full", "medium", "low", "quiet" };
+static char *uksm_cpu_governor_str[5] = { "full", "medium", "low", "quiet",
+					  "budget" };
+
+/*
+ * The "budget" governor: uksmd gets at most uksm_cpu_budget percent of one
+ * cpu, runs at SCHED_IDLE so that it only takes cpu nobody else wants, and
+ * does not scan at all while the system is early suspended.
+ */
+#define UKSM_GOVERNOR_BUDGET	4
+
+/* Percentage of one cpu the budget governor allows uksmd to use */
+static unsigned int uksm_cpu_budget = 5;
+
+/* Set from early suspend until late resume */
+static int uksm_early_suspended;
 
 struct uksm_cpu_preset_s {
 	int cpu_ratio[SCAN_LADDER_SIZE];
@@ -527,11 +549,13 @@ struct uksm_cpu_preset_s {
 	unsigned int max_cpu; /* percentage */
 };
 
-struct uksm_cpu_preset_s uksm_cpu_preset[4] = {
+struct uksm_cpu_preset_s uksm_cpu_preset[5] = {
 	{ {20, 40, -2500, -10000}, {1000, 500, 200, 50}, 95},
 	{ {20, 30, -2500, -10000}, {1000, 500, 400, 100}, 50},
 	{ {10, 20, -5000, -10000}, {1500, 1000, 1000, 250}, 20},
 	{ {10, 20, 40, 75}, {2000, 1000, 1000, 1000}, 1},
+	/* every rung relative to max_cpu, which follows uksm_cpu_budget */
+	{ {-1000, -2500, -5000, -10000}, {1500, 1000, 1000, 250}, 5},
 };
 
 /* The default value for uksm_ema_page_time if it's not initialized */
@@ -1166,12 +1190,37 @@ void uksm_remove_vma(struct vm_area_struct *vma)
 #define shiftl	8
 #define shiftr	12
 
+/* Pages looked up, then hashed together, under one mmap_sem hold */
+#define UKSM_SCAN_BATCH		4
+
+/* How many samples ahead of the hashing the batch hash prefetches */
+#define HASH_PREFETCH_AHEAD	8
+
+/*
+ * A page picked by get_next_scan_page() and waiting in a scan batch to be
+ * hashed. Its rmap_list_entry stays mapped until finish_scan_page().
+ */
+struct scan_page {
+	struct rmap_list_entry *entry;
+	unsigned long index;
+	unsigned long addr;
+	struct page *page;
+	u32 hash;
+};
+
+#define HASH_SEED	0xdeadbeef
+
+#define HASH_STEP(hash, word)				\
+do {							\
+	hash += (word);					\
+	hash += (hash << shiftl);			\
+	hash ^= (hash >> shiftr);			\
+} while (0)
+
 #define HASH_FROM_TO(from, to) 				\
 for (index = from; index < to; index++) {		\
 	pos = random_nums[index];			\
-	hash += key[pos];				\
-	hash += (hash << shiftl);			\
-	hash ^= (hash >> shiftr);			\
+	HASH_STEP(hash, key[pos]);			\
 }
 
 
@@ -1190,7 +1239,7 @@ for (index = from - 1; index >= to; index--) {		\
  */
 static u32 random_sample_hash(void *addr, u32 hash_strength)
 {
-	u32 hash = 0xdeadbeef;
+	u32 hash = HASH_SEED;
 	int index, pos, loop = hash_strength;
 	u32 *key = (u32 *)addr;
 
@@ -1325,27 +1374,100 @@ static inline void inc_rshash_neg(unsigned long delta)
 }
 
 
+/* Account the time saved by hashing a page instead of comparing it */
+static inline void account_page_hash(unsigned long hash_strength)
+{
+	unsigned long delta;
+
+	if (HASH_STRENGTH_FULL > hash_strength)
+		delta = HASH_STRENGTH_FULL - hash_strength;
+	else
+		delta = 0;
+
+	inc_rshash_pos(delta);
+}
+
 static inline u32 page_hash(struct page *page, unsigned long hash_strength,
 			    int cost_accounting)
 {
 	u32 val;
-	unsigned long delta;
 
 	void *addr = kmap_atomic(page, KM_USER0);
 
 	val = random_sample_hash(addr, hash_strength);
 	kunmap_atomic(addr, KM_USER0);
 
-	if (cost_accounting) {
-		if (HASH_STRENGTH_FULL > hash_strength)
-			delta = HASH_STRENGTH_FULL - hash_strength;
-		else
-			delta = 0;
+	if (cost_accounting)
+		account_page_hash(hash_strength);
+
+	return val;
+}
 
-		inc_rshash_pos(delta);
+/*
+ * Hash UKSM_SCAN_BATCH pages in one pass: each sample position is loaded
+ * once for all of them and their hashes advance in lockstep, so that the
+ * cache misses of the different pages overlap instead of being taken one
+ * after the other. The words HASH_PREFETCH_AHEAD samples later are
+ * prefetched, for the in-order cores that would otherwise stall on every
+ * miss. The result is the same as random_sample_hash() on each page.
+ */
+static void random_sample_hash_batch(u32 **key, u32 *hash, int from, int to)
+{
+	u32 h0 = hash[0], h1 = hash[1], h2 = hash[2], h3 = hash[3];
+	int index, pos;
+
+	for (index = from; index < to; index++) {
+		if (index + HASH_PREFETCH_AHEAD < to) {
+			pos = random_nums[index + HASH_PREFETCH_AHEAD];
+			prefetch(key[0] + pos);
+			prefetch(key[1] + pos);
+			prefetch(key[2] + pos);
+			prefetch(key[3] + pos);
+		}
+
+		pos = random_nums[index];
+		HASH_STEP(h0, key[0][pos]);
+		HASH_STEP(h1, key[1][pos]);
+		HASH_STEP(h2, key[2][pos]);
+		HASH_STEP(h3, key[3][pos]);
 	}
 
-	return val;
+	hash[0] = h0;
+	hash[1] = h1;
+	hash[2] = h2;
+	hash[3] = h3;
+}
+
+/* Hash the pages of a scan batch into their ->hash */
+static void page_hash_batch(struct scan_page *batch, int nr,
+			    u32 hash_strength)
+{
+	u32 *key[UKSM_SCAN_BATCH];
+	u32 hash[UKSM_SCAN_BATCH];
+	int i, loop;
+
+	if (nr != UKSM_SCAN_BATCH) {
+		for (i = 0; i < nr; i++)
+			batch[i].hash = page_hash(batch[i].page,
+						  hash_strength, 0);
+		return;
+	}
+
+	for (i = 0; i < UKSM_SCAN_BATCH; i++) {
+		key[i] = kmap_atomic(batch[i].page);
+		hash[i] = HASH_SEED;
+	}
+
+	loop = min_t(u32, hash_strength, HASH_STRENGTH_FULL);
+	random_sample_hash_batch(key, hash, 0, loop);
+	if (hash_strength > HASH_STRENGTH_FULL)
+		random_sample_hash_batch(key, hash, 0,
+					 hash_strength - HASH_STRENGTH_FULL);
+
+	for (i = UKSM_SCAN_BATCH - 1; i >= 0; i--) {
+		kunmap_atomic(key[i]);
+		batch[i].hash = hash[i];
+	}
 }
 
 static int memcmp_pages(struct page *page1, struct page *page2,
@@ -2557,6 +2679,8 @@ node_vma_ok: /* ok, ready to add to the list */
 	hold_anon_vma(rmap_item, rmap_item->slot->vma->anon_vma);
 	if (logdedup) {
 		rmap_item->slot->pages_merged++;
+		rmap_item->slot->total_merged++;
+		mem_cgroup_uksm_account(rmap_item->slot->mm, 1, 0, 0);
 		if (cont_p) {
 			hlist_for_each_entry_continue(node_vma,
 						      cont_p, hlist) {
@@ -3160,15 +3284,16 @@ static inline int vma_fully_scanned(struct vma_slot *slot)
 }
 
 /**
- * get_next_rmap_item() - Get the next rmap_item in a vma_slot according to
- * its random permutation. This function is embedded with the random
- * permutation index management code.
+ * get_next_scan_page() - Get the next page in a vma_slot according to its
+ * random permutation. This function is embedded with the random permutation
+ * index management code.
+ *
+ * return 1 if @sp holds a page to hash, 0 if there was no page to scan.
  */
-static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
+static int get_next_scan_page(struct vma_slot *slot, struct scan_page *sp)
 {
 	unsigned long rand_range, addr, swap_index, scan_index;
-	struct rmap_item *item = NULL;
-	struct rmap_list_entry *scan_entry, *swap_entry = NULL;
+	struct rmap_list_entry *scan_entry, *swap_entry;
 	struct page *page;
 
 	scan_index = swap_index = slot->pages_scanned % slot->pages;
@@ -3187,7 +3312,7 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 
 	scan_entry = get_rmap_list_entry(slot, scan_index, 1);
 	if (!scan_entry)
-		return NULL;
+		return 0;
 
 	if (entry_is_new(scan_entry)) {
 		scan_entry->addr = get_index_orig_addr(slot, scan_index);
@@ -3208,10 +3333,10 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 			set_is_addr(swap_entry->addr);
 		}
 		swap_entries(scan_entry, scan_index, swap_entry, swap_index);
+		put_rmap_list_entry(slot, swap_index);
 	}
 
 	addr = get_entry_address(scan_entry);
-	item = get_entry_item(scan_entry);
 	BUG_ON(addr > slot->vma->vm_end || addr < slot->vma->vm_start);
 
 	page = follow_page(slot->vma, addr, FOLL_GET);
@@ -3229,13 +3354,42 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 	flush_anon_page(slot->vma, page, addr);
 	flush_dcache_page(page);
 
+	sp->entry = scan_entry;
+	sp->index = scan_index;
+	sp->addr = addr;
+	sp->page = page;
+	return 1;
+
+putpage:
+	put_page(page);
+nopage:
+	/* no page, store addr back and free rmap_item if possible */
+	free_entry_item(scan_entry);
+	put_rmap_list_entry(slot, scan_index);
+	return 0;
+}
 
-	*hash = page_hash(page, hash_strength, 1);
+/**
+ * finish_scan_page() - Account the hash of a page picked by
+ * get_next_scan_page(), merge it with the zero page if it is empty and
+ * return its rmap_item. The rmap_item holds the page reference; NULL is
+ * returned if the page has been dropped.
+ */
+static struct rmap_item *finish_scan_page(struct vma_slot *slot,
+					  struct scan_page *sp)
+{
+	struct rmap_list_entry *entry = sp->entry;
+	struct rmap_item *item = get_entry_item(entry);
+	struct page *page = sp->page;
+
+	account_page_hash(hash_strength);
 	inc_uksm_pages_scanned();
 	/*if the page content all zero, re-map to zero-page*/
-	if (find_zero_page_hash(hash_strength, *hash)) {
+	if (find_zero_page_hash(hash_strength, sp->hash)) {
 		if (!cmp_and_merge_zero_page(slot->vma, page)) {
 			slot->pages_merged++;
+			slot->total_merged++;
+			mem_cgroup_uksm_account(slot->mm, 1, 0, 0);
 			__inc_zone_page_state(page, NR_UKSM_ZERO_PAGES);
 			dec_mm_counter(slot->mm, MM_ANONPAGES);
 
@@ -3251,10 +3405,10 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 		if (item) {
 			/* It has already been zeroed */
 			item->slot = slot;
-			item->address = addr;
-			item->entry_index = scan_index;
-			scan_entry->item = item;
-			inc_rmap_list_pool_count(slot, scan_index);
+			item->address = sp->addr;
+			item->entry_index = sp->index;
+			entry->item = item;
+			inc_rmap_list_pool_count(slot, sp->index);
 		} else
 			goto putpage;
 	}
@@ -3262,20 +3416,13 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 	BUG_ON(item->slot != slot);
 	/* the page may have changed */
 	item->page = page;
-	put_rmap_list_entry(slot, scan_index);
-	if (swap_entry)
-		put_rmap_list_entry(slot, swap_index);
+	put_rmap_list_entry(slot, sp->index);
 	return item;
 
 putpage:
 	put_page(page);
-	page = NULL;
-nopage:
-	/* no page, store addr back and free rmap_item if possible */
-	free_entry_item(scan_entry);
-	put_rmap_list_entry(slot, scan_index);
-	if (swap_entry)
-		put_rmap_list_entry(slot, swap_index);
+	free_entry_item(entry);
+	put_rmap_list_entry(slot, sp->index);
 	return NULL;
 }
 
@@ -3284,38 +3431,79 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 	return rmap_item->address & STABLE_FLAG;
 }
 
+static inline void slot_page_scanned(struct vma_slot *slot)
+{
+	slot->pages_scanned++;
+	slot->total_scanned++;
+	if (slot->fully_scanned_round != fully_scanned_round)
+		scanned_virtual_pages++;
+
+	if (vma_fully_scanned(slot))
+		slot->fully_scanned_round = fully_scanned_round;
+}
+
+/*
+ * Whether the next page of @slot can join a scan batch. The entries of a
+ * batch stay mapped until it is finished, so the batch must end before
+ * the scan index wraps around, which may sort the entries, and before it
+ * crosses into another pool page, which may free the previous one.
+ */
+static inline int scan_batch_can_grow(struct vma_slot *slot)
+{
+	unsigned long index = slot->pages_scanned;
+
+	return index < slot->pages && !pool_entry_boundary(index);
+}
+
 /**
- * scan_vma_one_page() - scan the next page in a vma_slot. Called with
+ * scan_vma_pages() - scan up to @nr next pages in a vma_slot. The pages are
+ * looked up first and hashed together, then merged one by one. Called with
  * mmap_sem locked.
+ *
+ * return the number of pages scanned, at least one.
  */
-static noinline void scan_vma_one_page(struct vma_slot *slot)
+static noinline int scan_vma_pages(struct vma_slot *slot, int nr)
 {
-	u32 hash;
-	struct mm_struct *mm;
-	struct rmap_item *rmap_item = NULL;
-	struct vm_area_struct *vma = slot->vma;
+	struct scan_page batch[UKSM_SCAN_BATCH];
+	struct rmap_item *rmap_item;
+	int i, n = 0, scanned = 0;
 
-	mm = vma->vm_mm;
-	BUG_ON(!mm);
 	BUG_ON(!slot);
+	BUG_ON(!slot->vma->vm_mm);
 
-	rmap_item = get_next_rmap_item(slot, &hash);
-	if (!rmap_item)
-		goto out1;
+	if (nr > UKSM_SCAN_BATCH)
+		nr = UKSM_SCAN_BATCH;
 
-	if (PageKsm(rmap_item->page) && in_stable_tree(rmap_item))
-		goto out2;
+	do {
+		if (get_next_scan_page(slot, &batch[n]))
+			n++;
+		slot_page_scanned(slot);
+		scanned++;
+	} while (scanned < nr && scan_batch_can_grow(slot));
 
-	cmp_and_merge_page(rmap_item, hash);
-out2:
-	put_page(rmap_item->page);
-out1:
-	slot->pages_scanned++;
-	if (slot->fully_scanned_round != fully_scanned_round)
-		scanned_virtual_pages++;
+	page_hash_batch(batch, n, hash_strength);
 
-	if (vma_fully_scanned(slot))
-		slot->fully_scanned_round = fully_scanned_round;
+	for (i = 0; i < n; i++) {
+		rmap_item = finish_scan_page(slot, &batch[i]);
+		if (!rmap_item)
+			continue;
+
+		/*
+		 * An earlier page of the batch may have been merged with this
+		 * one, which leaves us holding a page that is no longer mapped
+		 * here: leave it to the next round.
+		 */
+		if (i && follow_page(slot->vma, batch[i].addr, 0) !=
+			 batch[i].page)
+			goto put;
+
+		if (!PageKsm(rmap_item->page) || !in_stable_tree(rmap_item))
+			cmp_and_merge_page(rmap_item, batch[i].hash);
+put:
+		put_page(batch[i].page);
+	}
+
+	return scanned;
 }
 
 static inline unsigned long rung_get_pages(struct scan_rung *rung)
@@ -4392,6 +4580,19 @@ static inline int hash_round_finished(void)
 #define UKSM_MMSEM_BATCH	5
 #define BUSY_RETRY		100
 
+/*
+ * Add @ns of scanning to the slot, and charge the whole milliseconds it
+ * completes to the memcg of the slot's mm.
+ */
+static inline void slot_account_scan(struct vma_slot *slot, u64 ns)
+{
+	u64 before = div_u64(slot->scan_ns, NSEC_PER_MSEC);
+
+	slot->scan_ns += ns;
+	mem_cgroup_uksm_account(slot->mm, 0, 0,
+			div_u64(slot->scan_ns, NSEC_PER_MSEC) - before);
+}
+
 /**
  * uksm_do_scan()  - the main worker function.
  */
@@ -4400,8 +4601,9 @@ static noinline void uksm_do_scan(void)
 	struct vma_slot *slot, *iter;
 	struct mm_struct *busy_mm;
 	unsigned char round_finished, all_rungs_emtpy;
-	int i, err, mmsem_batch;
-	unsigned long pcost;
+	int i, err, mmsem_batch, done;
+	unsigned long pcost, nr;
+	u64 scan_start;
 	long long delta_exec;
 	unsigned long vpages, max_cpu_ratio;
 	unsigned long long start_time, end_time, scan_time;
@@ -4488,15 +4690,25 @@ rm_slot:
 				goto rm_slot;
 			}
 
-			if (mmsem_batch)
-				mmsem_batch--;
-			else
-				mmsem_batch = UKSM_MMSEM_BATCH;
+			if (!mmsem_batch)
+				mmsem_batch = UKSM_MMSEM_BATCH + 1;
 
-			/* Ok, we have take the mmap_sem, ready to scan */
-			scan_vma_one_page(slot);
-			rung->pages_to_scan--;
-			vpages++;
+			/*
+			 * Ok, we have take the mmap_sem, ready to scan as many
+			 * pages as the rung quota, the rung step over this slot
+			 * and the mmap_sem batch allow.
+			 */
+			nr = min3(rung->pages_to_scan,
+				  (slot->pages - 1 - rung->current_offset) /
+				  rung->step + 1,
+				  (unsigned long)mmsem_batch);
+			scan_start = local_clock();
+			done = scan_vma_pages(slot, nr);
+			slot_account_scan(slot, local_clock() - scan_start);
+			rung->pages_to_scan -= done;
+			vpages += done;
+			mmsem_batch -= done;
+			rung->current_offset += rung->step * (done - 1);
 
 			if (rung->current_offset + rung->step > slot->pages - 1
 			    || vma_fully_scanned(slot)) {
@@ -4582,8 +4794,25 @@ rm_slot:
 
 	uksm_calc_scan_pages();
 	uksm_sleep_real = uksm_sleep_jiffies;
-	/* in case of radical cpu bursts, apply the upper bound */
 	end_time = task_sched_runtime(current);
+
+	/*
+	 * The budget is a hard limit: sleep long enough for the whole round
+	 * to fit in it, without the responsiveness bound below.
+	 */
+	if (uksm_cpu_governor == UKSM_GOVERNOR_BUDGET &&
+	    end_time > start_time) {
+		scan_time = end_time - start_time;
+		expected_jiffies = msecs_to_jiffies(scan_time_to_sleep(scan_time,
+				uksm_cpu_budget * (TIME_RATIO_SCALE / 100)));
+
+		if (expected_jiffies > uksm_sleep_real)
+			uksm_sleep_real = expected_jiffies;
+
+		return;
+	}
+
+	/* in case of radical cpu bursts, apply the upper bound */
 	if (max_cpu_ratio && end_time > start_time) {
 		scan_time = end_time - start_time;
 		expected_jiffies = msecs_to_jiffies(
@@ -4602,15 +4831,42 @@ rm_slot:
 
 static int ksmd_should_run(void)
 {
+	if (uksm_cpu_governor == UKSM_GOVERNOR_BUDGET && uksm_early_suspended)
+		return 0;
+
 	return uksm_run & UKSM_RUN_MERGE;
 }
 
+/*
+ * Under the budget governor uksmd runs at SCHED_BATCH and nice 19, so that
+ * it rarely delays foreground work. Not SCHED_IDLE: uksmd holds mmap_sem
+ * and uksm_thread_mutex while it scans, and a holder starved by a busy
+ * CPU would stall the faults and writers waiting on them.
+ */
+static void uksm_update_sched_policy(void)
+{
+	static int batch_policy;
+	struct sched_param param = { .sched_priority = 0 };
+	int want_batch = uksm_cpu_governor == UKSM_GOVERNOR_BUDGET;
+
+	if (want_batch == batch_policy)
+		return;
+
+	sched_setscheduler_nocheck(current,
+				   want_batch ? SCHED_BATCH : SCHED_NORMAL,
+				   &param);
+	set_user_nice(current, want_batch ? 19 : 5);
+	batch_policy = want_batch;
+}
+
 static int uksm_scan_thread(void *nothing)
 {
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
+		uksm_update_sched_policy();
+
 		mutex_lock(&uksm_thread_mutex);
 		if (ksmd_should_run()) {
 			uksm_do_scan();
@@ -4630,6 +4886,24 @@ static int uksm_scan_thread(void *nothing)
 	return 0;
 }
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void uksm_early_suspend(struct early_suspend *h)
+{
+	uksm_early_suspended = 1;
+}
+
+static void uksm_late_resume(struct early_suspend *h)
+{
+	uksm_early_suspended = 0;
+	wake_up_interruptible(&uksm_thread_wait);
+}
+
+static struct early_suspend uksm_early_suspend_desc = {
+	.suspend = uksm_early_suspend,
+	.resume = uksm_late_resume,
+};
+#endif
+
 int page_referenced_ksm(struct page *page, struct mem_cgroup *memcg,
 			unsigned long *vm_flags)
 {
@@ -4988,7 +5262,10 @@ static inline void init_performance_values(void)
 		rung->cover_msecs = preset->cover_msecs[i];
 	}
 
-	uksm_max_cpu_percentage = preset->max_cpu;
+	if (uksm_cpu_governor == UKSM_GOVERNOR_BUDGET)
+		uksm_max_cpu_percentage = uksm_cpu_budget;
+	else
+		uksm_max_cpu_percentage = preset->max_cpu;
 }
 
 static ssize_t cpu_governor_store(struct kobject *kobj,
@@ -5010,10 +5287,38 @@ static ssize_t cpu_governor_store(struct kobject *kobj,
 
 	init_performance_values();
 
+	/* uksmd may be waiting out an early suspend under the old one */
+	wake_up_interruptible(&uksm_thread_wait);
+
 	return count;
 }
 UKSM_ATTR(cpu_governor);
 
+static ssize_t cpu_budget_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_cpu_budget);
+}
+
+static ssize_t cpu_budget_store(struct kobject *kobj,
+				struct kobj_attribute *attr,
+				const char *buf, size_t count)
+{
+	unsigned long budget;
+	int err;
+
+	err = strict_strtoul(buf, 10, &budget);
+	if (err || !budget || budget > 99)
+		return -EINVAL;
+
+	uksm_cpu_budget = budget;
+	if (uksm_cpu_governor == UKSM_GOVERNOR_BUDGET)
+		uksm_max_cpu_percentage = budget;
+
+	return count;
+}
+UKSM_ATTR(cpu_budget);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -5314,6 +5619,7 @@ static struct attribute *uksm_attrs[] = {
 	&max_cpu_percentage_attr.attr,
 	&sleep_millisecs_attr.attr,
 	&cpu_governor_attr.attr,
+	&cpu_budget_attr.attr,
 	&run_attr.attr,
 	&ema_per_page_time_attr.attr,
 	&pages_shared_attr.attr,
@@ -5336,6 +5642,131 @@ static struct attribute_group uksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+#ifdef CONFIG_DEBUG_FS
+/*
+ * debugfs uksm/vma_stats: for each process with VMAs under uksm, what
+ * scanning them has cost and what it has brought since they were created:
+ * pages scanned, pages merged, merged pages broken again by COW and the
+ * time spent scanning, in total and per VMA. A VMA with a high scan time
+ * per merged page is not worth scanning often.
+ */
+static void uksm_show_cost(struct seq_file *m, unsigned long scanned,
+			   unsigned long merged, unsigned long cowed,
+			   u64 scan_ns)
+{
+	u64 scan_us = div_u64(scan_ns, NSEC_PER_USEC);
+
+	seq_printf(m, "scanned %lu merged %lu cowed %lu scan_us %llu ",
+		   scanned, merged, cowed, scan_us);
+	if (merged)
+		seq_printf(m, "us_per_merge %llu\n", div_u64(scan_us, merged));
+	else
+		seq_puts(m, "us_per_merge -\n");
+}
+
+static void uksm_show_mm(struct seq_file *m, struct task_struct *task,
+			 struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	struct vma_slot *slot;
+	unsigned long scanned = 0, merged = 0, cowed = 0;
+	u64 scan_ns = 0;
+	char comm[TASK_COMM_LEN];
+
+	/* The slots of the VMAs still linked to the mm are not freed */
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		slot = vma->uksm_vma_slot;
+		if (!slot)
+			continue;
+		scanned += slot->total_scanned;
+		merged += slot->total_merged;
+		cowed += slot->total_cowed;
+		scan_ns += slot->scan_ns;
+	}
+
+	if (!scanned)
+		goto out;
+
+	seq_printf(m, "%d %s: ", task_pid_nr(task), get_task_comm(comm, task));
+	uksm_show_cost(m, scanned, merged, cowed, scan_ns);
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		slot = vma->uksm_vma_slot;
+		if (!slot || !slot->total_scanned)
+			continue;
+		seq_printf(m, "  %08lx-%08lx pages %lu rung %d ",
+			   vma->vm_start, vma->vm_end, slot->pages,
+			   slot->rung ? (int)(slot->rung - uksm_scan_ladder)
+				      : -1);
+		uksm_show_cost(m, slot->total_scanned, slot->total_merged,
+			       slot->total_cowed, slot->scan_ns);
+	}
+out:
+	up_read(&mm->mmap_sem);
+}
+
+static int uksm_vma_stats_show(struct seq_file *m, void *v)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct pid *pid;
+	int nr = 1;
+
+	for (;;) {
+		rcu_read_lock();
+		pid = find_ge_pid(nr, &init_pid_ns);
+		if (!pid) {
+			rcu_read_unlock();
+			break;
+		}
+		nr = pid_nr(pid) + 1;
+		task = pid_task(pid, PIDTYPE_PID);
+		if (!task || !has_group_leader_pid(task)) {
+			rcu_read_unlock();
+			continue;
+		}
+		get_task_struct(task);
+		rcu_read_unlock();
+
+		mm = get_task_mm(task);
+		if (mm) {
+			uksm_show_mm(m, task, mm);
+			mmput(mm);
+		}
+		put_task_struct(task);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int uksm_vma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, uksm_vma_stats_show, NULL);
+}
+
+static const struct file_operations uksm_vma_stats_fops = {
+	.open		= uksm_vma_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void __init uksm_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("uksm", NULL);
+	if (IS_ERR_OR_NULL(dir) ||
+	    !debugfs_create_file("vma_stats", S_IRUSR, dir, NULL,
+				 &uksm_vma_stats_fops))
+		printk(KERN_WARNING "uksm: register debugfs failed\n");
+}
+#else
+static inline void uksm_debugfs_init(void) { }
+#endif /* CONFIG_DEBUG_FS */
+
 static inline void init_scan_ladder(void)
 {
 	int i;
@@ -5595,6 +6026,12 @@ static int __init uksm_init(void)
 
 #endif /* CONFIG_SYSFS */
 
+	uksm_debugfs_init();
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	register_early_suspend(&uksm_early_suspend_desc);
+#endif
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 	/*
 	 * Choose a high priority since the callback takes uksm_thread_mutex:
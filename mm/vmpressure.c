@@ -0,0 +1,162 @@
+/*
+ * mm/vmpressure.c
+ *
+ * Reclaim efficiency based memory pressure notifications.
+ *
+ * Released under the GPL, see the file COPYING for details.
+ *
+ * Every window of pages scanned by reclaim yields a pressure value,
+ * the share of scanned pages that could not be reclaimed. A reclaimer
+ * that finds plenty of clean cache sees a pressure close to zero;
+ * one that keeps scanning without freeing anything is close to 100,
+ * which means the system is about to start thrashing or run out of
+ * memory. Subscribers, such as the Android low memory killer, are
+ * told about the level and can act before the OOM killer has to.
+ */
+
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/vmpressure.h>
+#include <linux/workqueue.h>
+
+/*
+ * Pages to scan before the pressure is evaluated: small enough for
+ * the events to be timely, large enough not to flood subscribers.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Pressure thresholds, in percent, of the medium and critical levels */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+/*
+ * Reclaim dropping to this priority means that it has scanned 1/8th
+ * of the LRUs several times over without reaching its target: report
+ * that as critical whatever the efficiency of the last window.
+ */
+static const int vmpressure_level_critical_prio = ilog2(100 / 10);
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notifier);
+
+static enum vmpressure_levels vmpressure_level(unsigned long pressure)
+{
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	else if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static unsigned long vmpressure_calc(unsigned long scanned,
+				     unsigned long reclaimed)
+{
+	unsigned long scale = scanned + reclaimed;
+	unsigned long pressure;
+
+	/*
+	 * Reclaimed can exceed scanned when slab or THP pages are freed
+	 * along the way; treat that as no pressure at all.
+	 */
+	if (reclaimed >= scanned)
+		return 0;
+
+	pressure = scale - (reclaimed * scale / scanned);
+	pressure = pressure * 100 / scale;
+
+	pr_debug("%s: %3lu  (s: %lu  r: %lu)\n", __func__, pressure,
+		 scanned, reclaimed);
+
+	return pressure;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	struct vmpressure_event event;
+	unsigned long scanned, reclaimed;
+
+	spin_lock(&vmpressure_lock);
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	if (!scanned)
+		return;
+
+	event.pressure = vmpressure_calc(scanned, reclaimed);
+	event.level = vmpressure_level(event.pressure);
+
+	blocking_notifier_call_chain(&vmpressure_notifier, event.level,
+				     &event);
+}
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+/**
+ * vmpressure() - Account memory pressure through scanned/reclaimed ratio
+ * @gfp:	reclaimer's gfp mask
+ * @scanned:	number of pages scanned
+ * @reclaimed:	number of pages reclaimed
+ *
+ * Called from the reclaim paths after each zone has been shrunk. The
+ * evaluation and the notifications are deferred to a work item, so
+ * this is cheap and may be called with any locks held.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	/*
+	 * Only user and page cache allocations are of interest: if the
+	 * kernel cannot find memory for a GFP_NOIO allocation, it is not
+	 * a sign that the applications are short of it.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	scanned = vmpressure_scanned;
+	spin_unlock(&vmpressure_lock);
+
+	if (scanned < vmpressure_win)
+		return;
+	schedule_work(&vmpressure_work);
+}
+
+/**
+ * vmpressure_prio() - Account memory pressure through reclaimer priority
+ * @gfp:	reclaimer's gfp mask
+ * @prio:	reclaimer's priority
+ *
+ * Called at the start of each reclaim priority pass.
+ */
+void vmpressure_prio(gfp_t gfp, int prio)
+{
+	if (prio > vmpressure_level_critical_prio)
+		return;
+
+	/* A full window with nothing reclaimed: critical */
+	vmpressure(gfp, vmpressure_win, 0);
+}
+
+int vmpressure_notifier_register(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_register);
+
+int vmpressure_notifier_unregister(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_unregister);
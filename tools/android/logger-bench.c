@@ -0,0 +1,223 @@
+/*
+ * logger-bench.c -- write throughput of the Android logger at N threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o logger-bench logger-bench.c -lpthread */
+
+/*
+ * Each thread writes entries the way liblog does, as a three element
+ * writev() of priority, tag and message, as fast as it can. The total
+ * number of entries per second is reported for every thread count from
+ * 1 to the given maximum, together with the slowest single write seen,
+ * which is what a UI thread logging during a frame would suffer.
+ *
+ * Optionally, a number of threads keep reading the log at the same
+ * time, as logcat does.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_PRIO_INFO	4
+#define READ_BUF_SIZE	(5 * 1024)
+
+static const char *log_path = "/dev/log/main";
+static int max_threads = 4;
+static int nr_readers;
+static long nr_writes = 100000;
+static size_t msg_size = 64;
+
+static volatile int stop_readers;
+
+struct writer {
+	pthread_t thread;
+	long long max_ns;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char prio = LOG_PRIO_INFO;
+	char tag[] = "logger-bench";
+	char *msg;
+	struct iovec iov[3];
+	long i;
+	int fd;
+
+	fd = open(log_path, O_WRONLY);
+	if (fd < 0) {
+		perror(log_path);
+		exit(1);
+	}
+
+	msg = malloc(msg_size);
+	if (!msg) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(msg, 'x', msg_size - 1);
+	msg[msg_size - 1] = '\0';
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = tag;
+	iov[1].iov_len = sizeof(tag);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msg_size;
+
+	for (i = 0; i < nr_writes; i++) {
+		long long t = now_ns();
+
+		if (writev(fd, iov, 3) < 0) {
+			perror("writev");
+			exit(1);
+		}
+
+		t = now_ns() - t;
+		if (t > w->max_ns)
+			w->max_ns = t;
+	}
+
+	free(msg);
+	close(fd);
+	return NULL;
+}
+
+static void *reader_fn(void *arg)
+{
+	char buf[READ_BUF_SIZE];
+	int fd;
+
+	(void)arg;
+
+	fd = open(log_path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(log_path);
+		exit(1);
+	}
+
+	while (!stop_readers) {
+		if (read(fd, buf, sizeof(buf)) < 0 && errno == EAGAIN)
+			usleep(1000);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void run(int nr_threads)
+{
+	struct writer *writers;
+	pthread_t *readers;
+	long long start, elapsed, max_ns = 0;
+	int i;
+
+	writers = calloc(nr_threads, sizeof(*writers));
+	readers = calloc(nr_readers ? nr_readers : 1, sizeof(*readers));
+	if (!writers || !readers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	stop_readers = 0;
+	for (i = 0; i < nr_readers; i++)
+		pthread_create(&readers[i], NULL, reader_fn, NULL);
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&writers[i].thread, NULL, writer_fn,
+			       &writers[i]);
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(writers[i].thread, NULL);
+		if (writers[i].max_ns > max_ns)
+			max_ns = writers[i].max_ns;
+	}
+	elapsed = now_ns() - start;
+
+	stop_readers = 1;
+	for (i = 0; i < nr_readers; i++)
+		pthread_join(readers[i], NULL);
+
+	printf("%7d %12.0f %10.0f %10lld\n", nr_threads,
+	       (double)nr_threads * nr_writes * 1e9 / elapsed,
+	       (double)elapsed / ((double)nr_threads * nr_writes),
+	       max_ns / 1000);
+
+	free(writers);
+	free(readers);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-l log] [-t max_threads] [-n writes_per_thread]\n"
+		"          [-s msg_size] [-r readers]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "l:t:n:s:r:")) != -1) {
+		switch (opt) {
+		case 'l':
+			log_path = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_writes = atol(optarg);
+			break;
+		case 's':
+			msg_size = atol(optarg);
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || nr_writes < 1 || msg_size < 1 ||
+	    nr_readers < 0)
+		usage(argv[0]);
+
+	printf("%s: %ld writes of %zu bytes per thread, %d reader(s)\n",
+	       log_path, nr_writes, msg_size, nr_readers);
+	printf("%7s %12s %10s %10s\n", "threads", "writes/s", "ns/write",
+	       "max_us");
+
+	for (i = 1; i <= max_threads; i++)
+		run(i);
+
+	return 0;
+}
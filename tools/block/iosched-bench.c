@@ -0,0 +1,448 @@
+/*
+ * iosched-bench.c -- compare I/O schedulers under a mixed workload
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o iosched-bench iosched-bench.c -lpthread */
+
+/*
+ * Runs the same workload once under each I/O scheduler of the device
+ * holding a scratch file, e.g.
+ *
+ *	iosched-bench -e noop,deadline,cfq,row,sio /data/local/tmp/bench
+ *
+ * The workload mixes foreground and background I/O:
+ *
+ *  - reader threads doing random O_DIRECT reads, whose latency is what
+ *    a foreground application sees
+ *  - writer threads doing large buffered sequential writes, flushed
+ *    with fsync every few MB, like writeback or a download
+ *
+ * Random offsets come from a fixed seed, so every scheduler sees the
+ * same requests. For each scheduler the program prints the read rate
+ * and latency percentiles, the write throughput, and the kernel's own
+ * dispatch and completion latency histograms when the kernel has them
+ * (CONFIG_BLK_LATENCY_HIST).
+ *
+ * The scratch file lives on a filesystem so that nothing but that file
+ * is overwritten. ramdisks, zram and loop devices take bios directly
+ * and have no I/O scheduler: use a request based device such as the
+ * eMMC or an SD card.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS	16
+#define LAT_BUCKETS	32	/* power of two buckets of usecs */
+
+struct thread {
+	pthread_t thread;
+	int id;
+	unsigned long long ops;
+	unsigned long long bytes;
+	unsigned long long lat[LAT_BUCKETS];
+	long long lat_max;
+};
+
+static const char *path;
+static char queue_dir[128];
+static unsigned long file_mb = 64;
+static unsigned long read_kb = 4;
+static unsigned long write_kb = 128;
+static unsigned long fsync_mb = 4;
+static int nr_readers = 2;
+static int nr_writers = 1;
+static int seconds = 10;
+static unsigned int seed = 1;
+
+static struct thread readers[MAX_THREADS];
+static struct thread writers[MAX_THREADS];
+static volatile int stop;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void add_latency(struct thread *t, long long us)
+{
+	int bucket = 0;
+
+	while (bucket < LAT_BUCKETS - 1 && (2LL << bucket) <= us)
+		bucket++;
+	t->lat[bucket]++;
+	if (us > t->lat_max)
+		t->lat_max = us;
+}
+
+/* Upper bound of the bucket holding the given percentile */
+static long long percentile(unsigned long long *lat, int pct)
+{
+	unsigned long long total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		total += lat[i];
+	if (!total)
+		return 0;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		sum += lat[i];
+		if (sum * 100 >= total * pct)
+			break;
+	}
+	return 2LL << i;
+}
+
+static void *reader(void *arg)
+{
+	struct thread *t = arg;
+	unsigned long nr_blocks = (file_mb << 10) / read_kb;
+	unsigned int rand_state = seed + t->id;
+	size_t size = read_kb << 10;
+	void *buf;
+	int fd;
+
+	if (posix_memalign(&buf, 4096, size)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+
+	fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		/* Not all filesystems do O_DIRECT */
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			perror(path);
+			exit(1);
+		}
+	}
+
+	while (!stop) {
+		off_t off = (off_t)(rand_r(&rand_state) % nr_blocks) * size;
+		long long start = now_us();
+
+		posix_fadvise(fd, off, size, POSIX_FADV_DONTNEED);
+		if (pread(fd, buf, size, off) != (ssize_t)size) {
+			perror("pread");
+			exit(1);
+		}
+		add_latency(t, now_us() - start);
+		t->ops++;
+		t->bytes += size;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct thread *t = arg;
+	unsigned long long area = (file_mb << 20) / nr_writers;
+	unsigned long long start_off = area * t->id;
+	unsigned long long off = 0, since_sync = 0;
+	size_t size = write_kb << 10;
+	char *buf;
+	int fd;
+
+	buf = malloc(size);
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(buf, 0x5a + t->id, size);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	while (!stop) {
+		long long start = now_us();
+
+		if (off + size > area)
+			off = 0;
+		if (pwrite(fd, buf, size, start_off + off) != (ssize_t)size) {
+			perror("pwrite");
+			exit(1);
+		}
+		off += size;
+		since_sync += size;
+		if (since_sync >= fsync_mb << 20) {
+			fsync(fd);
+			since_sync = 0;
+		}
+		add_latency(t, now_us() - start);
+		t->ops++;
+		t->bytes += size;
+	}
+
+	fsync(fd);
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int write_file(const char *dir, const char *name, const char *val)
+{
+	char file[PATH_MAX];
+	FILE *f;
+	int ret;
+
+	snprintf(file, sizeof(file), "%s/%s", dir, name);
+	f = fopen(file, "w");
+	if (!f)
+		return -1;
+	ret = fputs(val, f) < 0;
+	return fclose(f) || ret ? -1 : 0;
+}
+
+static void print_file(const char *dir, const char *name)
+{
+	char file[PATH_MAX], line[256];
+	FILE *f;
+
+	snprintf(file, sizeof(file), "%s/%s", dir, name);
+	f = fopen(file, "r");
+	if (!f)
+		return;
+
+	printf("  %s:\n", name);
+	while (fgets(line, sizeof(line), f))
+		printf("  %s", line);
+	fclose(f);
+}
+
+/* Find the queue directory of the device holding the scratch file */
+static void find_queue(void)
+{
+	struct stat st;
+
+	if (stat(path, &st)) {
+		perror(path);
+		exit(1);
+	}
+
+	snprintf(queue_dir, sizeof(queue_dir), "/sys/dev/block/%u:%u/queue",
+		 major(st.st_dev), minor(st.st_dev));
+	if (access(queue_dir, F_OK)) {
+		/* A partition: the queue is the whole disk's */
+		snprintf(queue_dir, sizeof(queue_dir),
+			 "/sys/dev/block/%u:%u/../queue",
+			 major(st.st_dev), minor(st.st_dev));
+	}
+	if (access(queue_dir, F_OK)) {
+		fprintf(stderr, "%s: no I/O scheduler for this device\n",
+			path);
+		exit(1);
+	}
+}
+
+static void create_file(void)
+{
+	size_t size = 1 << 20;
+	char *buf = malloc(size);
+	unsigned long i;
+	int fd;
+
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(buf, 0xa5, size);
+
+	fd = open(path, O_WRONLY | O_CREAT, 0600);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	for (i = 0; i < file_mb; i++) {
+		if (write(fd, buf, size) != (ssize_t)size) {
+			perror("write");
+			exit(1);
+		}
+	}
+	fsync(fd);
+	close(fd);
+	free(buf);
+}
+
+static void run(const char *sched)
+{
+	unsigned long long lat[LAT_BUCKETS] = { 0 };
+	unsigned long long rops = 0, wbytes = 0;
+	long long rmax = 0, t;
+	int i, j;
+
+	if (write_file(queue_dir, "scheduler", sched)) {
+		fprintf(stderr, "%s: cannot select %s\n", queue_dir, sched);
+		return;
+	}
+
+	sync();
+	write_file("/proc/sys/vm", "drop_caches", "3");
+	write_file(queue_dir, "dispatch_latency", "0");
+	write_file(queue_dir, "completion_latency", "0");
+
+	memset(readers, 0, sizeof(readers));
+	memset(writers, 0, sizeof(writers));
+	stop = 0;
+
+	t = now_us();
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].id = i;
+		pthread_create(&readers[i].thread, NULL, reader, &readers[i]);
+	}
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].id = i;
+		pthread_create(&writers[i].thread, NULL, writer, &writers[i]);
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_readers; i++)
+		pthread_join(readers[i].thread, NULL);
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(writers[i].thread, NULL);
+	t = now_us() - t;
+
+	for (i = 0; i < nr_readers; i++) {
+		rops += readers[i].ops;
+		if (readers[i].lat_max > rmax)
+			rmax = readers[i].lat_max;
+		for (j = 0; j < LAT_BUCKETS; j++)
+			lat[j] += readers[i].lat[j];
+	}
+	for (i = 0; i < nr_writers; i++)
+		wbytes += writers[i].bytes;
+
+	printf("\n%s:\n", sched);
+	printf("  reads:  %8.1f IOPS, latency p50 < %lld us, p95 < %lld us, "
+	       "p99 < %lld us, max %lld us\n", rops * 1e6 / t,
+	       percentile(lat, 50), percentile(lat, 95), percentile(lat, 99),
+	       rmax);
+	printf("  writes: %8.2f MB/s\n", wbytes * 1e6 / t / (1 << 20));
+
+	print_file(queue_dir, "dispatch_latency");
+	print_file(queue_dir, "completion_latency");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-e sched[,sched...]] [-t seconds] [-r readers]\n"
+		"          [-w writers] [-s file_mb] [-b read_kb] [-B write_kb]\n"
+		"          [-f fsync_mb] [-S seed] scratch_file\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char file[PATH_MAX], scheds[256], saved[256], current[64] = "";
+	char *sched, *p;
+	FILE *f;
+	int opt;
+
+	scheds[0] = '\0';
+	while ((opt = getopt(argc, argv, "e:t:r:w:s:b:B:f:S:")) != -1) {
+		switch (opt) {
+		case 'e':
+			snprintf(scheds, sizeof(scheds), "%s", optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'w':
+			nr_writers = atoi(optarg);
+			break;
+		case 's':
+			file_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			read_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			write_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fsync_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || seconds < 1 || !file_mb || !read_kb ||
+	    !write_kb || (file_mb << 10) < write_kb || !fsync_mb ||
+	    nr_readers < 0 || nr_readers > MAX_THREADS ||
+	    nr_writers < 0 || nr_writers > MAX_THREADS)
+		usage(argv[0]);
+	path = argv[optind];
+
+	create_file();
+	find_queue();
+
+	/* "noop deadline [row]": the current one is in brackets */
+	snprintf(file, sizeof(file), "%s/scheduler", queue_dir);
+	f = fopen(file, "r");
+	if (!f || !fgets(saved, sizeof(saved), f)) {
+		perror(queue_dir);
+		return 1;
+	}
+	fclose(f);
+	p = strchr(saved, '[');
+	if (p)
+		sscanf(p + 1, "%63[^]]", current);
+	if (!scheds[0]) {
+		for (p = saved; *p; p++)
+			if (*p == '[' || *p == ']' || *p == '\n')
+				*p = ' ';
+		snprintf(scheds, sizeof(scheds), "%s", saved);
+	}
+
+	printf("%s: %lu MB, %d readers of %lu KB, %d writers of %lu KB, "
+	       "%d s per scheduler\n", path, file_mb, nr_readers, read_kb,
+	       nr_writers, write_kb, seconds);
+
+	for (sched = strtok(scheds, ", "); sched; sched = strtok(NULL, ", "))
+		run(sched);
+
+	if (current[0])
+		write_file(queue_dir, "scheduler", current);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,467 @@
+/*
+ * governor-replay.c -- compare cpufreq governors on a recorded load trace
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -o governor-replay governor-replay.c */
+
+/*
+ * A trace is a list of "busy_us idle_us" pairs, one per line. It can be
+ * recorded on the device from /proc/stat while the workload of interest
+ * runs:
+ *
+ *	governor-replay -R 30 > scroll.trace
+ *
+ * and is then replayed under each governor in turn, on one CPU, with
+ * the real governors of the running kernel making the decisions:
+ *
+ *	governor-replay -g interactive,ondemand,smartassH3 scroll.trace
+ *
+ * Busy time is replayed as an amount of work, calibrated at the fastest
+ * speed, so a governor that runs too slow makes the busy periods last
+ * longer; idle time is replayed as is. For each governor the program
+ * reports:
+ *
+ *  - how long the busy periods took beyond their length at full speed,
+ *    i.e. what the workload lost to the governor
+ *  - the time spent at each frequency, from cpufreq_stats
+ *  - an energy proxy: the time at each frequency weighted by the power
+ *    given with -p, or by (f / fmax)^3 when no power table is given
+ *  - the ramp latency: how long after the start of a busy period the
+ *    CPU reached the ramp frequency (-r, the fastest speed by default)
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FREQS	32
+#define RAMP_POLL_US	500
+#define RECORD_US	10000
+
+struct segment {
+	long busy_us;
+	long idle_us;
+};
+
+struct freq_stat {
+	unsigned long khz;
+	unsigned long long time;	/* in 10 ms units, as in sysfs */
+	double power;
+};
+
+static int cpu;
+static const char *ramp_arg;
+static const char *power_path;
+static int loops = 1;
+
+static struct segment *trace;
+static int nr_segments;
+
+static struct freq_stat freqs[MAX_FREQS];
+static int nr_freqs;
+
+static double work_per_us;
+static volatile unsigned long sink;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static char *cpufreq_path(const char *file)
+{
+	static char path[128];
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq/%s", cpu, file);
+	return path;
+}
+
+static void write_sysfs(const char *file, const char *val)
+{
+	FILE *f = fopen(cpufreq_path(file), "w");
+
+	if (!f || fputs(val, f) < 0 || fclose(f)) {
+		perror(cpufreq_path(file));
+		exit(1);
+	}
+}
+
+static unsigned long read_sysfs_ulong(const char *file)
+{
+	FILE *f = fopen(cpufreq_path(file), "r");
+	unsigned long val;
+
+	if (!f || fscanf(f, "%lu", &val) != 1) {
+		perror(cpufreq_path(file));
+		exit(1);
+	}
+	fclose(f);
+	return val;
+}
+
+/* Fills in or updates freqs[] from cpufreq_stats */
+static void read_time_in_state(void)
+{
+	FILE *f = fopen(cpufreq_path("stats/time_in_state"), "r");
+	unsigned long khz;
+	unsigned long long time;
+	int i = 0;
+
+	if (!f) {
+		perror(cpufreq_path("stats/time_in_state"));
+		exit(1);
+	}
+
+	while (i < MAX_FREQS && fscanf(f, "%lu %llu", &khz, &time) == 2) {
+		freqs[i].khz = khz;
+		freqs[i].time = time;
+		i++;
+	}
+	fclose(f);
+	nr_freqs = i;
+}
+
+static unsigned long max_khz(void)
+{
+	unsigned long max = 0;
+	int i;
+
+	for (i = 0; i < nr_freqs; i++)
+		if (freqs[i].khz > max)
+			max = freqs[i].khz;
+	return max;
+}
+
+static void read_power_table(void)
+{
+	unsigned long khz;
+	double mw;
+	double fmax = max_khz();
+	FILE *f;
+	int i;
+
+	for (i = 0; i < nr_freqs; i++) {
+		double r = freqs[i].khz / fmax;
+
+		freqs[i].power = r * r * r;
+	}
+
+	if (!power_path)
+		return;
+
+	f = fopen(power_path, "r");
+	if (!f) {
+		perror(power_path);
+		exit(1);
+	}
+	for (i = 0; i < nr_freqs; i++)
+		freqs[i].power = 0;
+	while (fscanf(f, "%lu %lf", &khz, &mw) == 2)
+		for (i = 0; i < nr_freqs; i++)
+			if (freqs[i].khz == khz)
+				freqs[i].power = mw;
+	fclose(f);
+}
+
+static void spin(unsigned long n)
+{
+	unsigned long i;
+
+	for (i = 0; i < n; i++)
+		sink += i;
+}
+
+/* Measure how much work a microsecond holds at the fastest speed */
+static void calibrate(void)
+{
+	unsigned long n = 1000;
+	long long t;
+
+	write_sysfs("scaling_governor", "performance");
+	usleep(100000);
+
+	for (;;) {
+		t = now_us();
+		spin(n);
+		t = now_us() - t;
+		if (t > 200000)
+			break;
+		n *= 2;
+	}
+	work_per_us = (double)n / t;
+}
+
+static void parse_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	int size = 0;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct segment seg;
+
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%ld %ld", &seg.busy_us, &seg.idle_us) != 2 ||
+		    seg.busy_us < 0 || seg.idle_us < 0)
+			continue;
+
+		if (nr_segments == size) {
+			size = size ? size * 2 : 256;
+			trace = realloc(trace, size * sizeof(*trace));
+			if (!trace) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		trace[nr_segments++] = seg;
+	}
+	fclose(f);
+
+	if (!nr_segments) {
+		fprintf(stderr, "%s: no segments\n", path);
+		exit(1);
+	}
+}
+
+/* Sample /proc/stat for this CPU and print the trace to stdout */
+static void record(int seconds)
+{
+	char name[16], line[256];
+	unsigned long long v[8], busy, idle, last_busy = 0, last_idle = 0;
+	long long end = now_us() + seconds * 1000000LL;
+	long ticks_us = 1000000 / sysconf(_SC_CLK_TCK);
+	int first = 1;
+
+	snprintf(name, sizeof(name), "cpu%d ", cpu);
+	printf("# busy_us idle_us, cpu%d sampled every %d us\n", cpu,
+	       RECORD_US);
+
+	while (now_us() < end) {
+		FILE *f = fopen("/proc/stat", "r");
+		int found = 0;
+
+		if (!f) {
+			perror("/proc/stat");
+			exit(1);
+		}
+		while (!found && fgets(line, sizeof(line), f))
+			found = !strncmp(line, name, strlen(name));
+		fclose(f);
+		if (!found) {
+			fprintf(stderr, "cpu%d is not in /proc/stat\n", cpu);
+			exit(1);
+		}
+
+		memset(v, 0, sizeof(v));
+		sscanf(line + strlen(name),
+		       "%llu %llu %llu %llu %llu %llu %llu %llu",
+		       &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+		idle = v[3] + v[4];
+		busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+
+		if (!first)
+			printf("%lld %lld\n",
+			       (long long)(busy - last_busy) * ticks_us,
+			       (long long)(idle - last_idle) * ticks_us);
+		first = 0;
+		last_busy = busy;
+		last_idle = idle;
+
+		usleep(RECORD_US);
+	}
+}
+
+static void replay(const char *governor, unsigned long ramp_khz)
+{
+	unsigned long long before[MAX_FREQS];
+	long long start, t, lost = 0, ramp_total = 0, ramp_max = 0;
+	long nr_ramps = 0, nr_missed = 0, nr_busy = 0;
+	double energy = 0, total = 0;
+	int i, l;
+
+	write_sysfs("scaling_governor", governor);
+	/* Let the governor settle at its idle speed */
+	usleep(500000);
+
+	read_time_in_state();
+	for (i = 0; i < nr_freqs; i++)
+		before[i] = freqs[i].time;
+
+	start = now_us();
+	for (l = 0; l < loops; l++) {
+		for (i = 0; i < nr_segments; i++) {
+			struct segment *seg = &trace[i];
+			unsigned long work = seg->busy_us * work_per_us;
+			unsigned long chunk = RAMP_POLL_US * work_per_us;
+			long long ramp = -1;
+
+			if (!seg->busy_us)
+				goto idle;
+
+			t = now_us();
+			while (work) {
+				unsigned long n = work < chunk ? work : chunk;
+
+				spin(n);
+				work -= n;
+				if (ramp < 0 &&
+				    read_sysfs_ulong("scaling_cur_freq") >=
+				    ramp_khz)
+					ramp = now_us() - t;
+			}
+			t = now_us() - t;
+
+			nr_busy++;
+			if (t > seg->busy_us)
+				lost += t - seg->busy_us;
+			if (ramp >= 0) {
+				nr_ramps++;
+				ramp_total += ramp;
+				if (ramp > ramp_max)
+					ramp_max = ramp;
+			} else {
+				nr_missed++;
+			}
+idle:
+			if (seg->idle_us)
+				usleep(seg->idle_us);
+		}
+	}
+	t = now_us() - start;
+
+	read_time_in_state();
+
+	printf("\n%s: %.2f s, busy periods %.2f s longer than at full speed\n",
+	       governor, t / 1e6, lost / 1e6);
+	printf("  ramp to %lu kHz: %ld of %ld busy periods, avg %lld us, "
+	       "max %lld us\n", ramp_khz, nr_ramps, nr_busy,
+	       nr_ramps ? ramp_total / nr_ramps : 0, ramp_max);
+	if (nr_missed)
+		printf("  %ld busy periods ended before the ramp\n", nr_missed);
+
+	for (i = 0; i < nr_freqs; i++)
+		total += freqs[i].time - before[i];
+	printf("  %10s %8s %6s\n", "kHz", "time_s", "%");
+	for (i = 0; i < nr_freqs; i++) {
+		unsigned long long d = freqs[i].time - before[i];
+
+		energy += d * freqs[i].power / 100.0;
+		if (!d)
+			continue;
+		printf("  %10lu %8.2f %6.1f\n", freqs[i].khz, d / 100.0,
+		       total ? 100.0 * d / total : 0);
+	}
+	printf("  energy: %.3f %s\n", energy,
+	       power_path ? "mJ" : "units of a second at full speed");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-c cpu] [-g gov[,gov...]] [-r ramp_khz] [-p power_table]\n"
+		"          [-l loops] trace\n"
+		"       %s [-c cpu] -R seconds > trace\n", name, name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	char *governors = "interactive,ondemand,conservative";
+	char saved_governor[64];
+	unsigned long ramp_khz;
+	cpu_set_t mask;
+	int record_s = 0;
+	char *gov;
+	FILE *f;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:g:r:p:l:R:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'g':
+			governors = optarg;
+			break;
+		case 'r':
+			ramp_arg = optarg;
+			break;
+		case 'p':
+			power_path = optarg;
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'R':
+			record_s = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (cpu < 0 || loops < 1 || record_s < 0)
+		usage(argv[0]);
+
+	if (record_s) {
+		record(record_s);
+		return 0;
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+	parse_trace(argv[optind]);
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask)) {
+		perror("sched_setaffinity");
+		return 1;
+	}
+
+	f = fopen(cpufreq_path("scaling_governor"), "r");
+	if (!f || !fgets(saved_governor, sizeof(saved_governor), f)) {
+		perror(cpufreq_path("scaling_governor"));
+		return 1;
+	}
+	fclose(f);
+
+	read_time_in_state();
+	read_power_table();
+	ramp_khz = ramp_arg ? strtoul(ramp_arg, NULL, 0) : max_khz();
+
+	calibrate();
+	printf("cpu%d: %d segments x %d, %.1f work/us at %lu kHz\n", cpu,
+	       nr_segments, loops, work_per_us, max_khz());
+
+	for (gov = strtok(governors, ","); gov; gov = strtok(NULL, ","))
+		replay(gov, ramp_khz);
+
+	write_sysfs("scaling_governor", saved_governor);
+	return 0;
+}